@@ -0,0 +1,174 @@
+//
+//  arena.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct arena_block {
+	struct arena_block *prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+// Memory is handed out from the newest block. When it runs out a bigger block
+// is added, and on reset all blocks are merged into one that is big enough for
+// everything that was used. After a few expressions the arena has grown to fit
+// the workload and allocating from it never touches the heap.
+struct arena {
+	struct arena_block *block;
+	size_t total;		// Sum of all block sizes
+	void *last;			// Most recent allocation, can be grown in place
+	size_t allocs;		// Number of heap allocations made
+};
+
+size_t align_up(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+struct arena_block *arena_block_new(struct arena *arena, size_t size)
+{
+	struct arena_block *block = malloc(sizeof(*block) + size);
+
+	if (block) {
+		block->prev = NULL;
+		block->size = size;
+		block->used = 0;
+		arena->allocs++;
+	}
+
+	return block;
+}
+
+struct arena *arena_new(size_t size)
+{
+	struct arena *arena = malloc(sizeof(*arena));
+
+	if (arena == NULL)
+		return NULL;
+
+	arena->allocs = 1;
+	arena->last = NULL;
+	arena->total = align_up(size);
+	arena->block = arena_block_new(arena, arena->total);
+
+	if (arena->block == NULL) {
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void arena_free(struct arena *arena)
+{
+	if (arena) {
+		struct arena_block *block = arena->block;
+
+		while (block) {
+			struct arena_block *prev = block->prev;
+
+			free(block);
+			block = prev;
+		}
+
+		free(arena);
+	}
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_block *block = arena->block;
+	void *ptr;
+
+	size = align_up(size);
+
+	if (block->size - block->used < size) {
+		size_t new_size = block->size * 2;
+
+		while (new_size < size)
+			new_size *= 2;
+
+		block = arena_block_new(arena, new_size);
+
+		if (block == NULL)
+			return NULL;
+
+		block->prev = arena->block;
+		arena->block = block;
+		arena->total += new_size;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+	arena->last = ptr;
+
+	return ptr;
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+					size_t new_size)
+{
+	struct arena_block *block = arena->block;
+
+	if (ptr == NULL)
+		return arena_alloc(arena, new_size);
+
+	// The last allocation can grow without moving if there is room after it
+	if (ptr == arena->last) {
+		size_t offset = (char *)ptr - block->data;
+
+		if (block->size - offset >= align_up(new_size)) {
+			block->used = offset + align_up(new_size);
+			return ptr;
+		}
+	}
+
+	{
+		void *new_ptr = arena_alloc(arena, new_size);
+
+		if (new_ptr)
+			memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+
+		return new_ptr;
+	}
+}
+
+// Release all allocations. Memory is kept for reuse.
+void arena_reset(struct arena *arena)
+{
+	struct arena_block *block = arena->block;
+
+	if (block->prev) {
+		// Replace all blocks with a single one of the same total size. If
+		// that fails the old blocks are kept, only the newest is reused.
+		struct arena_block *merged = arena_block_new(arena, arena->total);
+
+		if (merged) {
+			while (block) {
+				struct arena_block *prev = block->prev;
+
+				free(block);
+				block = prev;
+			}
+
+			arena->block = merged;
+		}
+	}
+
+	arena->block->used = 0;
+	arena->last = NULL;
+}
+
+size_t arena_allocs(struct arena *arena)
+{
+	return arena->allocs;
+}
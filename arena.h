@@ -0,0 +1,26 @@
+//
+//  arena.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16
+
+struct arena;
+
+struct arena *arena_new(size_t size);
+void arena_free(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+					size_t new_size);
+void arena_reset(struct arena *arena);
+size_t arena_allocs(struct arena *arena);
+
+#endif
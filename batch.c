@@ -0,0 +1,915 @@
+//
+// batch.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcalc.h"
+#include "settings.h"
+#include "batch.h"
+#include "pool.h"
+#include "num.h"
+#include "token.h"
+
+struct batch_error {
+	size_t line;		// Relative to the first line of the job
+	size_t col;			// Zero if unknown
+	enum retcode ret;
+};
+
+// A run of complete lines and the results of evaluating them
+struct batch_job {
+	char *start;
+	size_t len;
+	size_t lines;
+
+	char *out;
+	size_t out_len;
+	size_t out_size;
+
+	struct batch_error *errors;
+	size_t err_num;
+	size_t err_size;
+
+	int failed;			// Out of memory
+};
+
+struct batch {
+	struct settings *s;
+	struct pool *pool;			// NULL when single threaded
+	unsigned nworkers;
+	struct pcalc_ctx **ctx;		// One per worker
+	struct cache *cache;		// Shared by the workers, NULL if disabled
+	struct batch_job *jobs;
+	size_t job_num;
+	size_t job_size;
+
+	FILE *out;
+	FILE *err;
+	struct batch_stats stats;
+	double start;
+};
+
+// Write the decimal representation of n to buf and return its length
+size_t format_decimal(char *buf, int n)
+{
+	char tmp[16];
+	size_t len = 0;
+	unsigned int u = n < 0 ? -(unsigned int)n : (unsigned int)n;
+	char *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+
+	if (n < 0)
+		buf[len++] = '-';
+
+	memcpy(buf + len, p, tmp + sizeof(tmp) - p);
+
+	return len + (tmp + sizeof(tmp) - p);
+}
+
+// Same format as print_number, INT_MIN can not be represented
+size_t format_hex(char *buf, int n)
+{
+	const char *digits = "0123456789ABCDEF";
+	char tmp[16];
+	size_t len = 0;
+	unsigned int u;
+	char *p = tmp + sizeof(tmp);
+
+	assert(n != INT_MIN);
+
+	buf[len++] = '0';
+	buf[len++] = 'x';
+
+	if (n < 0) {
+		buf[len++] = '-';
+		n *= -1;
+	}
+
+	u = n;
+	do {
+		*--p = digits[u % 16];
+		u /= 16;
+	} while (u);
+
+	memcpy(buf + len, p, tmp + sizeof(tmp) - p);
+
+	return len + (tmp + sizeof(tmp) - p);
+}
+
+int is_blank(const char *line, size_t len)
+{
+	const char *end = line + len;
+
+	while (line < end && (*line == ' ' || *line == '\t' || *line == '\r' ||
+						  *line == '\v' || *line == '\f'))
+		line++;
+
+	return line == end;
+}
+
+// Make room for at least n more output bytes
+char *job_reserve(struct batch_job *job, size_t n)
+{
+	if (job->out_len + n > job->out_size) {
+		size_t size = job->out_size ? job->out_size * 2 : BATCH_CHUNK_SIZE;
+		char *out;
+
+		while (size < job->out_len + n)
+			size *= 2;
+
+		out = realloc(job->out, size);
+
+		if (out == NULL)
+			return NULL;
+
+		job->out = out;
+		job->out_size = size;
+	}
+
+	return job->out + job->out_len;
+}
+
+enum retcode job_add_error(struct batch_job *job, size_t line, size_t col,
+						   enum retcode ret)
+{
+	if (job->err_num == job->err_size) {
+		size_t size = job->err_size ? job->err_size * 2 : 16;
+		struct batch_error *errors;
+
+		errors = realloc(job->errors, size * sizeof(*errors));
+
+		if (errors == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		job->errors = errors;
+		job->err_size = size;
+	}
+
+	job->errors[job->err_num].line = line;
+	job->errors[job->err_num].col = col;
+	job->errors[job->err_num].ret = ret;
+	job->err_num++;
+
+	return PCALC_OK;
+}
+
+// Evaluate a line with one of the wide numeric backends, writing exactly one
+// line to the job output
+enum retcode batch_line_num(struct settings *s, struct batch_job *job,
+							char *line, size_t len)
+{
+	union num result;
+	char *str = NULL;
+	size_t str_len = 0;
+	char *errp = NULL;
+	char *p;
+	enum retcode ret;
+
+	ret = num_evaln(s->arith, &result, &errp, line, len, s->notation, NULL);
+
+	if (ret == PCALC_OK) {
+		str = num_to_str(s->arith, &result, s->output == BASE_HEX ? 16 : 10);
+		num_free(s->arith, &result);
+
+		if (str == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		str_len = strlen(str);
+	}
+	else {
+		size_t col = errp && errp >= line ? errp - line + 1 : 0;
+
+		if (job_add_error(job, job->lines, col, ret) != PCALC_OK)
+			return PCALC_MEMORY_ALLOC;
+	}
+
+	// Room for the 0x prefix and the line break
+	p = job_reserve(job, str_len + 3);
+
+	if (p == NULL) {
+		free(str);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	if (str) {
+		// Same format as format_hex, the sign follows the 0x
+		if (s->output == BASE_HEX) {
+			*p++ = '0';
+			*p++ = 'x';
+		}
+
+		memcpy(p, str, str_len);
+		p += str_len;
+		free(str);
+	}
+
+	*p++ = '\n';
+	job->out_len = p - job->out;
+
+	return PCALC_OK;
+}
+
+// Evaluate a line of len characters, writing exactly one line to the job
+// output
+enum retcode batch_line(struct settings *s, struct pcalc_ctx *ctx,
+						struct cache *cache, struct batch_job *job, char *line,
+						size_t len)
+{
+	char *p = job_reserve(job, 32);
+	int result;
+	char *errp = NULL;
+	enum retcode ret;
+
+	if (p == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	job->lines++;
+
+	if (is_blank(line, len)) {
+		*p = '\n';
+		job->out_len++;
+		return PCALC_OK;
+	}
+
+	if (s->arith != ARITH_INT)
+		return batch_line_num(s, job, line, len);
+
+	ret = cache_eval(cache, ctx, &result, &errp, line, len, s->notation, NULL);
+
+	if (ret == PCALC_OK && s->output == BASE_HEX && result == INT_MIN)
+		ret = PCALC_OUT_OF_BOUNDS;
+
+	if (ret == PCALC_OK) {
+		switch (s->output) {
+			case BASE_DECIMAL:
+				p += format_decimal(p, result);
+				break;
+
+			case BASE_HEX:
+				p += format_hex(p, result);
+				break;
+
+			default:
+				assert(0);
+		}
+	}
+	else {
+		size_t col = errp && errp >= line ? errp - line + 1 : 0;
+
+		if (job_add_error(job, job->lines, col, ret) != PCALC_OK)
+			return PCALC_MEMORY_ALLOC;
+	}
+
+	*p++ = '\n';
+	job->out_len = p - job->out;
+
+	return PCALC_OK;
+}
+
+// Evaluate every line of a job. The input is only read, so it may be mapped
+// read-only.
+void batch_job_run(void *arg, size_t index, unsigned worker)
+{
+	struct batch *b = arg;
+	struct batch_job *job = &b->jobs[index];
+	char *line = job->start;
+	char *end = job->start + job->len;
+
+	job->lines = 0;
+	job->out_len = 0;
+	job->err_num = 0;
+	job->failed = 0;
+
+	while (line < end) {
+		char *nl = memchr(line, '\n', end - line);
+
+		if (nl == NULL)
+			nl = end;		// Last line of the input
+
+		if (batch_line(b->s, b->ctx[worker], b->cache, job, line, nl - line)
+			!= PCALC_OK) {
+			job->failed = 1;
+			return;
+		}
+
+		line = nl + 1;
+	}
+}
+
+void batch_job_write(struct batch_job *job, size_t first_line, FILE *out,
+					 FILE *err, struct batch_stats *stats)
+{
+	fwrite(job->out, 1, job->out_len, out);
+
+	for (size_t i = 0; i < job->err_num; i++) {
+		struct batch_error *e = &job->errors[i];
+
+		if (e->col)
+			fprintf(err, "%zu:%zu: %s\n", first_line + e->line, e->col,
+					retcode_str(e->ret));
+		else
+			fprintf(err, "%zu: %s\n", first_line + e->line,
+					retcode_str(e->ret));
+	}
+
+	stats->lines += job->lines;
+	stats->errors += job->err_num;
+}
+
+// Split len bytes of complete lines into jobs of about BATCH_CHUNK_SIZE
+enum retcode batch_split(struct batch *b, char *start, size_t len)
+{
+	char *end = start + len;
+
+	b->job_num = 0;
+
+	while (start < end) {
+		struct batch_job *job;
+		char *stop = end;
+
+		if (end - start > BATCH_CHUNK_SIZE) {
+			stop = memchr(start + BATCH_CHUNK_SIZE, '\n',
+						  end - start - BATCH_CHUNK_SIZE);
+			stop = stop ? stop + 1 : end;
+		}
+
+		if (b->job_num == b->job_size) {
+			size_t size = b->job_size ? b->job_size * 2 : 64;
+			struct batch_job *jobs = realloc(b->jobs, size * sizeof(*jobs));
+
+			if (jobs == NULL)
+				return PCALC_MEMORY_ALLOC;
+
+			memset(jobs + b->job_size, 0,
+				   (size - b->job_size) * sizeof(*jobs));
+			b->jobs = jobs;
+			b->job_size = size;
+		}
+
+		job = &b->jobs[b->job_num++];
+		job->start = start;
+		job->len = stop - start;
+		start = stop;
+	}
+
+	return PCALC_OK;
+}
+
+// Fill buf from fd until it is full or the input ends
+ssize_t batch_read(int fd, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size) {
+		ssize_t n = read(fd, buf + len, size - len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+		else if (n == 0) {
+			break;
+		}
+
+		len += n;
+	}
+
+	return len;
+}
+
+double batch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum retcode batch_init(struct batch *b, struct settings *s, FILE *out,
+						FILE *err)
+{
+	memset(b, 0, sizeof(*b));
+	b->s = s;
+	b->out = out;
+	b->err = err;
+	b->start = batch_now();
+	b->nworkers = s->jobs > 1 ? s->jobs : 1;
+	b->ctx = calloc(b->nworkers, sizeof(*b->ctx));
+
+	if (b->ctx == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	// The bindings don't change during the run, so results with variables
+	// are cached like any other
+	for (unsigned i = 0; i < b->nworkers; i++) {
+		if ((b->ctx[i] = pcalc_ctx_new()) == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		pcalc_ctx_set_vars(b->ctx[i], s->vars);
+	}
+
+	if (b->nworkers > 1 && (b->pool = pool_new(b->nworkers)) == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (s->cache > 0 && (b->cache = cache_new(s->cache)) == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	return PCALC_OK;
+}
+
+// Evaluate len bytes of complete lines and write the results in order
+enum retcode batch_process(struct batch *b, char *start, size_t len)
+{
+	enum retcode ret = batch_split(b, start, len);
+
+	if (ret != PCALC_OK)
+		return ret;
+
+	if (b->pool) {
+		if (!pool_start(b->pool, b->job_num, batch_job_run, b))
+			return PCALC_MEMORY_ALLOC;
+
+		for (size_t i = 0; i < b->job_num; i++) {
+			struct batch_job *job = &b->jobs[i];
+
+			pool_wait_job(b->pool, i);
+
+			if (job->failed)
+				ret = PCALC_MEMORY_ALLOC;
+			else if (ret == PCALC_OK)
+				batch_job_write(job, b->stats.lines, b->out, b->err,
+								&b->stats);
+		}
+	}
+	else {
+		for (size_t i = 0; ret == PCALC_OK && i < b->job_num; i++) {
+			struct batch_job *job = &b->jobs[i];
+
+			batch_job_run(b, i, 0);
+
+			if (job->failed)
+				ret = PCALC_MEMORY_ALLOC;
+			else
+				batch_job_write(job, b->stats.lines, b->out, b->err,
+								&b->stats);
+		}
+	}
+
+	return ret;
+}
+
+// Release everything and return the exit status
+int batch_finish(struct batch *b, enum retcode ret, int status)
+{
+	if (ret != PCALC_OK) {
+		fprintf(b->err, "Error: %s\n", retcode_str(ret));
+		status = EXIT_FAILURE;
+	}
+
+	fflush(b->out);
+
+	pool_free(b->pool);
+
+	for (size_t i = 0; i < b->job_size; i++) {
+		free(b->jobs[i].out);
+		free(b->jobs[i].errors);
+	}
+	free(b->jobs);
+
+	if (b->ctx) {
+		for (unsigned i = 0; i < b->nworkers; i++) {
+			if (b->ctx[i]) {
+				b->stats.allocs += pcalc_ctx_allocs(b->ctx[i]);
+				pcalc_ctx_free(b->ctx[i]);
+			}
+		}
+		free(b->ctx);
+	}
+
+	if (b->cache) {
+		b->stats.has_cache = 1;
+		cache_get_stats(b->cache, &b->stats.cache);
+		cache_free(b->cache);
+	}
+
+	b->stats.seconds = batch_now() - b->start;
+
+	if (b->s->stats)
+		batch_print_stats(&b->stats, b->err);
+
+	if (b->stats.errors > 0)
+		status = EXIT_FAILURE;
+
+	return status;
+}
+
+// Length of the complete lines at the start of the len bytes at buf
+size_t complete_lines(char *buf, size_t len)
+{
+	while (len > 0 && buf[len - 1] != '\n')
+		len--;
+
+	return len;
+}
+
+// Evaluate one expression per line read from fd. Results are written to out,
+// one line per input line. Failed lines produce an empty output line and an
+// error record on err. Lines are independent of each other, so 'ans' is not
+// available, and with s->jobs > 1 they are evaluated on that many threads.
+int batch_run(struct settings *s, int fd, FILE *out, FILE *err)
+{
+	struct batch b;
+	char *in = NULL;
+	size_t in_size = BATCH_BLOCK_SIZE * (s->jobs > 1 ? s->jobs : 1);
+	size_t in_len = 0;
+	int eof = 0;
+	int status = EXIT_SUCCESS;
+	enum retcode ret = batch_init(&b, s, out, err);
+
+	if (ret == PCALC_OK && (in = malloc(in_size)) == NULL)
+		ret = PCALC_MEMORY_ALLOC;
+
+	while (ret == PCALC_OK && !eof) {
+		ssize_t n = batch_read(fd, in + in_len, in_size - in_len);
+		size_t complete;
+
+		if (n < 0) {
+			perror("Reading input failed");
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		in_len += n;
+		eof = in_len < in_size;
+		complete = eof ? in_len : complete_lines(in, in_len);
+
+		if (complete == 0 && !eof) {
+			// A single line fills the whole buffer
+			char *new_in = realloc(in, in_size * 2);
+
+			if (new_in == NULL) {
+				ret = PCALC_MEMORY_ALLOC;
+			}
+			else {
+				in = new_in;
+				in_size *= 2;
+			}
+			continue;
+		}
+
+		ret = batch_process(&b, in, complete);
+
+		// Keep the incomplete last line for the next read
+		in_len -= complete;
+		memmove(in, in + complete, in_len);
+	}
+
+	free(in);
+
+	return batch_finish(&b, ret, status);
+}
+
+// Batch mode on a file. Regular files are mapped into memory and evaluated in
+// place, everything else is read like standard input.
+int batch_run_file(struct settings *s, const char *path, FILE *out, FILE *err)
+{
+	struct batch b;
+	struct stat st;
+	char *map;
+	size_t size;
+	size_t pos = 0;
+	size_t window = BATCH_BLOCK_SIZE * (s->jobs > 1 ? s->jobs : 1);
+	enum retcode ret;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		int status = batch_run(s, fd, out, err);
+
+		close(fd);
+		return status;
+	}
+
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+	ret = batch_init(&b, s, out, err);
+
+	// Hand the mapping to the workers a window at a time so that only a
+	// window's worth of output is buffered
+	while (ret == PCALC_OK && pos < size) {
+		size_t len = size - pos < window ? size - pos : window;
+		size_t complete = len;
+
+		if (pos + len < size)
+			complete = complete_lines(map + pos, len);
+
+		if (complete == 0) {
+			// A single line is longer than the window
+			window *= 2;
+			continue;
+		}
+
+		ret = batch_process(&b, map + pos, complete);
+		pos += complete;
+	}
+
+	munmap(map, size);
+
+	return batch_finish(&b, ret, EXIT_SUCCESS);
+}
+
+// A line of input in column mode
+struct column_line {
+	int blank;
+	enum retcode ret;	// Parsing the value
+	size_t col;			// Of a parse error
+};
+
+// Values of ans parsed from the lines of a block, and the results of the
+// program for them
+struct column {
+	struct column_line *lines;
+	int *ans;
+	int *results;
+	enum retcode *rets;
+	size_t size;
+};
+
+// Grow the column to n lines
+enum retcode column_reserve(struct column *c, size_t n)
+{
+	if (n > c->size) {
+		struct column_line *lines = realloc(c->lines, n * sizeof(*lines));
+		int *ans = realloc(c->ans, n * sizeof(*ans));
+		int *results = realloc(c->results, n * sizeof(*results));
+		enum retcode *rets = realloc(c->rets, n * sizeof(*rets));
+
+		// Keep whatever was reallocated so that column_free frees it
+		if (lines)
+			c->lines = lines;
+		if (ans)
+			c->ans = ans;
+		if (results)
+			c->results = results;
+		if (rets)
+			c->rets = rets;
+
+		if (lines == NULL || ans == NULL || results == NULL || rets == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		c->size = n;
+	}
+
+	return PCALC_OK;
+}
+
+void column_free(struct column *c)
+{
+	free(c->lines);
+	free(c->ans);
+	free(c->results);
+	free(c->rets);
+}
+
+// Parse a line holding a single integer literal with optional surrounding
+// whitespace
+void column_parse(struct column_line *cl, int *ans, char *line, size_t len)
+{
+	char *end = line + len;
+	char *head = line;
+	char *endp;
+
+	*ans = 0;
+	cl->blank = is_blank(line, len);
+	cl->ret = PCALC_OK;
+	cl->col = 0;
+
+	if (cl->blank)
+		return;
+
+	while (head < end && is_blank(head, 1))
+		head++;
+
+	cl->ret = lex_number(ans, head, end, &endp);
+
+	if (cl->ret == PCALC_OK && !is_blank(endp, end - endp)) {
+		cl->ret = PCALC_UKNOWN_TOKEN;
+
+		while (is_blank(endp, 1))
+			endp++;
+	}
+
+	if (cl->ret != PCALC_OK) {
+		*ans = 0;
+		cl->col = (cl->ret == PCALC_OUT_OF_BOUNDS ? head : endp) - line + 1;
+	}
+}
+
+// Run prog over the len bytes of complete lines at start, writing one line to
+// the job output for each
+enum retcode column_process(struct settings *s, struct pcalc_program *prog,
+							struct column *c, struct batch_job *job,
+							char *start, size_t len)
+{
+	char *line = start;
+	char *end = start + len;
+	size_t n = 0;
+	enum retcode ret;
+
+	job->lines = 0;
+	job->out_len = 0;
+	job->err_num = 0;
+
+	while (line < end) {
+		char *nl = memchr(line, '\n', end - line);
+
+		if (nl == NULL)
+			nl = end;		// Last line of the input
+
+		if (n == c->size &&
+			column_reserve(c, c->size ? c->size * 2 : 1024) != PCALC_OK)
+			return PCALC_MEMORY_ALLOC;
+
+		column_parse(&c->lines[n], &c->ans[n], line, nl - line);
+		n++;
+		line = nl + 1;
+	}
+
+	// Blank and invalid lines are evaluated with ans 0 and their results
+	// dropped, which keeps the column contiguous
+	ret = pcalc_exec_column(prog, c->ans, c->results, c->rets, n);
+
+	if (ret != PCALC_OK)
+		return ret;
+
+	for (size_t i = 0; i < n; i++) {
+		struct column_line *cl = &c->lines[i];
+		char *p = job_reserve(job, 32);
+		int result = c->results[i];
+
+		if (p == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		job->lines++;
+
+		if (cl->blank) {
+			// Leave the line blank
+		}
+		else if (cl->ret != PCALC_OK) {
+			ret = job_add_error(job, job->lines, cl->col, cl->ret);
+		}
+		else if (c->rets[i] != PCALC_OK ||
+				 (s->output == BASE_HEX && result == INT_MIN)) {
+			ret = job_add_error(job, job->lines, 0,
+								c->rets[i] != PCALC_OK ? c->rets[i]
+													   : PCALC_OUT_OF_BOUNDS);
+		}
+		else if (s->output == BASE_HEX) {
+			p += format_hex(p, result);
+		}
+		else {
+			p += format_decimal(p, result);
+		}
+
+		if (ret != PCALC_OK)
+			return ret;
+
+		*p++ = '\n';
+		job->out_len = p - job->out;
+	}
+
+	return PCALC_OK;
+}
+
+// Evaluate prog once for every line of fd, each holding an integer which
+// stands in for 'ans'. Output and errors are as in batch_run, but the values
+// are run through the program a column at a time instead of a line at a time.
+int batch_run_column(struct settings *s, struct pcalc_program *prog, int fd,
+					 FILE *out, FILE *err)
+{
+	struct batch_job job = {0};
+	struct column c = {0};
+	struct batch_stats stats = {0};
+	char *in = malloc(BATCH_BLOCK_SIZE);
+	size_t in_size = BATCH_BLOCK_SIZE;
+	size_t in_len = 0;
+	int eof = 0;
+	int status = EXIT_SUCCESS;
+	double start = batch_now();
+	enum retcode ret = in ? PCALC_OK : PCALC_MEMORY_ALLOC;
+
+	while (ret == PCALC_OK && !eof) {
+		ssize_t n = batch_read(fd, in + in_len, in_size - in_len);
+		size_t complete;
+
+		if (n < 0) {
+			perror("Reading input failed");
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		in_len += n;
+		eof = in_len < in_size;
+		complete = eof ? in_len : complete_lines(in, in_len);
+
+		if (complete == 0 && !eof) {
+			// A single line fills the whole buffer
+			char *new_in = realloc(in, in_size * 2);
+
+			if (new_in == NULL) {
+				ret = PCALC_MEMORY_ALLOC;
+			}
+			else {
+				in = new_in;
+				in_size *= 2;
+			}
+			continue;
+		}
+
+		ret = column_process(s, prog, &c, &job, in, complete);
+
+		if (ret == PCALC_OK)
+			batch_job_write(&job, stats.lines, out, err, &stats);
+
+		in_len -= complete;
+		memmove(in, in + complete, in_len);
+	}
+
+	free(in);
+	free(job.out);
+	free(job.errors);
+	column_free(&c);
+
+	if (ret != PCALC_OK) {
+		fprintf(err, "Error: %s\n", retcode_str(ret));
+		status = EXIT_FAILURE;
+	}
+
+	fflush(out);
+
+	stats.seconds = batch_now() - start;
+
+	if (s->stats)
+		batch_print_stats(&stats, err);
+
+	if (stats.errors > 0)
+		status = EXIT_FAILURE;
+
+	return status;
+}
+
+void batch_print_stats(struct batch_stats *stats, FILE *stream)
+{
+	double rate = stats->seconds > 0 ? stats->lines / stats->seconds : 0;
+
+	fprintf(stream,
+			"lines %zu\n"
+			"errors %zu\n"
+			"seconds %.6f\n"
+			"lines/sec %.0f\n"
+			"allocations %zu\n",
+			stats->lines, stats->errors, stats->seconds, rate,
+			stats->allocs);
+
+	if (stats->has_cache)
+		cache_print_stats(&stats->cache, stream);
+}
@@ -0,0 +1,43 @@
+//
+// batch.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <sys/types.h>
+
+#include "settings.h"
+#include "cache.h"
+
+// Size of the input and output blocks used in batch mode
+#define BATCH_BLOCK_SIZE (1 << 20)
+
+// Input is split into jobs of about this size for the worker threads
+#define BATCH_CHUNK_SIZE (1 << 16)
+
+struct batch_stats {
+	size_t lines;
+	size_t errors;
+	double seconds;
+	size_t allocs;		// Heap allocations made by the evaluator
+	int has_cache;
+	struct cache_stats cache;
+};
+
+size_t format_decimal(char *buf, int n);
+size_t format_hex(char *buf, int n);
+size_t complete_lines(char *buf, size_t len);
+int is_blank(const char *line, size_t len);
+ssize_t batch_read(int fd, char *buf, size_t size);
+int batch_run(struct settings *s, int fd, FILE *out, FILE *err);
+int batch_run_file(struct settings *s, const char *path, FILE *out, FILE *err);
+int batch_run_column(struct settings *s, struct pcalc_program *prog, int fd,
+					 FILE *out, FILE *err);
+void batch_print_stats(struct batch_stats *stats, FILE *stream);
+
+#endif
@@ -0,0 +1,889 @@
+//
+// bench.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "bignum.h"
+
+// Minimum time spent on each benchmark. Benchmarks make repeated passes over
+// their input and report the fastest pass, which is the one least disturbed
+// by other load on the machine.
+#define BENCH_SECONDS 0.5
+
+// Formulas of the image benchmark and their operands
+#define IMAGE_FORMULAS 4096
+#define IMAGE_OPERANDS 16
+
+// Operand size of the bignum benchmarks
+#define BIG_DIGITS 10000
+
+struct benchmark {
+	const char *name;
+	void (*run)(void);
+};
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Results are printed as "<benchmark> <metric> <value>" lines
+void bench_report(const char *name, const char *metric, double value)
+{
+	printf("%s %s %.0f\n", name, metric, value);
+}
+
+// Peak resident set size of the whole run, including the generated input
+void bench_report_rss(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+		bench_report("bench", "peak_rss_kb", usage.ru_maxrss / 1024.0);
+#else
+		bench_report("bench", "peak_rss_kb", usage.ru_maxrss);
+#endif
+}
+
+// Random tokens of all kinds, separated by single spaces
+char *gen_tokens(size_t count, size_t *len)
+{
+	const char *ops[] = {"+", "-", "*", "/", "ans"};
+	size_t size = count * 16;
+	char *buf = malloc(size);
+	size_t n = 0;
+
+	if (buf == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		int r = rand() % 8;
+
+		if (r < 5)
+			n += sprintf(buf + n, "%d ", rand() % 2000001 - 1000000);
+		else if (r < 6)
+			n += sprintf(buf + n, "0x%X ", rand() % 65536);
+		else
+			n += sprintf(buf + n, "%s ", ops[rand() % 5]);
+	}
+
+	*len = n;
+
+	return buf;
+}
+
+void bench_lexer(void)
+{
+	size_t len;
+	size_t count = 1 << 20;
+	char *buf = gen_tokens(count, &len);
+	char *end = buf + len;
+	size_t tokens = 0;
+	double start = bench_now();
+	double best = 0;
+
+	if (buf == NULL)
+		return;
+
+	do {
+		double pass = bench_now();
+		char *p = buf;
+
+		tokens = 0;
+
+		while (p < end) {
+			struct token token;
+
+			while (p < end && *p == ' ')
+				p++;
+
+			if (p < end) {
+				if (read_token(&token, p, end, &p, 0) != PCALC_OK)
+					abort();
+				tokens++;
+			}
+		}
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("lexer", "tokens/sec", tokens / best);
+	free(buf);
+}
+
+// A single postfix or prefix expression of count values joined by + and -,
+// with runs of up to max_space spaces between the tokens. Both notations are
+// generated so that the value stack never holds more than two values.
+char *gen_long_expr(size_t count, int max_space, int is_prefix, size_t *len)
+{
+	size_t size = count * (2 * max_space + 8);
+	char *buf = malloc(size);
+	size_t n = 0;
+
+	if (buf == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		if (is_prefix && i + 1 < count)
+			n += sprintf(buf + n, "%c%*s", i % 2 ? '+' : '-',
+						 1 + rand() % max_space, "");
+
+		n += sprintf(buf + n, "%d%*s", rand() % 1000, 1 + rand() % max_space,
+					 "");
+
+		if (!is_prefix && i > 0)
+			n += sprintf(buf + n, "%c%*s", i % 2 ? '+' : '-',
+						 1 + rand() % max_space, "");
+	}
+
+	*len = n;
+
+	return buf;
+}
+
+void bench_long(const char *name, enum notation notation, int max_space)
+{
+	size_t len;
+	char *buf = gen_long_expr(1 << 16, max_space, notation == PREFIX, &len);
+	struct pcalc_ctx *ctx = pcalc_ctx_new();
+	double start = bench_now();
+	double best = 0;
+
+	if (buf == NULL || ctx == NULL)
+		abort();
+
+	do {
+		double pass = bench_now();
+		int result;
+		char *errp;
+
+		if (pcalc_evaln(ctx, &result, &errp, buf, len, notation, NULL)
+			!= PCALC_OK)
+			abort();
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report(name, "MB/sec", len / best / 1e6);
+	pcalc_ctx_free(ctx);
+	free(buf);
+}
+
+void bench_postfix_long(void)
+{
+	bench_long("postfix_long", POSTFIX, 1);
+}
+
+void bench_prefix_long(void)
+{
+	bench_long("prefix_long", PREFIX, 1);
+}
+
+void bench_postfix_spaced(void)
+{
+	bench_long("postfix_spaced", POSTFIX, 64);
+}
+
+void bench_prefix_spaced(void)
+{
+	bench_long("prefix_spaced", PREFIX, 64);
+}
+
+// Sizes of the expressions timed by bench_expr, in operands, and the deepest
+// nesting allowed in each. Every size is evaluated in all three notations.
+struct expr_size {
+	size_t count;
+	int depth;
+};
+
+struct expr_size expr_sizes[] = {
+	{8, 4},
+	{64, 8},
+	{512, 16},
+	{4096, 24},
+};
+
+// Tokens evaluated per size and notation in each pass of bench_expr
+#define EXPR_TOKENS (1 << 18)
+
+// Append a random expression tree with count operands joined by + and - to
+// buf, in prefix or postfix order. No subtree is nested deeper than depth,
+// which must be large enough to hold count operands.
+size_t gen_tree(char *buf, size_t count, int depth, int is_prefix)
+{
+	size_t cap = depth > 30 ? (size_t)1 << 30 : (size_t)1 << (depth - 1);
+	size_t low, high, left;
+	char op = rand() % 2 ? '+' : '-';
+	size_t n = 0;
+
+	if (count == 1)
+		return sprintf(buf, "%d ", rand() % 1000);
+
+	// The left subtree gets between 1 and count - 1 operands, and neither
+	// side more than fits below depth
+	low = count > cap ? count - cap : 1;
+	high = count - 1 < cap ? count - 1 : cap;
+	left = low + rand() % (high - low + 1);
+
+	if (is_prefix)
+		n += sprintf(buf + n, "%c ", op);
+
+	n += gen_tree(buf + n, left, depth - 1, is_prefix);
+	n += gen_tree(buf + n, count - left, depth - 1, is_prefix);
+
+	if (!is_prefix)
+		n += sprintf(buf + n, "%c ", op);
+
+	return n;
+}
+
+// A valid expression of count operands in any notation, zero terminated.
+// Infix has no grouping, so depth only shapes prefix and postfix.
+char *gen_expr(size_t count, int depth, enum notation notation)
+{
+	char *buf = malloc(count * 8 + 1);
+	size_t n = 0;
+
+	if (buf == NULL)
+		return NULL;
+
+	if (notation == INFIX) {
+		for (size_t i = 0; i < count; i++) {
+			if (i > 0)
+				n += sprintf(buf + n, "%c ", rand() % 2 ? '+' : '-');
+			n += sprintf(buf + n, "%d ", rand() % 1000);
+		}
+	}
+	else {
+		n = gen_tree(buf, count, depth, notation == PREFIX);
+	}
+
+	buf[n] = '\0';
+
+	return buf;
+}
+
+// Evaluate expr with the string API, which allocates from the heap
+enum retcode bench_eval_str(char *expr, enum notation notation)
+{
+	int result;
+	char *errp;
+
+	if (notation == INFIX)
+		return inf_eval_str(&result, &errp, expr, NULL);
+	else
+		return pn_eval_str(&result, &errp, expr, notation == POSTFIX, NULL);
+}
+
+// Time random expressions of each size in each notation, through the string
+// API and through a reused context. Heap allocations are counted in the
+// context path only, where the arena makes them.
+void bench_expr(void)
+{
+	const char *names[] = {"prefix", "postfix", "infix"};
+	size_t n_sizes = sizeof(expr_sizes) / sizeof(expr_sizes[0]);
+	struct pcalc_ctx *ctx = pcalc_ctx_new();
+
+	if (ctx == NULL)
+		abort();
+
+	for (size_t s = 0; s < n_sizes; s++) {
+		for (enum notation notation = PREFIX; notation <= INFIX; notation++) {
+			size_t count = expr_sizes[s].count;
+			size_t n_exprs = EXPR_TOKENS / (2 * count - 1);
+			size_t tokens = n_exprs * (2 * count - 1);
+			char **exprs = malloc(n_exprs * sizeof(*exprs));
+			double best_str = 0, best_ctx = 0;
+			size_t allocs;
+			double start;
+			char name[32];
+
+			if (exprs == NULL)
+				abort();
+
+			for (size_t i = 0; i < n_exprs; i++) {
+				exprs[i] = gen_expr(count, expr_sizes[s].depth, notation);
+				if (exprs[i] == NULL)
+					abort();
+			}
+
+			start = bench_now();
+			do {
+				double pass = bench_now();
+
+				for (size_t i = 0; i < n_exprs; i++)
+					if (bench_eval_str(exprs[i], notation) != PCALC_OK)
+						abort();
+
+				pass = bench_now() - pass;
+				if (best_str == 0 || pass < best_str)
+					best_str = pass;
+			} while (bench_now() - start < BENCH_SECONDS);
+
+			// A fresh context shows the allocations of a cold start, amortized
+			// over one pass
+			pcalc_ctx_free(ctx);
+			ctx = pcalc_ctx_new();
+			if (ctx == NULL)
+				abort();
+
+			start = bench_now();
+			allocs = pcalc_ctx_allocs(ctx);
+			do {
+				double pass = bench_now();
+
+				for (size_t i = 0; i < n_exprs; i++) {
+					int result;
+					char *errp;
+
+					if (pcalc_eval(ctx, &result, &errp, exprs[i], notation,
+								   NULL) != PCALC_OK)
+						abort();
+				}
+
+				pass = bench_now() - pass;
+				if (best_ctx == 0) {
+					allocs = pcalc_ctx_allocs(ctx) - allocs;
+					best_ctx = pass;
+				}
+				else if (pass < best_ctx) {
+					best_ctx = pass;
+				}
+			} while (bench_now() - start < BENCH_SECONDS);
+
+			sprintf(name, "%s_%zu", names[notation], count);
+			bench_report(name, "str_ns/token", best_str / tokens * 1e9);
+			bench_report(name, "ctx_ns/token", best_ctx / tokens * 1e9);
+			printf("%s allocs/expr %.3f\n", name, (double)allocs / n_exprs);
+
+			for (size_t i = 0; i < n_exprs; i++)
+				free(exprs[i]);
+			free(exprs);
+		}
+	}
+
+	pcalc_ctx_free(ctx);
+}
+
+// Compiled machine generated expression: ans terms scaled by identities and
+// added to constant subtrees, most of which fold away
+void bench_exec(void)
+{
+	size_t terms = 1 << 10;
+	char *buf = malloc(terms * 64);
+	struct pcalc_program *prog;
+	size_t n = 0;
+	int ans = 42;
+	double start, best = 0;
+	char *errp;
+
+	if (buf == NULL)
+		abort();
+
+	n += sprintf(buf + n, "0 ");
+	for (size_t i = 0; i < terms; i++) {
+		if (i % 4 == 0)
+			n += sprintf(buf + n, "ans 1 * 0 + + ");
+		else
+			n += sprintf(buf + n, "%d %d * %d - + ", rand() % 100,
+						 rand() % 100, rand() % 100);
+	}
+
+	if (pcalc_compile(&prog, &errp, buf, POSTFIX) != PCALC_OK)
+		abort();
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+		int result;
+
+		for (int i = 0; i < 1000; i++)
+			if (pcalc_exec(&result, prog, &ans) != PCALC_OK)
+				abort();
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("exec", "execs/sec", 1000 / best);
+	bench_report("exec", "folded_nodes", pcalc_program_folded(prog));
+	pcalc_program_free(prog);
+	free(buf);
+}
+
+// An infix formula of count operands, half of them ans so that it doesn't
+// fold to a constant
+char *gen_formula(size_t count)
+{
+	const char *ops[] = {"+", "-", "xor", "min", "max"};
+	char *buf = malloc(count * 10 + 1);
+	size_t n = 0;
+
+	if (buf == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		if (i > 0)
+			n += sprintf(buf + n, "%s ", ops[rand() % 5]);
+
+		if (rand() % 2)
+			n += sprintf(buf + n, "ans ");
+		else
+			n += sprintf(buf + n, "%d ", rand() % 1000);
+	}
+
+	return buf;
+}
+
+// Starting from a set of formulas in a compiled file against compiling them
+// from text, and evaluating each once from the file against evaluating the
+// text. The file is mapped and loaded on every pass, so the page cache is
+// warm but the mapping is not.
+void bench_image(void)
+{
+	size_t n = IMAGE_FORMULAS;
+	char **exprs = malloc(n * sizeof(*exprs));
+	struct pcalc_program **progs = malloc(n * sizeof(*progs));
+	struct pcalc_ctx *ctx = pcalc_ctx_new();
+	struct pcalc_image *image;
+	FILE *file = tmpfile();
+	size_t text_size = 0;
+	void *data;
+	size_t size;
+	void *map;
+	double start;
+	double best_text = 0, best_load = 0;
+	double best_eval_text = 0, best_eval_image = 0;
+	char *errp;
+	int result;
+	int ans = 3;
+
+	if (exprs == NULL || progs == NULL || ctx == NULL || file == NULL)
+		abort();
+
+	for (size_t i = 0; i < n; i++) {
+		exprs[i] = gen_formula(IMAGE_OPERANDS);
+		if (exprs[i] == NULL ||
+			pcalc_compile(&progs[i], &errp, exprs[i], INFIX) != PCALC_OK)
+			abort();
+		text_size += strlen(exprs[i]) + 1;
+	}
+
+	if (pcalc_image_build(&data, &size, progs, n) != PCALC_OK ||
+		fwrite(data, 1, size, file) != size || fflush(file) != 0)
+		abort();
+
+	for (size_t i = 0; i < n; i++)
+		pcalc_program_free(progs[i]);
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+
+		for (size_t i = 0; i < n; i++) {
+			if (pcalc_compile(&progs[i], &errp, exprs[i], INFIX) != PCALC_OK)
+				abort();
+		}
+
+		pass = bench_now() - pass;
+		if (best_text == 0 || pass < best_text)
+			best_text = pass;
+
+		for (size_t i = 0; i < n; i++)
+			pcalc_program_free(progs[i]);
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (map == MAP_FAILED ||
+			pcalc_image_load(&image, map, size) != PCALC_OK)
+			abort();
+
+		pass = bench_now() - pass;
+		if (best_load == 0 || pass < best_load)
+			best_load = pass;
+
+		pcalc_image_free(image);
+		munmap(map, size);
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+
+		for (size_t i = 0; i < n; i++)
+			if (pcalc_eval(ctx, &result, &errp, exprs[i], INFIX,
+						   &ans) != PCALC_OK)
+				abort();
+
+		pass = bench_now() - pass;
+		if (best_eval_text == 0 || pass < best_eval_text)
+			best_eval_text = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (map == MAP_FAILED || pcalc_image_load(&image, map, size) != PCALC_OK)
+		abort();
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+
+		for (size_t i = 0; i < n; i++)
+			if (pcalc_exec(&result, pcalc_image_program(image, i),
+						   &ans) != PCALC_OK)
+				abort();
+
+		pass = bench_now() - pass;
+		if (best_eval_image == 0 || pass < best_eval_image)
+			best_eval_image = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("image", "text_load_ns/formula", best_text / n * 1e9);
+	bench_report("image", "image_load_ns/formula", best_load / n * 1e9);
+	bench_report("image", "text_eval_ns/formula", best_eval_text / n * 1e9);
+	bench_report("image", "image_eval_ns/formula", best_eval_image / n * 1e9);
+	bench_report("image", "text_bytes/formula", (double)text_size / n);
+	bench_report("image", "image_bytes/formula", (double)size / n);
+
+	pcalc_image_free(image);
+	munmap(map, size);
+	fclose(file);
+	for (size_t i = 0; i < n; i++)
+		free(exprs[i]);
+	free(exprs);
+	free(progs);
+	free(data);
+	pcalc_ctx_free(ctx);
+}
+
+// One program over a column of ans values, against a pcalc_exec call per value
+void bench_column(void)
+{
+	size_t n = 1 << 16;
+	int *ans = malloc(n * sizeof(int));
+	int *results = malloc(n * sizeof(int));
+	enum retcode *rets = malloc(n * sizeof(enum retcode));
+	char expr[] = "ans 3 * 7 + ans ans * - 5 /";
+	struct pcalc_program *prog;
+	double start, best_exec = 0, best_column = 0;
+	char *errp;
+
+	if (ans == NULL || results == NULL || rets == NULL ||
+		pcalc_compile(&prog, &errp, expr, POSTFIX) != PCALC_OK)
+		abort();
+
+	// Small values so that few lanes overflow
+	for (size_t i = 0; i < n; i++)
+		ans[i] = rand() % 20001 - 10000;
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+
+		for (size_t i = 0; i < n; i++)
+			rets[i] = pcalc_exec(&results[i], prog, &ans[i]);
+
+		pass = bench_now() - pass;
+		if (best_exec == 0 || pass < best_exec)
+			best_exec = pass;
+
+		pass = bench_now();
+
+		if (pcalc_exec_column(prog, ans, results, rets, n) != PCALC_OK)
+			abort();
+
+		pass = bench_now() - pass;
+		if (best_column == 0 || pass < best_column)
+			best_column = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("column", "exec_ns/value", best_exec / n * 1e9);
+	bench_report("column", "column_ns/value", best_column / n * 1e9);
+
+	pcalc_program_free(prog);
+	free(ans);
+	free(results);
+	free(rets);
+}
+
+// Native code against the interpreter on a program like that of bench_exec,
+// with a division in every fourth term
+void bench_jit(void)
+{
+	size_t terms = 1 << 10;
+	char *buf = malloc(terms * 64);
+	struct pcalc_program *prog;
+	struct pcalc_jit *jit;
+	size_t n = 0;
+	int ans = 42;
+	double start, best_exec = 0, best_jit = 0;
+	char *errp;
+
+	if (buf == NULL)
+		abort();
+
+	n += sprintf(buf + n, "0 ");
+	for (size_t i = 0; i < terms; i++) {
+		if (i % 4 == 0)
+			n += sprintf(buf + n, "ans 3 / ans - + ");
+		else
+			n += sprintf(buf + n, "%d %d * %d - + ", rand() % 100,
+						 rand() % 100, rand() % 100);
+	}
+
+	if (pcalc_compile(&prog, &errp, buf, POSTFIX) != PCALC_OK ||
+		pcalc_jit_compile(&jit, prog) != PCALC_OK)
+		abort();
+
+	start = bench_now();
+	do {
+		double pass = bench_now();
+		int result, jit_result;
+
+		for (int i = 0; i < 1000; i++)
+			if (pcalc_exec(&result, prog, &ans) != PCALC_OK)
+				abort();
+
+		pass = bench_now() - pass;
+		if (best_exec == 0 || pass < best_exec)
+			best_exec = pass;
+
+		pass = bench_now();
+
+		for (int i = 0; i < 1000; i++)
+			if (pcalc_jit_exec(&jit_result, jit, &ans) != PCALC_OK)
+				abort();
+
+		pass = bench_now() - pass;
+		if (best_jit == 0 || pass < best_jit)
+			best_jit = pass;
+
+		if (result != jit_result)
+			abort();
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("jit", "native", pcalc_jit_native(jit));
+	bench_report("jit", "exec_execs/sec", 1000 / best_exec);
+	bench_report("jit", "jit_execs/sec", 1000 / best_jit);
+
+	pcalc_jit_free(jit);
+	pcalc_program_free(prog);
+	free(buf);
+}
+
+// Operands are random over the whole int range or small, so that both the
+// overflow and the normal paths are taken
+int gen_operand(void)
+{
+	if (rand() % 4 == 0)
+		return (int)((unsigned)rand() << 16 ^ (unsigned)rand());
+	else
+		return rand() % 2001 - 1000;
+}
+
+// Checked arithmetic kernel on a random stream of operators and operands
+void bench_arith(void)
+{
+#ifdef HAVE_OVERFLOW_BUILTINS
+	const char *name = "arith_builtin";
+#else
+	const char *name = "arith_portable";
+#endif
+	size_t n = 1 << 16;
+	int *lval = malloc(n * sizeof(*lval));
+	int *rval = malloc(n * sizeof(*rval));
+	enum token_type *ops = malloc(n * sizeof(*ops));
+	volatile int sink = 0;
+	double start = bench_now();
+	double best = 0;
+
+	if (lval == NULL || rval == NULL || ops == NULL)
+		abort();
+
+	for (size_t i = 0; i < n; i++) {
+		lval[i] = gen_operand();
+		rval[i] = gen_operand();
+		ops[i] = OP_ADD + rand() % 4;
+	}
+
+	do {
+		double pass = bench_now();
+		int sum = 0;
+
+		for (size_t i = 0; i < n; i++) {
+			int result;
+
+			if (pcalc_binop(&result, ops[i], lval[i], rval[i]) == PCALC_OK)
+				sum ^= result;
+		}
+
+		sink = sum;
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	(void)sink;
+	bench_report(name, "ops/sec", n / best);
+	free(lval);
+	free(rval);
+	free(ops);
+}
+
+// Random decimal number of the given number of digits
+struct bignum *gen_bignum(size_t digits)
+{
+	char *buf = malloc(digits);
+	struct bignum *n;
+
+	if (buf == NULL)
+		abort();
+
+	buf[0] = '1' + rand() % 9;
+	for (size_t i = 1; i < digits; i++)
+		buf[i] = '0' + rand() % 10;
+
+	if (big_parse(&n, buf, buf + digits) != PCALC_OK)
+		abort();
+
+	free(buf);
+
+	return n;
+}
+
+// Time op on operands of BIG_DIGITS digits. The dividend of OP_DIV has twice
+// as many digits, so that the quotient is as long as the divisor.
+void bench_big(const char *name, enum token_type op)
+{
+	struct bignum *a = gen_bignum(op == OP_DIV ? 2 * BIG_DIGITS : BIG_DIGITS);
+	struct bignum *b = gen_bignum(BIG_DIGITS);
+	double start = bench_now();
+	double best = 0;
+
+	do {
+		double pass = bench_now();
+		struct bignum *r;
+
+		if (big_binop(&r, op, a, b) != PCALC_OK)
+			abort();
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+
+		big_free(r);
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report(name, "ops/sec", 1 / best);
+	big_free(a);
+	big_free(b);
+}
+
+void bench_big_add(void)
+{
+	bench_big("big_add", OP_ADD);
+}
+
+void bench_big_mul(void)
+{
+	bench_big("big_mul", OP_MULT);
+}
+
+void bench_big_div(void)
+{
+	bench_big("big_div", OP_DIV);
+}
+
+void bench_big_str(void)
+{
+	struct bignum *a = gen_bignum(BIG_DIGITS);
+	double start = bench_now();
+	double best = 0;
+
+	do {
+		double pass = bench_now();
+		char *str = big_to_str(a, 10);
+
+		if (str == NULL)
+			abort();
+
+		pass = bench_now() - pass;
+		if (best == 0 || pass < best)
+			best = pass;
+
+		free(str);
+	} while (bench_now() - start < BENCH_SECONDS);
+
+	bench_report("big_str", "ops/sec", 1 / best);
+	big_free(a);
+}
+
+struct benchmark benchmarks[] = {
+	{"lexer", bench_lexer},
+	{"postfix_long", bench_postfix_long},
+	{"prefix_long", bench_prefix_long},
+	{"postfix_spaced", bench_postfix_spaced},
+	{"prefix_spaced", bench_prefix_spaced},
+	{"expr", bench_expr},
+	{"exec", bench_exec},
+	{"column", bench_column},
+	{"jit", bench_jit},
+	{"image", bench_image},
+	{"arith", bench_arith},
+	{"big_add", bench_big_add},
+	{"big_mul", bench_big_mul},
+	{"big_div", bench_big_div},
+	{"big_str", bench_big_str},
+};
+
+int main(int argc, char **argv)
+{
+	size_t n = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+	srand(1);
+
+	for (size_t i = 0; i < n; i++) {
+		int selected = argc < 2;
+
+		for (int j = 1; j < argc; j++)
+			if (strcmp(argv[j], benchmarks[i].name) == 0)
+				selected = 1;
+
+		if (selected)
+			benchmarks[i].run();
+	}
+
+	bench_report_rss();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,881 @@
+//
+//  bignum.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "bignum.h"
+
+#define LIMB_BITS 32
+
+// Magnitudes are limb arrays with an explicit length. Unless noted otherwise
+// they may have leading zero limbs.
+
+// Length of a without leading zero limbs
+size_t mag_len(const uint32_t *a, size_t an)
+{
+	while (an > 0 && a[an - 1] == 0)
+		an--;
+
+	return an;
+}
+
+// Compare a and b, which have no leading zero limbs
+int mag_cmp(const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	if (an != bn)
+		return an < bn ? -1 : 1;
+
+	while (an-- > 0)
+		if (a[an] != b[an])
+			return a[an] < b[an] ? -1 : 1;
+
+	return 0;
+}
+
+// r = a + b where an >= bn. r has room for an + 1 limbs.
+void mag_add(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b,
+			 size_t bn)
+{
+	uint64_t carry = 0;
+	size_t i;
+
+	for (i = 0; i < bn; i++) {
+		carry += (uint64_t)a[i] + b[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+
+	for (; i < an; i++) {
+		carry += a[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+
+	r[an] = (uint32_t)carry;
+}
+
+// r = a - b where a >= b and an >= bn. r has room for an limbs and may be a.
+void mag_sub(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b,
+			 size_t bn)
+{
+	uint32_t borrow = 0;
+	size_t i;
+
+	for (i = 0; i < bn; i++) {
+		uint64_t d = (uint64_t)a[i] - b[i] - borrow;
+		r[i] = (uint32_t)d;
+		borrow = (d >> LIMB_BITS) & 1;
+	}
+
+	for (; i < an; i++) {
+		uint64_t d = (uint64_t)a[i] - borrow;
+		r[i] = (uint32_t)d;
+		borrow = (d >> LIMB_BITS) & 1;
+	}
+}
+
+// r += a where the sum fits in the rn limbs of r and an <= rn
+void mag_add_to(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+	uint64_t carry = 0;
+	size_t i;
+
+	for (i = 0; i < an; i++) {
+		carry += (uint64_t)r[i] + a[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+
+	for (; carry && i < rn; i++) {
+		carry += r[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+}
+
+// r = r * mul + add, where r has room for one more limb than *rn
+void mag_mul_small(uint32_t *r, size_t *rn, uint32_t mul, uint32_t add)
+{
+	uint64_t carry = add;
+
+	for (size_t i = 0; i < *rn; i++) {
+		carry += (uint64_t)r[i] * mul;
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+
+	if (carry)
+		r[(*rn)++] = (uint32_t)carry;
+}
+
+// r = a / div, returning the remainder. r has room for an limbs and may be a.
+uint32_t mag_div_small(uint32_t *r, const uint32_t *a, size_t an, uint32_t div)
+{
+	uint64_t rem = 0;
+
+	for (size_t i = an; i-- > 0;) {
+		uint64_t cur = rem << LIMB_BITS | a[i];
+		r[i] = (uint32_t)(cur / div);
+		rem = cur % div;
+	}
+
+	return (uint32_t)rem;
+}
+
+// r = a * b with room for an + bn limbs in r
+void mag_mul_school(uint32_t *r, const uint32_t *a, size_t an,
+					const uint32_t *b, size_t bn)
+{
+	memset(r, 0, (an + bn) * sizeof(*r));
+
+	for (size_t i = 0; i < an; i++) {
+		uint64_t carry = 0;
+
+		for (size_t j = 0; j < bn; j++) {
+			carry += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t)carry;
+			carry >>= LIMB_BITS;
+		}
+
+		r[i + bn] = (uint32_t)carry;
+	}
+}
+
+// r = a * b with room for an + bn limbs in r. Returns -1 if memory for the
+// intermediate products could not be allocated.
+int mag_mul(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b,
+			size_t bn)
+{
+	if (an < bn) {
+		const uint32_t *t = a;
+		size_t tn = an;
+
+		a = b;
+		an = bn;
+		b = t;
+		bn = tn;
+	}
+
+	if (bn < KARATSUBA_CUTOFF) {
+		mag_mul_school(r, a, an, b, bn);
+		return 0;
+	}
+
+	if (2 * bn <= an) {
+		// Too unbalanced to split both operands in the middle, so a is
+		// multiplied by b in slices of bn limbs
+		uint32_t *t = malloc(2 * bn * sizeof(*t));
+
+		if (t == NULL)
+			return -1;
+
+		memset(r, 0, (an + bn) * sizeof(*r));
+
+		for (size_t i = 0; i < an; i += bn) {
+			size_t n = an - i < bn ? an - i : bn;
+
+			if (mag_mul(t, a + i, n, b, bn) != 0) {
+				free(t);
+				return -1;
+			}
+
+			mag_add_to(r + i, an + bn - i, t, n + bn);
+		}
+
+		free(t);
+		return 0;
+	}
+
+	{
+		// a = a1 * B^m + a0 and b = b1 * B^m + b0, where bn > m
+		size_t m = an / 2;
+		size_t a1n = an - m;
+		size_t b1n = bn - m;
+		size_t san = a1n + 1;
+		size_t sbn = (b1n > m ? b1n : m) + 1;
+		uint32_t *sa = malloc((2 * (san + sbn)) * sizeof(*sa));
+		uint32_t *sb = sa + san;
+		uint32_t *z1 = sb + sbn;
+		size_t z1n = san + sbn;
+
+		if (sa == NULL)
+			return -1;
+
+		mag_add(sa, a + m, a1n, a, m);
+
+		if (b1n >= m)
+			mag_add(sb, b + m, b1n, b, m);
+		else
+			mag_add(sb, b, m, b + m, b1n);
+
+		// z0 = a0 * b0 and z2 = a1 * b1 go straight to their place in r
+		if (mag_mul(r, a, m, b, m) != 0 ||
+			mag_mul(r + 2 * m, a + m, a1n, b + m, b1n) != 0 ||
+			mag_mul(z1, sa, san, sb, sbn) != 0) {
+			free(sa);
+			return -1;
+		}
+
+		// z1 = (a0 + a1) * (b0 + b1) - z0 - z2
+		mag_sub(z1, z1, z1n, r, 2 * m);
+		mag_sub(z1, z1, z1n, r + 2 * m, a1n + b1n);
+		mag_add_to(r + m, an + bn - m, z1, mag_len(z1, z1n));
+
+		free(sa);
+		return 0;
+	}
+}
+
+// q = a / b where a and b have no leading zero limbs and an >= bn > 1. q has
+// room for an - bn + 1 limbs. This is algorithm D from Knuth, The Art of
+// Computer Programming, volume 2, section 4.3.1.
+int mag_div(uint32_t *q, const uint32_t *a, size_t an, const uint32_t *b,
+			size_t bn)
+{
+	uint32_t *u = malloc((an + 1 + bn) * sizeof(*u));
+	uint32_t *v = u + an + 1;
+	unsigned s = 0;
+
+	if (u == NULL)
+		return -1;
+
+	// Normalize so that the top bit of the divisor is set
+	while ((b[bn - 1] << s & 0x80000000u) == 0)
+		s++;
+
+	for (size_t i = bn - 1; i > 0; i--)
+		v[i] = b[i] << s | (s ? b[i - 1] >> (LIMB_BITS - s) : 0);
+	v[0] = b[0] << s;
+
+	u[an] = s ? a[an - 1] >> (LIMB_BITS - s) : 0;
+	for (size_t i = an - 1; i > 0; i--)
+		u[i] = a[i] << s | (s ? a[i - 1] >> (LIMB_BITS - s) : 0);
+	u[0] = a[0] << s;
+
+	for (size_t j = an - bn + 1; j-- > 0;) {
+		uint64_t num = (uint64_t)u[j + bn] << LIMB_BITS | u[j + bn - 1];
+		uint64_t qhat = num / v[bn - 1];
+		uint64_t rhat = num % v[bn - 1];
+		uint64_t carry = 0;
+		uint32_t borrow = 0;
+
+		while (qhat >> LIMB_BITS ||
+			   qhat * v[bn - 2] > (rhat << LIMB_BITS | u[j + bn - 2])) {
+			qhat--;
+			rhat += v[bn - 1];
+
+			if (rhat >> LIMB_BITS)
+				break;
+		}
+
+		// u[j..j+bn] -= qhat * v
+		for (size_t i = 0; i < bn; i++) {
+			uint64_t p = qhat * v[i] + carry;
+			uint64_t d = (uint64_t)u[i + j] - (uint32_t)p - borrow;
+
+			carry = p >> LIMB_BITS;
+			u[i + j] = (uint32_t)d;
+			borrow = (d >> LIMB_BITS) & 1;
+		}
+
+		if (u[j + bn] < carry + borrow) {
+			// qhat was one too large, add v back
+			u[j + bn] -= carry + borrow;
+			qhat--;
+			carry = 0;
+
+			for (size_t i = 0; i < bn; i++) {
+				carry += (uint64_t)u[i + j] + v[i];
+				u[i + j] = (uint32_t)carry;
+				carry >>= LIMB_BITS;
+			}
+
+			u[j + bn] += (uint32_t)carry;
+		}
+		else {
+			u[j + bn] -= carry + borrow;
+		}
+
+		q[j] = (uint32_t)qhat;
+	}
+
+	free(u);
+
+	return 0;
+}
+
+struct bignum *big_new(size_t len)
+{
+	struct bignum *a = malloc(sizeof(*a) + len * sizeof(a->limb[0]));
+
+	if (a) {
+		a->len = len;
+		a->negative = 0;
+	}
+
+	return a;
+}
+
+struct bignum *big_copy(const struct bignum *a)
+{
+	struct bignum *r = big_new(a->len);
+
+	if (r) {
+		r->negative = a->negative;
+		memcpy(r->limb, a->limb, a->len * sizeof(a->limb[0]));
+	}
+
+	return r;
+}
+
+void big_free(struct bignum *a)
+{
+	free(a);
+}
+
+// Drop leading zero limbs, zero is never negative
+struct bignum *big_trim(struct bignum *a)
+{
+	a->len = mag_len(a->limb, a->len);
+
+	if (a->len == 0)
+		a->negative = 0;
+
+	return a;
+}
+
+// Largest power of radix that fits in a limb and its number of digits
+uint32_t chunk_size(unsigned radix, unsigned *digits)
+{
+	uint64_t chunk = radix;
+
+	*digits = 1;
+
+	while (chunk * radix <= UINT32_MAX) {
+		chunk *= radix;
+		*digits += 1;
+	}
+
+	return (uint32_t)chunk;
+}
+
+// Read the integer literal at head, see lex_prefix
+enum retcode big_parse(struct bignum **result, char *head, char *end)
+{
+	struct bignum *r;
+	unsigned base;
+	unsigned digits;
+	uint32_t chunk_mul;
+	uint32_t chunk = 0;
+	unsigned chunk_len = 0;
+	int negative;
+	size_t n = 0;
+
+	head = lex_prefix(head, end, &negative, &base);
+	chunk_size(base, &digits);
+
+	while (head + n < end && digit_value(head[n]) < base)
+		n++;
+
+	if (n == 0)
+		return PCALC_UKNOWN_TOKEN;
+
+	// Each digit holds at most four bits
+	r = big_new(n * 4 / LIMB_BITS + 2);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	r->len = 0;
+	chunk_mul = 1;
+
+	for (size_t i = 0; i < n; i++) {
+		chunk = chunk * base + digit_value(head[i]);
+		chunk_mul *= base;
+
+		if (++chunk_len == digits || i + 1 == n) {
+			mag_mul_small(r->limb, &r->len, chunk_mul, chunk);
+			chunk = 0;
+			chunk_len = 0;
+			chunk_mul = 1;
+		}
+	}
+
+	r->negative = negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// r = a + b, or a - b if negate_b is set
+enum retcode big_add(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b, int negate_b)
+{
+	int b_negative = b->negative != negate_b;
+	int negative = a->negative;
+	struct bignum *r = big_new((a->len > b->len ? a->len : b->len) + 1);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (a->negative == b_negative) {
+		if (a->len >= b->len)
+			mag_add(r->limb, a->limb, a->len, b->limb, b->len);
+		else
+			mag_add(r->limb, b->limb, b->len, a->limb, a->len);
+	}
+	else if (mag_cmp(a->limb, a->len, b->limb, b->len) >= 0) {
+		mag_sub(r->limb, a->limb, a->len, b->limb, b->len);
+		r->limb[a->len] = 0;
+	}
+	else {
+		mag_sub(r->limb, b->limb, b->len, a->limb, a->len);
+		r->limb[b->len] = 0;
+		negative = b_negative;
+	}
+
+	r->negative = negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+enum retcode big_mul(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	struct bignum *r = big_new(a->len + b->len);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (a->len == 0 || b->len == 0) {
+		r->len = 0;
+	}
+	else if (mag_mul(r->limb, a->limb, a->len, b->limb, b->len) != 0) {
+		big_free(r);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	r->negative = a->negative != b->negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// Division truncates towards zero like C integer division
+enum retcode big_div(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	struct bignum *r;
+
+	if (b->len == 0)
+		return PCALC_OUT_OF_BOUNDS;
+
+	if (mag_cmp(a->limb, a->len, b->limb, b->len) < 0) {
+		r = big_new(0);
+
+		if (r == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		*result = r;
+		return PCALC_OK;
+	}
+
+	r = big_new(a->len - b->len + 1);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (b->len == 1) {
+		mag_div_small(r->limb, a->limb, a->len, b->limb[0]);
+	}
+	else if (mag_div(r->limb, a->limb, a->len, b->limb, b->len) != 0) {
+		big_free(r);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	r->negative = a->negative != b->negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// Number of significant bits in the magnitude of a
+uint64_t big_bits(const struct bignum *a)
+{
+	uint64_t bits = (uint64_t)a->len * LIMB_BITS;
+	uint32_t top;
+
+	if (a->len == 0)
+		return 0;
+
+	for (top = a->limb[a->len - 1]; !(top >> (LIMB_BITS - 1)); top <<= 1)
+		bits--;
+
+	return bits;
+}
+
+// Power by repeated squaring, negative exponents are handled like checked_pow
+enum retcode big_pow(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	int unit = a->len == 1 && a->limb[0] == 1;
+	struct bignum *r, *base;
+	enum retcode ret = PCALC_OK;
+
+	if (b->negative && a->len == 0)
+		return PCALC_OUT_OF_BOUNDS;
+
+	// Powers of 0, 1 and -1, a zero exponent and negative exponents have
+	// the results 0, 1 and -1
+	if (a->len == 0 || unit || b->len == 0 || b->negative) {
+		r = big_new(1);
+
+		if (r == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		r->limb[0] = unit || b->len == 0;
+		r->negative = unit && a->negative && b->len > 0 && b->limb[0] & 1;
+		*result = big_trim(r);
+
+		return PCALC_OK;
+	}
+
+	if (b->len > 1 || big_bits(a) * b->limb[0] > BIG_MAX_BITS)
+		return PCALC_OUT_OF_BOUNDS;
+
+	r = big_new(1);
+	base = big_copy(a);
+
+	if (r == NULL || base == NULL) {
+		big_free(r);
+		big_free(base);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	r->limb[0] = 1;
+
+	for (uint32_t exp = b->limb[0]; exp > 0 && ret == PCALC_OK; exp >>= 1) {
+		struct bignum *t;
+
+		if (exp & 1) {
+			ret = big_mul(&t, r, base);
+
+			if (ret == PCALC_OK) {
+				big_free(r);
+				r = t;
+			}
+		}
+
+		if (exp > 1 && ret == PCALC_OK) {
+			ret = big_mul(&t, base, base);
+
+			if (ret == PCALC_OK) {
+				big_free(base);
+				base = t;
+			}
+		}
+	}
+
+	big_free(base);
+
+	if (ret == PCALC_OK)
+		*result = r;
+	else
+		big_free(r);
+
+	return ret;
+}
+
+// Zero stays non-negative
+enum retcode big_neg(struct bignum **result, const struct bignum *a)
+{
+	struct bignum *r = big_copy(a);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	r->negative = !a->negative && a->len > 0;
+	*result = r;
+
+	return PCALC_OK;
+}
+
+// The remainder of big_div, which has the sign of a
+enum retcode big_mod(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	struct bignum *q, *p;
+	enum retcode ret = big_div(&q, a, b);
+
+	if (ret != PCALC_OK)
+		return ret;
+
+	ret = big_mul(&p, q, b);
+	big_free(q);
+
+	if (ret == PCALC_OK) {
+		ret = big_add(result, a, p, 1);
+		big_free(p);
+	}
+
+	return ret;
+}
+
+// a multiplied by two to the power of b
+enum retcode big_shl(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	uint32_t count = b->len ? b->limb[0] : 0;
+	size_t limbs = a->len ? count / LIMB_BITS : 0;
+	unsigned bits = count % LIMB_BITS;
+	uint32_t carry = 0;
+	struct bignum *r;
+
+	if (b->negative || b->len > 1 || big_bits(a) + count > BIG_MAX_BITS)
+		return PCALC_OUT_OF_BOUNDS;
+
+	r = big_new(a->len + limbs + 1);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	memset(r->limb, 0, limbs * sizeof(r->limb[0]));
+
+	for (size_t i = 0; i < a->len; i++) {
+		r->limb[limbs + i] = a->limb[i] << bits | carry;
+		carry = bits ? a->limb[i] >> (LIMB_BITS - bits) : 0;
+	}
+
+	r->limb[limbs + a->len] = carry;
+	r->negative = a->negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// a divided by two to the power of b, rounded towards negative infinity
+enum retcode big_shr(struct bignum **result, const struct bignum *a,
+					 const struct bignum *b)
+{
+	uint32_t count = b->len ? b->limb[0] : 0;
+	size_t limbs = count / LIMB_BITS;
+	unsigned bits = count % LIMB_BITS;
+	int inexact = 0;
+	struct bignum *r;
+
+	if (b->negative)
+		return PCALC_OUT_OF_BOUNDS;
+
+	// Every bit is shifted out
+	if (b->len > 1 || limbs > a->len) {
+		limbs = a->len;
+		bits = 0;
+	}
+
+	// One limb more for rounding a negative value away from zero
+	r = big_new(a->len - limbs + 1);
+
+	if (r == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i < limbs; i++)
+		inexact |= a->limb[i] != 0;
+
+	if (bits && limbs < a->len)
+		inexact |= (uint32_t)(a->limb[limbs] << (LIMB_BITS - bits)) != 0;
+
+	for (size_t i = 0; i + limbs < a->len; i++) {
+		uint32_t hi = i + limbs + 1 < a->len ? a->limb[i + limbs + 1] : 0;
+
+		if (bits)
+			r->limb[i] = a->limb[i + limbs] >> bits | hi << (LIMB_BITS - bits);
+		else
+			r->limb[i] = a->limb[i + limbs];
+	}
+
+	r->limb[a->len - limbs] = 0;
+
+	if (a->negative && inexact) {
+		uint32_t one = 1;
+
+		mag_add_to(r->limb, r->len, &one, 1);
+	}
+
+	r->negative = a->negative;
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// r = -r in two's complement
+void twos_negate(uint32_t *r, size_t n)
+{
+	uint64_t carry = 1;
+
+	for (size_t i = 0; i < n; i++) {
+		carry += (uint32_t)~r[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+}
+
+// a in two's complement in n limbs, which must be more than a->len
+void twos_from_big(uint32_t *r, size_t n, const struct bignum *a)
+{
+	memcpy(r, a->limb, a->len * sizeof(r[0]));
+	memset(r + a->len, 0, (n - a->len) * sizeof(r[0]));
+
+	if (a->negative)
+		twos_negate(r, n);
+}
+
+// Bitwise operations work as if a and b were in two's complement of infinite
+// width, like C on int
+enum retcode big_bitop(struct bignum **result, enum token_type op,
+					   const struct bignum *a, const struct bignum *b)
+{
+	size_t n = (a->len > b->len ? a->len : b->len) + 1;
+	struct bignum *r = big_new(n);
+	uint32_t *t = malloc(n * sizeof(*t));
+
+	if (r == NULL || t == NULL) {
+		big_free(r);
+		free(t);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	twos_from_big(r->limb, n, a);
+	twos_from_big(t, n, b);
+
+	for (size_t i = 0; i < n; i++) {
+		switch (op) {
+			case OP_AND:	r->limb[i] &= t[i];	break;
+			case OP_OR:		r->limb[i] |= t[i];	break;
+			case OP_XOR:	r->limb[i] ^= t[i];	break;
+
+			default: assert(0);
+		}
+	}
+
+	free(t);
+
+	r->negative = r->limb[n - 1] >> (LIMB_BITS - 1);
+
+	if (r->negative)
+		twos_negate(r->limb, n);
+
+	*result = big_trim(r);
+
+	return PCALC_OK;
+}
+
+// Compare the values of a and b
+int big_cmp(const struct bignum *a, const struct bignum *b)
+{
+	int cmp;
+
+	if (a->negative != b->negative)
+		return a->negative ? -1 : 1;
+
+	cmp = mag_cmp(a->limb, a->len, b->limb, b->len);
+
+	return a->negative ? -cmp : cmp;
+}
+
+enum retcode big_minmax(struct bignum **result, enum token_type op,
+						const struct bignum *a, const struct bignum *b)
+{
+	int take_a = big_cmp(a, b) <= 0;
+
+	if (op == OP_MAX)
+		take_a = !take_a;
+
+	*result = big_copy(take_a ? a : b);
+
+	return *result ? PCALC_OK : PCALC_MEMORY_ALLOC;
+}
+
+enum retcode big_binop(struct bignum **result, enum token_type op,
+					   const struct bignum *lval, const struct bignum *rval)
+{
+	switch (op) {
+		case OP_ADD:	return big_add(result, lval, rval, 0);
+		case OP_SUB:	return big_add(result, lval, rval, 1);
+		case OP_MULT:	return big_mul(result, lval, rval);
+		case OP_DIV:	return big_div(result, lval, rval);
+		case OP_POW:	return big_pow(result, lval, rval);
+		case OP_MOD:	return big_mod(result, lval, rval);
+		case OP_SHL:	return big_shl(result, lval, rval);
+		case OP_SHR:	return big_shr(result, lval, rval);
+
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+			return big_bitop(result, op, lval, rval);
+
+		case OP_MIN:
+		case OP_MAX:
+			return big_minmax(result, op, lval, rval);
+
+		default: assert(0);
+	}
+}
+
+// Digits of a in radix with a leading minus sign if negative. The string is
+// allocated with malloc.
+char *big_to_str(const struct bignum *a, unsigned radix)
+{
+	const char *digit_chars = "0123456789ABCDEF";
+	unsigned digits;
+	uint32_t chunk = chunk_size(radix, &digits);
+	// A limb has at most ten digits in any radix of ten or more
+	size_t size = (a->len + 1) * 10 + digits + 2;
+	char *str = malloc(size);
+	uint32_t *t = malloc((a->len + 1) * sizeof(*t));
+	char *p = str + size;
+	size_t tn = a->len;
+
+	assert(radix >= 10 && radix <= 16);
+
+	if (str == NULL || t == NULL) {
+		free(str);
+		free(t);
+		return NULL;
+	}
+
+	memcpy(t, a->limb, a->len * sizeof(*t));
+	*--p = '\0';
+
+	// Divide out one chunk of digits at a time, least significant first
+	do {
+		uint32_t rem = mag_div_small(t, t, tn, chunk);
+
+		tn = mag_len(t, tn);
+
+		for (unsigned i = 0; i < digits && (tn > 0 || rem > 0); i++) {
+			*--p = digit_chars[rem % radix];
+			rem /= radix;
+		}
+	} while (tn > 0);
+
+	if (*p == '\0')
+		*--p = '0';
+
+	if (a->negative)
+		*--p = '-';
+
+	memmove(str, p, str + size - p);
+	free(t);
+
+	return str;
+}
@@ -0,0 +1,44 @@
+//
+//  bignum.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcalc.h"
+#include "token.h"
+
+// Multiplications where both operands have at least this many limbs are split
+// with Karatsuba's method
+#define KARATSUBA_CUTOFF 64
+
+// Powers and left shifts are refused as out of bounds if they could have more
+// bits than this
+#define BIG_MAX_BITS (1 << 20)
+
+// Arbitrary precision integer in sign and magnitude form. The limbs are stored
+// least significant first and the most significant limb is never zero, so
+// zero has no limbs. Values are not modified after they have been returned.
+struct bignum {
+	size_t len;
+	int negative;
+	uint32_t limb[];
+};
+
+struct bignum *big_new(size_t len);
+struct bignum *big_copy(const struct bignum *a);
+void big_free(struct bignum *a);
+enum retcode big_parse(struct bignum **result, char *head, char *end);
+enum retcode big_binop(struct bignum **result, enum token_type op,
+					   const struct bignum *lval, const struct bignum *rval);
+enum retcode big_neg(struct bignum **result, const struct bignum *a);
+char *big_to_str(const struct bignum *a, unsigned radix);
+
+#endif
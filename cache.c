@@ -0,0 +1,272 @@
+//
+// cache.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pcalc.h"
+#include "cache.h"
+#include "scan.h"
+
+// Results of expressions are cached under their text with whitespace
+// normalized, so that "1  +2" and " 1 +2 " share an entry. Expressions that
+// use ans depend on more than their text and are always evaluated, and so are
+// the longer ones, which keeps every entry the same size. Only successful
+// results are cached, an error is evaluated again to find its position.
+//
+// The cache is set associative. A key hashes to a set of CACHE_WAYS entries,
+// and a new entry replaces one of those chosen by CLOCK. Each set is guarded
+// by one of CACHE_STRIPES locks.
+
+struct cache_entry {
+	uint64_t hash;
+	int value;
+	unsigned char used;
+	unsigned char ref;			// Used since the clock hand last passed
+	unsigned char notation;
+	unsigned char key_len;
+	char key[CACHE_KEY_SIZE];
+};
+
+struct cache_set {
+	struct cache_entry entries[CACHE_WAYS];
+	unsigned hand;
+};
+
+struct cache_stripe {
+	pthread_mutex_t lock;
+	struct cache_stats stats;
+};
+
+struct cache {
+	struct cache_set *sets;
+	size_t mask;				// Number of sets - 1
+	struct cache_stripe stripes[CACHE_STRIPES];
+};
+
+// A cache of at least the given number of entries
+struct cache *cache_new(size_t entries)
+{
+	struct cache *cache = calloc(1, sizeof(*cache));
+	size_t nsets = 1;
+
+	if (cache == NULL)
+		return NULL;
+
+	while (nsets * CACHE_WAYS < entries)
+		nsets *= 2;
+
+	cache->mask = nsets - 1;
+	cache->sets = calloc(nsets, sizeof(*cache->sets));
+
+	if (cache->sets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	for (int i = 0; i < CACHE_STRIPES; i++)
+		pthread_mutex_init(&cache->stripes[i].lock, NULL);
+
+	return cache;
+}
+
+void cache_free(struct cache *cache)
+{
+	if (cache) {
+		for (int i = 0; i < CACHE_STRIPES; i++)
+			pthread_mutex_destroy(&cache->stripes[i].lock);
+
+		free(cache->sets);
+		free(cache);
+	}
+}
+
+// Whether the len characters at p contain the ans keyword. Parentheses need
+// no space around them, so it may be anywhere in a token.
+int token_has_ans(const char *p, size_t len)
+{
+	for (size_t i = 0; i + 3 <= len; i++)
+		if (memcmp(p + i, "ans", 3) == 0)
+			return 1;
+
+	return 0;
+}
+
+// Copy the tokens of expr to key separated by single spaces. Returns the
+// length of the key, or 0 if the expression can not be cached.
+size_t cache_key(char *key, char *expr, char *end)
+{
+	char *p = scan_skip_space(expr, end);
+	size_t n = 0;
+
+	while (p < end) {
+		char *token_end = scan_find_space(p, end);
+		size_t len = token_end - p;
+
+		if (token_has_ans(p, len) || n + (n > 0) + len > CACHE_KEY_SIZE)
+			return 0;
+
+		if (n > 0)
+			key[n++] = ' ';
+
+		memcpy(key + n, p, len);
+		n += len;
+		p = scan_skip_space(token_end, end);
+	}
+
+	return n;
+}
+
+// FNV-1a
+uint64_t cache_hash(const char *key, size_t len, enum notation notation)
+{
+	uint64_t hash = 14695981039346656037ULL ^ notation;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+struct cache_entry *cache_find(struct cache_set *set, uint64_t hash,
+							   const char *key, size_t key_len,
+							   enum notation notation)
+{
+	for (int i = 0; i < CACHE_WAYS; i++) {
+		struct cache_entry *e = &set->entries[i];
+
+		if (e->used && e->hash == hash && e->notation == notation &&
+			e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+// The entry to replace in set. Entries used since the hand last passed get
+// another round.
+struct cache_entry *cache_victim(struct cache_set *set)
+{
+	for (;;) {
+		struct cache_entry *e = &set->entries[set->hand];
+
+		set->hand = (set->hand + 1) % CACHE_WAYS;
+
+		if (!e->used || !e->ref)
+			return e;
+
+		e->ref = 0;
+	}
+}
+
+// Evaluate like pcalc_evaln, answering from the cache when the expression has
+// been evaluated before. cache may be NULL to always evaluate. It may be
+// shared by threads with different contexts.
+enum retcode cache_eval(struct cache *cache, struct pcalc_ctx *ctx,
+						int *result, char **errp, char *expr, size_t len,
+						enum notation notation, int *last_ans)
+{
+	char key[CACHE_KEY_SIZE];
+	size_t key_len;
+	uint64_t hash;
+	size_t index;
+	struct cache_stripe *stripe;
+	struct cache_entry *e;
+	enum retcode ret;
+
+	if (cache == NULL)
+		return pcalc_evaln(ctx, result, errp, expr, len, notation, last_ans);
+
+	key_len = cache_key(key, expr, expr + len);
+
+	if (key_len == 0) {
+		// Spread the count over the stripes by length
+		stripe = &cache->stripes[len % CACHE_STRIPES];
+
+		pthread_mutex_lock(&stripe->lock);
+		stripe->stats.bypasses++;
+		pthread_mutex_unlock(&stripe->lock);
+
+		return pcalc_evaln(ctx, result, errp, expr, len, notation, last_ans);
+	}
+
+	hash = cache_hash(key, key_len, notation);
+	index = hash & cache->mask;
+	stripe = &cache->stripes[index % CACHE_STRIPES];
+
+	pthread_mutex_lock(&stripe->lock);
+
+	e = cache_find(&cache->sets[index], hash, key, key_len, notation);
+
+	if (e) {
+		*result = e->value;
+		e->ref = 1;
+		stripe->stats.hits++;
+	}
+	else {
+		stripe->stats.misses++;
+	}
+
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (e) {
+		*errp = expr + len;
+		return PCALC_OK;
+	}
+
+	ret = pcalc_evaln(ctx, result, errp, expr, len, notation, last_ans);
+
+	if (ret == PCALC_OK) {
+		pthread_mutex_lock(&stripe->lock);
+
+		// Another thread may have added it meanwhile
+		if (!cache_find(&cache->sets[index], hash, key, key_len, notation)) {
+			e = cache_victim(&cache->sets[index]);
+			e->hash = hash;
+			e->value = *result;
+			e->used = 1;
+			e->ref = 0;
+			e->notation = notation;
+			e->key_len = key_len;
+			memcpy(e->key, key, key_len);
+		}
+
+		pthread_mutex_unlock(&stripe->lock);
+	}
+
+	return ret;
+}
+
+// Sum of the counters of all stripes
+void cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	for (int i = 0; i < CACHE_STRIPES; i++) {
+		struct cache_stripe *stripe = &cache->stripes[i];
+
+		pthread_mutex_lock(&stripe->lock);
+		stats->hits += stripe->stats.hits;
+		stats->misses += stripe->stats.misses;
+		stats->bypasses += stripe->stats.bypasses;
+		pthread_mutex_unlock(&stripe->lock);
+	}
+}
+
+void cache_print_stats(struct cache_stats *stats, FILE *stream)
+{
+	fprintf(stream,
+			"cache_hits %zu\n"
+			"cache_misses %zu\n"
+			"cache_bypasses %zu\n",
+			stats->hits, stats->misses, stats->bypasses);
+}
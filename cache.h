@@ -0,0 +1,44 @@
+//
+// cache.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "pcalc.h"
+
+// Result cache in front of pcalc_evaln, see cache.c
+
+// Entries of a set, searched together and evicted by CLOCK within the set
+#define CACHE_WAYS 8
+
+// Sets are guarded by this many locks, so that threads rarely contend
+#define CACHE_STRIPES 64
+
+// Longest cached expression after its whitespace is normalized
+#define CACHE_KEY_SIZE 112
+
+struct cache;
+
+struct cache_stats {
+	size_t hits;
+	size_t misses;
+	size_t bypasses;	// Not cacheable, e.g. uses ans
+};
+
+struct cache *cache_new(size_t entries);
+void cache_free(struct cache *cache);
+enum retcode cache_eval(struct cache *cache, struct pcalc_ctx *ctx,
+						int *result, char **errp, char *expr, size_t len,
+						enum notation notation, int *last_ans);
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
+void cache_print_stats(struct cache_stats *stats, FILE *stream);
+
+#endif
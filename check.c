@@ -0,0 +1,820 @@
+//
+// check.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pcalc.h"
+#include "program.h"
+#include "sheet.h"
+
+// Regression checks of results, error codes and error positions, run with
+// make check. Every failed check is printed, and the exit status is nonzero
+// if any failed. Name groups of checks to run only those, e.g.
+// ./pcalc-check program
+
+// Value of ans in the checks that give one
+#define CHECK_ANS 5
+
+// Column of the error position when it is not checked
+#define ANY_COL -1
+
+struct check {
+	const char *name;
+	void (*run)(void);
+};
+
+size_t check_failures;
+size_t check_count;
+
+// Record the outcome of a check, described by the printf format fmt
+void check(int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	check_count++;
+
+	if (ok)
+		return;
+
+	check_failures++;
+	fprintf(stderr, "FAIL ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+// Column of errp in expr counting from zero, -1 if it is NULL
+long error_col(const char *expr, const char *errp)
+{
+	return errp ? errp - expr : -1;
+}
+
+// Evaluate expr with the evaluator of notation and check the return code, and
+// the result if it is PCALC_OK or else the column of the error unless col is
+// ANY_COL
+void check_eval(const char *expr, enum notation notation, int has_ans,
+				enum retcode ret, int result, long col)
+{
+	char buf[256];
+	char *errp = NULL;
+	int value = 0;
+	int ans = CHECK_ANS;
+	int *last_ans = has_ans ? &ans : NULL;
+	enum retcode got;
+
+	strcpy(buf, expr);
+
+	if (notation == INFIX)
+		got = inf_eval_str(&value, &errp, buf, last_ans);
+	else
+		got = pn_eval_str(&value, &errp, buf,
+						  notation == POSTFIX ? PCALC_REVERSED : 0, last_ans);
+
+	if (ret == PCALC_OK)
+		check(got == PCALC_OK && value == result,
+			  "eval '%s': got %s %d, want %d", expr, retcode_str(got), value,
+			  result);
+	else
+		check(got == ret && (col == ANY_COL || error_col(buf, errp) == col),
+			  "eval '%s': got %s at %ld, want %s at %ld", expr,
+			  retcode_str(got), error_col(buf, errp), retcode_str(ret), col);
+}
+
+// Compile expr and run it with ans set. Compile errors are checked like in
+// check_eval, and runs by their return code and result, which has no error
+// position. The compiled result must agree with check_eval.
+void check_program(const char *expr, enum notation notation, enum retcode ret,
+				   int result, long col)
+{
+	char buf[256];
+	struct pcalc_program *prog;
+	char *errp = NULL;
+	int value = 0;
+	int ans = CHECK_ANS;
+	enum retcode got;
+
+	strcpy(buf, expr);
+	got = pcalc_compile(&prog, &errp, buf, notation);
+
+	if (got != PCALC_OK) {
+		check(got == ret && (col == ANY_COL || error_col(buf, errp) == col),
+			  "compile '%s': got %s at %ld, want %s at %ld", expr,
+			  retcode_str(got), error_col(buf, errp), retcode_str(ret), col);
+		return;
+	}
+
+	got = pcalc_exec(&value, prog, &ans);
+	check(got == ret && (ret != PCALC_OK || value == result),
+		  "exec '%s': got %s %d, want %s %d", expr, retcode_str(got), value,
+		  retcode_str(ret), result);
+
+	pcalc_program_free(prog);
+
+	if (ret == PCALC_OK)
+		check_eval(expr, notation, 1, ret, result, ANY_COL);
+}
+
+// Compile expr and check the number of nodes folded away
+void check_folded(const char *expr, enum notation notation, size_t folded)
+{
+	char buf[256];
+	struct pcalc_program *prog;
+	char *errp = NULL;
+
+	strcpy(buf, expr);
+
+	if (pcalc_compile(&prog, &errp, buf, notation) != PCALC_OK) {
+		check(0, "compile '%s'", expr);
+		return;
+	}
+
+	check(pcalc_program_folded(prog) == folded,
+		  "folded '%s': got %zu, want %zu", expr,
+		  pcalc_program_folded(prog), folded);
+	pcalc_program_free(prog);
+}
+
+// Compiled programs, constant folding and where compile errors point
+void check_programs(void)
+{
+	struct pcalc_program *prog;
+	char expr[64];
+	char *errp;
+	int value;
+	int ans = CHECK_ANS;
+
+	check_program("1 2 +", POSTFIX, PCALC_OK, 3, 0);
+	check_program("- 10 3", PREFIX, PCALC_OK, 7, 0);
+	check_program("1 + 2 * 3", INFIX, PCALC_OK, 7, 0);
+	check_program("ans 2 * 3 4 * +", POSTFIX, PCALC_OK, 22, 0);
+	check_program("0 ans -", POSTFIX, PCALC_OK, -CHECK_ANS, 0);
+
+	// Compile errors point at the offending token
+	check_program("1 2 + +", POSTFIX, PCALC_NOT_ENOUGH_VALUES, 0, 6);
+	check_program("1 2", POSTFIX, PCALC_INVALID_EXPRESSION, 0, ANY_COL);
+	check_program("1 @ 2", POSTFIX, PCALC_UKNOWN_TOKEN, 0, 2);
+	check_program("1 x +", POSTFIX, PCALC_UNBOUND_VARIABLE, 0, 2);
+
+	// Operations that fail are not folded away but fail when run
+	check_program("1 0 /", POSTFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("2147483647 1 +", POSTFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("ans 0 /", POSTFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+
+	// Identities fold, as does 0 * x where x can't fail
+	check_program("ans + 0", INFIX, PCALC_OK, CHECK_ANS, 0);
+	check_program("+ 0 ans", PREFIX, PCALC_OK, CHECK_ANS, 0);
+	check_program("ans 1 /", POSTFIX, PCALC_OK, CHECK_ANS, 0);
+	check_program("0 ans *", POSTFIX, PCALC_OK, 0, 0);
+	check_program("ans 1 - 0 *", POSTFIX, PCALC_OK, 0, 0);
+	check_folded("ans + 0", INFIX, 2);
+	check_folded("+ 0 ans", PREFIX, 2);
+	check_folded("1 * ans * 1", INFIX, 4);
+	check_folded("0 ans *", POSTFIX, 2);
+	check_folded("ans 1 - 0 *", POSTFIX, 0);
+	check_folded("- 10 * 2 3", PREFIX, 4);
+	check_folded("1 0 /", POSTFIX, 0);
+	check_folded("2147483647 1 +", POSTFIX, 0);
+
+	// Constant subtrees fold, those with ans don't. A program is run again
+	// with another ans, or none.
+	strcpy(expr, "ans 2 * 3 4 * +");
+	if (pcalc_compile(&prog, &errp, expr, POSTFIX) == PCALC_OK) {
+		check(pcalc_program_folded(prog) == 2,
+			  "folded '%s': got %zu, want 2", expr,
+			  pcalc_program_folded(prog));
+		check(pcalc_program_uses_ans(prog), "uses_ans '%s'", expr);
+		check(pcalc_exec(&value, prog, NULL) == PCALC_NO_LAST_ANS,
+			  "exec '%s' without ans", expr);
+		check(pcalc_exec(&value, prog, &ans) == PCALC_OK && value == 22,
+			  "exec '%s' twice", expr);
+		ans = -1;
+		check(pcalc_exec(&value, prog, &ans) == PCALC_OK && value == 10,
+			  "exec '%s' with ans -1", expr);
+		pcalc_program_free(prog);
+	}
+	else {
+		check(0, "compile '%s'", expr);
+	}
+
+	// ans is still required when it was folded away
+	strcpy(expr, "0 ans *");
+	if (pcalc_compile(&prog, &errp, expr, POSTFIX) == PCALC_OK) {
+		check(pcalc_exec(&value, prog, NULL) == PCALC_NO_LAST_ANS,
+			  "exec '%s' without ans", expr);
+		pcalc_program_free(prog);
+	}
+	else {
+		check(0, "compile '%s'", expr);
+	}
+}
+
+// Feed expr to a stream in chunks of every size, which must all give the
+// same return code, and result or byte offset of the error
+void check_stream(const char *expr, int has_ans, enum retcode ret, int result,
+				  size_t offset)
+{
+	char buf[256];
+	size_t len = strlen(expr);
+	int ans = CHECK_ANS;
+
+	strcpy(buf, expr);
+
+	for (size_t chunk = 1; chunk <= len + 1; chunk++) {
+		struct pcalc_stream *stream = pcalc_stream_new(has_ans ? &ans : NULL);
+		enum retcode got = PCALC_OK;
+		int value = 0;
+
+		if (stream == NULL) {
+			check(0, "stream '%s': out of memory", expr);
+			return;
+		}
+
+		for (size_t i = 0; i < len && got == PCALC_OK; i += chunk)
+			got = pcalc_stream_feed(stream, buf + i,
+									len - i < chunk ? len - i : chunk);
+
+		if (got == PCALC_OK)
+			got = pcalc_stream_finish(stream, &value);
+
+		if (ret == PCALC_OK)
+			check(got == PCALC_OK && value == result,
+				  "stream '%s' in chunks of %zu: got %s %d, want %d", expr,
+				  chunk, retcode_str(got), value, result);
+		else
+			check(got == ret && pcalc_stream_offset(stream) == offset,
+				  "stream '%s' in chunks of %zu: got %s at %zu, want %s at %zu",
+				  expr, chunk, retcode_str(got), pcalc_stream_offset(stream),
+				  retcode_str(ret), offset);
+
+		pcalc_stream_free(stream);
+	}
+}
+
+// Postfix expressions passed in chunks, with tokens split anywhere
+void check_streams(void)
+{
+	struct pcalc_stream *stream = pcalc_stream_new(NULL);
+	char first[] = "0";
+	char chunk[] = " 1 +";
+	int value = 0;
+	enum retcode ret = PCALC_OK;
+
+	check_stream("1 2 +", 0, PCALC_OK, 3, 0);
+	check_stream("12345 678 +", 0, PCALC_OK, 13023, 0);
+	check_stream("10 3 - 2 *", 0, PCALC_OK, 14, 0);
+	check_stream("ans 3 *", 1, PCALC_OK, 3 * CHECK_ANS, 0);
+
+	// Errors are reported at the byte offset of their token
+	check_stream("1 2 + +", 0, PCALC_NOT_ENOUGH_VALUES, 0, 6);
+	check_stream("1 0 /", 0, PCALC_OUT_OF_BOUNDS, 0, 4);
+	check_stream("1 x +", 0, PCALC_UNBOUND_VARIABLE, 0, 2);
+	check_stream("1 @ 2", 0, PCALC_UKNOWN_TOKEN, 0, 2);
+	check_stream("ans 3 *", 0, PCALC_NO_LAST_ANS, 0, 0);
+	check_stream("1 2", 0, PCALC_INVALID_EXPRESSION, 0, 3);
+	check_stream("", 0, PCALC_INVALID_EXPRESSION, 0, 0);
+
+	// Only the value stack is kept, however long the stream
+	if (stream == NULL) {
+		check(0, "stream: out of memory");
+		return;
+	}
+
+	ret = pcalc_stream_feed(stream, first, strlen(first));
+	for (int i = 0; i < 100000 && ret == PCALC_OK; i++)
+		ret = pcalc_stream_feed(stream, chunk, strlen(chunk));
+
+	if (ret == PCALC_OK)
+		ret = pcalc_stream_finish(stream, &value);
+
+	check(ret == PCALC_OK && value == 100000,
+		  "stream of 100000 additions: got %s %d", retcode_str(ret), value);
+	pcalc_stream_free(stream);
+}
+
+// Parentheses, precedence, unary minus and powers in infix notation
+void check_infix(void)
+{
+	check_program("1 + 2 * 3", INFIX, PCALC_OK, 7, 0);
+	check_program("( 1 + 2 ) * 3", INFIX, PCALC_OK, 9, 0);
+	check_program("( ( 1 ) )", INFIX, PCALC_OK, 1, 0);
+	check_program("10 - 4 - 3", INFIX, PCALC_OK, 3, 0);
+	check_program("3 * - 2", INFIX, PCALC_OK, -6, 0);
+	check_program("- - 3", INFIX, PCALC_OK, 3, 0);
+	check_program("- ( ans + 1 )", INFIX, PCALC_OK, -CHECK_ANS - 1, 0);
+
+	// ^ binds tighter than the unary minus and groups to the right, and a
+	// minus directly before a number is its sign
+	check_program("2 ^ 3 ^ 2", INFIX, PCALC_OK, 512, 0);
+	check_program("- 2 ^ 2", INFIX, PCALC_OK, -4, 0);
+	check_program("-2 ^ 2", INFIX, PCALC_OK, 4, 0);
+	check_program("2 ^ -1", INFIX, PCALC_OK, 0, 0);
+	check_program("-1 ^ -3", INFIX, PCALC_OK, -1, 0);
+	check_program("0 ^ -1", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("2 ^ 31", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("- 2147483647 - 1", INFIX, PCALC_OK, -2147483647 - 1, 0);
+	check_program("- ( - 2147483647 - 1 )", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("^ 2 3", PREFIX, PCALC_OK, 8, 0);
+	check_program("2 3 ^", POSTFIX, PCALC_OK, 8, 0);
+
+	// Before anything else it is the operator, so in prefix and postfix
+	// notation -ans is the same as - ans
+	check_program("-ans", INFIX, PCALC_OK, -CHECK_ANS, 0);
+	check_program("-ans ^ 2", INFIX, PCALC_OK, -CHECK_ANS * CHECK_ANS, 0);
+	check_program("3 * -ans", INFIX, PCALC_OK, -3 * CHECK_ANS, 0);
+	check_program("1 -ans", INFIX, PCALC_OK, 1 - CHECK_ANS, 0);
+	check_program("-(1 + 2)", INFIX, PCALC_OK, -3, 0);
+	check_program("+ans", INFIX, PCALC_OK, CHECK_ANS, 0);
+	check_program("--2", INFIX, PCALC_OK, 2, 0);
+	check_program("-ans 3", PREFIX, PCALC_OK, CHECK_ANS - 3, 0);
+	check_program("-ans", PREFIX, PCALC_NOT_ENOUGH_VALUES, 0, 0);
+	check_program("3 -ans", POSTFIX, PCALC_NOT_ENOUGH_VALUES, 0, 2);
+	check_program("3 ans -ans", POSTFIX, PCALC_INVALID_EXPRESSION, 0,
+				  ANY_COL);
+	check_eval("-ans", INFIX, 0, PCALC_NO_LAST_ANS, 0, 1);
+	check_eval("-@", INFIX, 0, PCALC_UKNOWN_TOKEN, 0, 1);
+
+	// Misplaced parentheses point at the parenthesis, an unclosed one at
+	// the end
+	check_eval("1 + 2 )", INFIX, 0, PCALC_INVALID_EXPRESSION, 0, 6);
+	check_eval("( )", INFIX, 0, PCALC_INVALID_EXPRESSION, 0, 2);
+	check_eval("2 ( 3 )", INFIX, 0, PCALC_INVALID_EXPRESSION, 0, 2);
+	check_eval("( 1 + 2", INFIX, 0, PCALC_INVALID_EXPRESSION, 0, 7);
+	check_program("( 1 + 2", INFIX, PCALC_INVALID_EXPRESSION, 0, 7);
+	check_eval("( 1 2 +", POSTFIX, 0, PCALC_UKNOWN_TOKEN, 0, 0);
+	check_eval("1 + ans", INFIX, 0, PCALC_NO_LAST_ANS, 0, 4);
+}
+
+// Remainder, shifts, bitwise operators and min and max
+void check_operators(void)
+{
+	check_program("7 % 3", INFIX, PCALC_OK, 1, 0);
+	check_program("-7 % 3", INFIX, PCALC_OK, -1, 0);
+	check_program("7 % -3", INFIX, PCALC_OK, 1, 0);
+	check_program("1 % 0", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("-2147483648 % -1", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+
+	check_program("1 << 30", INFIX, PCALC_OK, 1 << 30, 0);
+	check_program("-1 << 31", INFIX, PCALC_OK, -2147483647 - 1, 0);
+	check_program("1 << 31", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("2 << 30", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("1 << 32", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("-7 >> 1", INFIX, PCALC_OK, -4, 0);
+	check_program("1 >> -1", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+	check_program("ans >> 32", INFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+
+	check_program("12 & 10", INFIX, PCALC_OK, 8, 0);
+	check_program("12 | 3", INFIX, PCALC_OK, 15, 0);
+	check_program("12 xor 10", INFIX, PCALC_OK, 6, 0);
+	check_program("-1 & 255", INFIX, PCALC_OK, 255, 0);
+	check_program("300 max 0 min 255", INFIX, PCALC_OK, 255, 0);
+	check_program("ans min -3", INFIX, PCALC_OK, -3, 0);
+	check_program("ans max -3", INFIX, PCALC_OK, CHECK_ANS, 0);
+
+	// Precedence as in C, with min and max loosest of all
+	check_program("1 + 2 min 0", INFIX, PCALC_OK, 0, 0);
+	check_program("1 | 2 & 0", INFIX, PCALC_OK, 1, 0);
+	check_program("12 xor 10 & 6", INFIX, PCALC_OK, 14, 0);
+	check_program("1 << 2 + 1", INFIX, PCALC_OK, 8, 0);
+	check_program("2 * 7 % 4", INFIX, PCALC_OK, 2, 0);
+
+	// Prefix notation compiles to instructions with swapped operands
+	check_program("% 7 3", PREFIX, PCALC_OK, 1, 0);
+	check_program("<< 1 3", PREFIX, PCALC_OK, 8, 0);
+	check_program(">> ans 1", PREFIX, PCALC_OK, CHECK_ANS >> 1, 0);
+	check_program("min 4 xor 1 3", PREFIX, PCALC_OK, 2, 0);
+	check_program("7 3 %", POSTFIX, PCALC_OK, 1, 0);
+	check_program("ans 0 %", POSTFIX, PCALC_OUT_OF_BOUNDS, 0, 0);
+
+	check_eval("1 xor", POSTFIX, 0, PCALC_NOT_ENOUGH_VALUES, 0, ANY_COL);
+	check_eval("1 xo 2", INFIX, 0, PCALC_UNBOUND_VARIABLE, 0, 2);
+}
+
+// Compile expr with the variables of vars and run it, then evaluate it with
+// a context reading vars, and check both like check_eval
+void check_var(const char *expr, enum notation notation,
+			   const struct pcalc_vars *vars, enum retcode ret, int result,
+			   long col)
+{
+	char buf[256];
+	struct pcalc_program *prog;
+	struct pcalc_ctx *ctx = pcalc_ctx_new();
+	char *errp = NULL;
+	int value = 0;
+	int ans = CHECK_ANS;
+	enum retcode got;
+
+	strcpy(buf, expr);
+	got = pcalc_compilen(&prog, &errp, buf, strlen(buf), notation, vars);
+
+	if (got == PCALC_OK) {
+		got = pcalc_exec(&value, prog, &ans);
+		pcalc_program_free(prog);
+	}
+
+	check(got == ret && (ret == PCALC_OK ? value == result : col == ANY_COL ||
+						 error_col(buf, errp) == col),
+		  "compile '%s': got %s %d at %ld, want %s %d at %ld", expr,
+		  retcode_str(got), value, error_col(buf, errp), retcode_str(ret),
+		  result, col);
+
+	errp = NULL;
+	value = 0;
+	strcpy(buf, expr);
+	pcalc_ctx_set_vars(ctx, vars);
+	got = pcalc_eval(ctx, &value, &errp, buf, notation, &ans);
+	check(got == ret && (ret == PCALC_OK ? value == result : col == ANY_COL ||
+						 error_col(buf, errp) == col),
+		  "eval '%s': got %s %d at %ld, want %s %d at %ld", expr,
+		  retcode_str(got), value, error_col(buf, errp), retcode_str(ret),
+		  result, col);
+	pcalc_ctx_free(ctx);
+}
+
+// Bind the variable binding and check the return code, and the column of the
+// error unless it is PCALC_OK
+void check_bind(struct pcalc_vars *vars, const char *binding,
+				enum retcode ret, long col)
+{
+	char buf[256];
+	char *errp = NULL;
+	enum retcode got;
+
+	strcpy(buf, binding);
+	got = pcalc_vars_bind(vars, &errp, buf, strlen(buf));
+	check(got == ret && (ret == PCALC_OK || error_col(buf, errp) == col),
+		  "bind '%s': got %s at %ld, want %s at %ld", binding,
+		  retcode_str(got), error_col(buf, errp), retcode_str(ret), col);
+}
+
+// Named variables bound from the command line
+void check_vars(void)
+{
+	struct pcalc_vars *vars = pcalc_vars_new();
+	struct pcalc_program *prog;
+	char expr[] = "rate * count - rate";
+	char *errp = NULL;
+	size_t slots[4];
+	size_t rate;
+	size_t n;
+	int value = 0;
+
+	check_bind(vars, "rate=3", PCALC_OK, 0);
+	check_bind(vars, " count = -14 ", PCALC_OK, 0);
+	check_bind(vars, "_x1 = 7", PCALC_OK, 0);
+	check_bind(vars, "ans=1", PCALC_UKNOWN_TOKEN, 0);
+	check_bind(vars, "xor=1", PCALC_UKNOWN_TOKEN, 0);
+	check_bind(vars, "1x=1", PCALC_UKNOWN_TOKEN, 0);
+	check_bind(vars, "x-y=1", PCALC_INVALID_EXPRESSION, 1);
+	check_bind(vars, "x 1", PCALC_INVALID_EXPRESSION, 2);
+	check_bind(vars, "x=1y", PCALC_UKNOWN_TOKEN, 3);
+	check_bind(vars, "x=99999999999", PCALC_OUT_OF_BOUNDS, 2);
+	check(pcalc_vars_set(vars, "min", 3, 1) == PCALC_UKNOWN_TOKEN,
+		  "set 'min' is not rejected");
+	check(pcalc_vars_set(vars, "", 0, 1) == PCALC_UKNOWN_TOKEN,
+		  "set '' is not rejected");
+
+	check_var("rate * count - 2", INFIX, vars, PCALC_OK, -44, 0);
+	check_var("( rate + _x1 ) * ans", INFIX, vars, PCALC_OK, 50, 0);
+	check_var("- rate ^ 2", INFIX, vars, PCALC_OK, -9, 0);
+	check_var("rate max count", INFIX, vars, PCALC_OK, 3, 0);
+	check_var("* rate - count 1", PREFIX, vars, PCALC_OK, -45, 0);
+	check_var("rate count 1 - *", POSTFIX, vars, PCALC_OK, -45, 0);
+	check_var("rate + nope", INFIX, vars, PCALC_UNBOUND_VARIABLE, 0, 7);
+	check_var("+ 1 nope", PREFIX, vars, PCALC_UNBOUND_VARIABLE, 0, 4);
+	check_var("nope 1 +", POSTFIX, vars, PCALC_UNBOUND_VARIABLE, 0, 0);
+	check_var("rate + 1", INFIX, NULL, PCALC_UNBOUND_VARIABLE, 0, 0);
+	check_var("rate / ( count + 14 )", INFIX, vars, PCALC_OUT_OF_BOUNDS, 0,
+			  ANY_COL);
+	check_var("rate +", INFIX, vars, PCALC_NOT_ENOUGH_VALUES, 0, 6);
+
+	// A sign before a name is the operator, as it is before ans
+	check_var("-rate", INFIX, vars, PCALC_OK, -3, 0);
+	check_var("-rate + 1", INFIX, vars, PCALC_OK, -2, 0);
+	check_var("2 * -count", INFIX, vars, PCALC_OK, 28, 0);
+	check_var("-rate 1", PREFIX, vars, PCALC_OK, 2, 0);
+	check_var("-rate", PREFIX, vars, PCALC_NOT_ENOUGH_VALUES, 0, 0);
+	check_var("rate 1 -rate *", POSTFIX, vars, PCALC_OK, 6, 0);
+	check_var("-nope", INFIX, vars, PCALC_UNBOUND_VARIABLE, 0, 1);
+
+	// A compiled program reads the values when it is run, and its variables
+	// are listed once for every time they are read
+	check(pcalc_compilen(&prog, &errp, expr, strlen(expr), INFIX,
+						 vars) == PCALC_OK, "compile '%s'", expr);
+	pcalc_vars_slot(vars, "rate", 4, &rate);
+	n = pcalc_program_vars(prog, slots);
+	check(n == 3 && slots[0] == rate && slots[2] == rate &&
+		  pcalc_program_vars(prog, NULL) == n && !pcalc_program_uses_ans(prog),
+		  "'%s' reads %zu variables", expr, n);
+	pcalc_vars_set(vars, "rate", 4, 10);
+	check(pcalc_exec(&value, prog, NULL) == PCALC_OK && value == -150,
+		  "'%s' after setting rate = 10: got %d", expr, value);
+	pcalc_program_free(prog);
+
+	pcalc_vars_free(vars);
+}
+
+// Set the formula of line in sh and check the return code, and the column of
+// the error unless it is PCALC_OK
+void check_set(struct sheet *sh, const char *line, enum retcode ret, long col)
+{
+	char buf[256];
+	char *errp = NULL;
+	enum retcode got;
+
+	strcpy(buf, line);
+	got = sheet_set(sh, &errp, buf, strlen(buf), INFIX);
+	check(got == ret && (ret == PCALC_OK || error_col(buf, errp) == col),
+		  "set '%s': got %s at %ld, want %s at %ld", line, retcode_str(got),
+		  error_col(buf, errp), retcode_str(ret), col);
+}
+
+// Update sh and check that the names of the changed nodes, separated by
+// spaces, are want
+void check_update(struct sheet *sh, const char *want)
+{
+	char names[256] = "";
+	size_t *changed;
+	size_t n;
+	enum retcode got = sheet_update(sh, &changed, &n);
+
+	for (size_t i = 0; i < n && got == PCALC_OK; i++) {
+		size_t len;
+		const char *name = sheet_name(sh, changed[i], &len);
+
+		if (i > 0)
+			strcat(names, " ");
+
+		strncat(names, name, len);
+	}
+
+	check(got == PCALC_OK && strcmp(names, want) == 0,
+		  "update: got %s '%s', want '%s'", retcode_str(got), names, want);
+}
+
+// Check the result of node, which must be ret, and value if it is PCALC_OK
+void check_node(struct sheet *sh, size_t node, enum retcode ret, int value)
+{
+	int got_value = 0;
+	enum retcode got = sheet_value(sh, node, &got_value);
+
+	check(got == ret && (ret != PCALC_OK || got_value == value),
+		  "node %zu: got %s %d, want %s %d", node, retcode_str(got),
+		  got_value, retcode_str(ret), value);
+}
+
+// Sheets of formulas computed incrementally
+void check_sheet(void)
+{
+	struct sheet *sh = sheet_new(1);
+	enum { A, B, C, D, E };
+	char line[64];
+	size_t *changed;
+	size_t n;
+
+	check_set(sh, "a = 2", PCALC_OK, 0);
+	check_set(sh, "b = a * 3", PCALC_OK, 0);
+	check_set(sh, "c = b + a", PCALC_OK, 0);
+	check_set(sh, "d = e + 1", PCALC_OK, 0);
+
+	// d fails as e has no formula, which it already did before it was set
+	check_update(sh, "a b c");
+	check(sheet_len(sh) == 5 && sheet_has_formula(sh, D) &&
+		  !sheet_has_formula(sh, E), "sheet has %zu nodes", sheet_len(sh));
+	check_node(sh, A, PCALC_OK, 2);
+	check_node(sh, B, PCALC_OK, 6);
+	check_node(sh, C, PCALC_OK, 8);
+	check_node(sh, D, PCALC_UNBOUND_VARIABLE, 0);
+	check_node(sh, E, PCALC_UNBOUND_VARIABLE, 0);
+
+	// Only the formulas reading a changed result are computed
+	check_set(sh, "a = 3", PCALC_OK, 0);
+	check_update(sh, "a b c");
+	check_node(sh, C, PCALC_OK, 12);
+	check_set(sh, "a = 1 + 2", PCALC_OK, 0);
+	check_update(sh, "");
+	check_set(sh, "e = 4", PCALC_OK, 0);
+	check_update(sh, "e d");
+	check_node(sh, D, PCALC_OK, 5);
+
+	// A cycle fails until it is broken
+	check_set(sh, "b = c - 1", PCALC_OK, 0);
+	check_update(sh, "b c");
+	check_node(sh, B, PCALC_CIRCULAR_DEPENDENCY, 0);
+	check_node(sh, C, PCALC_CIRCULAR_DEPENDENCY, 0);
+	check_node(sh, A, PCALC_OK, 3);
+	check_set(sh, "b = a", PCALC_OK, 0);
+	check_update(sh, "b c");
+	check_node(sh, C, PCALC_OK, 6);
+
+	// Errors are the results of the formulas reading them
+	check_set(sh, "a = 1 / 0", PCALC_OK, 0);
+	check_update(sh, "a b c");
+	check_node(sh, C, PCALC_OUT_OF_BOUNDS, 0);
+	check_set(sh, "a = 1 +", PCALC_NOT_ENOUGH_VALUES, 7);
+	check_update(sh, "a b c");
+	check_node(sh, B, PCALC_NOT_ENOUGH_VALUES, 0);
+	check_set(sh, "= 1", PCALC_UKNOWN_TOKEN, 0);
+	check_set(sh, "min = 1", PCALC_UKNOWN_TOKEN, 0);
+	check_set(sh, "f 1", PCALC_INVALID_EXPRESSION, 2);
+	sheet_free(sh);
+
+	// A level wider than a job is computed by several threads
+	sh = sheet_new(4);
+	check_set(sh, "x = 1", PCALC_OK, 0);
+
+	for (int i = 0; i < 4 * SHEET_CHUNK; i++) {
+		sprintf(line, "y%d = x + %d", i, i);
+		check_set(sh, line, PCALC_OK, 0);
+	}
+
+	sheet_update(sh, &changed, &n);
+	check_set(sh, "x = 100", PCALC_OK, 0);
+	check(sheet_update(sh, &changed, &n) == PCALC_OK &&
+		  n == 4 * SHEET_CHUNK + 1, "wide update changed %zu nodes", n);
+
+	for (int i = 0; i < 4 * SHEET_CHUNK; i++)
+		check_node(sh, i + 1, PCALC_OK, 100 + i);
+
+	sheet_free(sh);
+}
+
+uint64_t image_checksum(const uint64_t *words, size_t n);
+
+// Load a copy of the image of size bytes at data with the len bytes at patch
+// written at offset, and its checksum computed again if rehash is set, and
+// check that the return code is ret
+void check_patch(const void *data, size_t size, size_t offset,
+				 const void *patch, size_t len, int rehash, enum retcode ret)
+{
+	uint64_t *copy = malloc(size);
+	struct pcalc_image *image;
+	size_t words = size / sizeof(uint64_t) - 1;
+	enum retcode got;
+
+	memcpy(copy, data, size);
+	memcpy((char *)copy + offset, patch, len);
+
+	if (rehash)
+		copy[words] = image_checksum(copy, words);
+
+	got = pcalc_image_load(&image, copy, size);
+	check(got == ret, "load patched at %zu: got %s, want %s", offset,
+		  retcode_str(got), retcode_str(ret));
+
+	if (got == PCALC_OK)
+		pcalc_image_free(image);
+
+	free(copy);
+}
+
+// Compiled expressions in a file, and how damaged files are rejected
+void check_image(void)
+{
+	const char *exprs[] = {
+		"ans + 1", "2 ^ 10 - 1", "- ans * 3 max 4", "1 / ( ans - 5 )", "7",
+	};
+	size_t n = sizeof(exprs) / sizeof(exprs[0]);
+	struct pcalc_program *progs[sizeof(exprs) / sizeof(exprs[0])];
+	struct pcalc_vars *vars = pcalc_vars_new();
+	struct pcalc_image *image;
+	char buf[64];
+	char *errp;
+	void *data;
+	size_t size;
+	int ans = CHECK_ANS;
+	enum retcode got;
+
+	for (size_t i = 0; i < n; i++) {
+		strcpy(buf, exprs[i]);
+		pcalc_compile(&progs[i], &errp, buf, INFIX);
+	}
+
+	// The loaded programs run like the ones they were built from
+	check(pcalc_image_build(&data, &size, progs, n) == PCALC_OK &&
+		  size % sizeof(uint64_t) == 0, "build image of %zu programs", n);
+	got = pcalc_image_load(&image, data, size);
+	check(got == PCALC_OK && pcalc_image_len(image) == n,
+		  "load image: got %s", retcode_str(got));
+
+	for (size_t i = 0; i < n && got == PCALC_OK; i++) {
+		const struct pcalc_program *prog = pcalc_image_program(image, i);
+		int want = 0;
+		int value = 0;
+		enum retcode want_ret = pcalc_exec(&want, progs[i], &ans);
+		enum retcode ret = pcalc_exec(&value, prog, &ans);
+
+		check(ret == want_ret && value == want &&
+			  pcalc_program_uses_ans(prog) ==
+			  pcalc_program_uses_ans(progs[i]),
+			  "image '%s': got %s %d, want %s %d", exprs[i],
+			  retcode_str(ret), value, retcode_str(want_ret), want);
+	}
+
+	if (got == PCALC_OK)
+		pcalc_image_free(image);
+
+	free(data);
+
+	// The first program alone, ans + 1, is laid out as the 40 byte header,
+	// its 24 byte index entry, the constant 1 and the code ANS PUSH ADD
+	pcalc_image_build(&data, &size, progs, 1);
+	check_patch(data, size, 64, &(int){2}, sizeof(int), 1, PCALC_OK);
+	check_patch(data, size, 64, &(int){2}, sizeof(int), 0,
+				PCALC_INVALID_IMAGE);
+	check_patch(data, size, 70, &(char){1}, 1, 0, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 0, "x", 1, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 8, &(uint32_t){2}, 4, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 16, &(uint32_t){1}, 4, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 20, &(uint32_t){1}, 4, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 24, &(uint64_t){2}, 8, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 40, &(uint64_t){60}, 8, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 40, &(uint64_t){8}, 8, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 52, &(uint32_t){200}, 4, 1,
+				PCALC_INVALID_IMAGE);
+	check_patch(data, size, 56, &(uint32_t){1}, 4, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 60, &(uint32_t){0}, 4, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 60, &(uint32_t){3}, 4, 1, PCALC_INVALID_IMAGE);
+
+	// Code that would read outside the value stack or the constant pool
+	check_patch(data, size, 68, &(char){OPC_ANS}, 1, 1, PCALC_OK);
+	check_patch(data, size, 69, &(char){OPC_PUSH}, 1, 1, PCALC_OK);
+	check_patch(data, size, 68, &(char){OPC_ADD}, 1, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 69, &(char){OPC_ANS}, 1, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 69, &(char){OPC_VAR}, 1, 1, PCALC_INVALID_IMAGE);
+	check_patch(data, size, 70, &(char){OPC_NEG + 1}, 1, 1,
+				PCALC_INVALID_IMAGE);
+	check_patch(data, size, 70, &(char){OPC_NEG}, 1, 1, PCALC_INVALID_IMAGE);
+
+	got = pcalc_image_load(&image, data, size - sizeof(uint64_t));
+	check(got == PCALC_INVALID_IMAGE, "load truncated: got %s",
+		  retcode_str(got));
+	got = pcalc_image_load(&image, data, 0);
+	check(got == PCALC_INVALID_IMAGE, "load empty: got %s", retcode_str(got));
+	free(data);
+
+	for (size_t i = 0; i < n; i++)
+		pcalc_program_free(progs[i]);
+
+	// Variables can't be stored
+	pcalc_vars_set(vars, "x", 1, 1);
+	strcpy(buf, "x + 1");
+	pcalc_compilen(&progs[0], &errp, buf, strlen(buf), INFIX, vars);
+	got = pcalc_image_build(&data, &size, progs, 1);
+	check(got == PCALC_UNBOUND_VARIABLE, "build with variables: got %s",
+		  retcode_str(got));
+	pcalc_program_free(progs[0]);
+	pcalc_vars_free(vars);
+
+	got = pcalc_image_build(&data, &size, NULL, 0);
+	check(got == PCALC_OK, "build empty image: got %s", retcode_str(got));
+	got = pcalc_image_load(&image, data, size);
+	check(got == PCALC_OK && pcalc_image_len(image) == 0,
+		  "load empty image: got %s", retcode_str(got));
+
+	if (got == PCALC_OK)
+		pcalc_image_free(image);
+
+	free(data);
+}
+
+struct check checks[] = {
+	{"program", check_programs},
+	{"stream", check_streams},
+	{"infix", check_infix},
+	{"operators", check_operators},
+	{"vars", check_vars},
+	{"sheet", check_sheet},
+	{"image", check_image},
+};
+
+int main(int argc, char **argv)
+{
+	size_t n = sizeof(checks) / sizeof(checks[0]);
+
+	for (size_t i = 0; i < n; i++) {
+		int selected = argc < 2;
+
+		for (int j = 1; j < argc; j++)
+			if (strcmp(argv[j], checks[i].name) == 0)
+				selected = 1;
+
+		if (selected)
+			checks[i].run();
+	}
+
+	printf("%zu checks, %zu failed\n", check_count, check_failures);
+
+	return check_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+//
+//  column.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "program.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define COLUMN_X86
+#include <immintrin.h>
+#endif
+
+// A program is run over COLUMN_LANES values of ans at a time. The value stack
+// holds a vector of lanes in each slot, and a bit for each lane records
+// whether it has failed. Failed lanes go on being computed with whatever
+// values they hold, except where that could trap, and their results are
+// discarded.
+#define COLUMN_LANES 8
+
+typedef int lanes[COLUMN_LANES];
+
+// Run prog over the first n lanes of ans, n <= COLUMN_LANES. Returns the
+// failed lanes.
+typedef unsigned (*column_block)(const struct pcalc_program *prog,
+								 lanes *stack, const int *ans, int *results,
+								 size_t n);
+
+// Binary operation of opcode op on every lane, setting failed bits. The right
+// operand of the swapped opcodes such as OPC_RSUB is a.
+unsigned scalar_binop(enum opcode op, int *a, const int *b, size_t n)
+{
+	int swapped;
+	enum token_type type = opcode_to_op(op, &swapped);
+	unsigned failed = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		int lval = swapped ? b[i] : a[i];
+		int rval = swapped ? a[i] : b[i];
+
+		if (pcalc_binop(&a[i], type, lval, rval) != PCALC_OK)
+			failed |= 1u << i;
+	}
+
+	return failed;
+}
+
+unsigned scalar_neg(int *a, size_t n)
+{
+	unsigned failed = 0;
+
+	for (size_t i = 0; i < n; i++)
+		if (pcalc_unop(&a[i], OP_NEG, a[i]) != PCALC_OK)
+			failed |= 1u << i;
+
+	return failed;
+}
+
+unsigned scalar_block(const struct pcalc_program *prog, lanes *stack,
+					  const int *ans, int *results, size_t n)
+{
+	const int *k = prog->consts;
+	const int *vars = program_vars(prog);
+	size_t top = 0;
+	unsigned failed = 0;
+
+	for (size_t i = 0; i < prog->code_len; i++) {
+		switch (prog->code[i]) {
+			case OPC_PUSH:
+			case OPC_VAR:
+				for (size_t j = 0; j < n; j++)
+					stack[top][j] = prog->code[i] == OPC_PUSH ? *k : vars[*k];
+				k++;
+				top++;
+				break;
+
+			case OPC_ANS:
+				memcpy(stack[top++], ans, n * sizeof(int));
+				break;
+
+			case OPC_NEG:
+				failed |= scalar_neg(stack[top - 1], n);
+				break;
+
+			default:
+				top--;
+				failed |= scalar_binop(prog->code[i], stack[top - 1],
+									   stack[top], n);
+				break;
+		}
+	}
+
+	memcpy(results, stack[0], n * sizeof(int));
+
+	return failed;
+}
+
+#ifdef COLUMN_X86
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Lanes whose sign bit is set in x
+AVX2 unsigned avx2_sign_mask(__m256i x)
+{
+	return _mm256_movemask_ps(_mm256_castsi256_ps(x));
+}
+
+AVX2 unsigned avx2_binop(enum opcode op, int *dst, const int *src)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *)dst);
+	__m256i b = _mm256_loadu_si256((const __m256i *)src);
+	__m256i r, hi, even, odd;
+	unsigned failed;
+
+	switch (op) {
+		case OPC_ADD:
+			// Overflow if the result has the opposite sign of both operands
+			r = _mm256_add_epi32(a, b);
+			failed = avx2_sign_mask(_mm256_and_si256(_mm256_xor_si256(a, r),
+													 _mm256_xor_si256(b, r)));
+			break;
+
+		case OPC_SUB:
+		case OPC_RSUB:
+			if (op == OPC_RSUB) {
+				__m256i t = a;
+				a = b;
+				b = t;
+			}
+
+			// Overflow if the operands differ in sign and the result does
+			// not have the sign of the left operand
+			r = _mm256_sub_epi32(a, b);
+			failed = avx2_sign_mask(_mm256_and_si256(_mm256_xor_si256(a, b),
+													 _mm256_xor_si256(a, r)));
+			break;
+
+		case OPC_MULT:
+			// Overflow if the high half of the 64-bit product is not the
+			// sign extension of the low half
+			r = _mm256_mullo_epi32(a, b);
+			even = _mm256_mul_epi32(a, b);
+			odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32),
+								   _mm256_srli_epi64(b, 32));
+			hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+			failed = ~avx2_sign_mask(_mm256_cmpeq_epi32(
+						hi, _mm256_srai_epi32(r, 31))) & 0xFF;
+			break;
+
+		// These can not fail
+		case OPC_AND:	r = _mm256_and_si256(a, b);	failed = 0;	break;
+		case OPC_OR:	r = _mm256_or_si256(a, b);	failed = 0;	break;
+		case OPC_XOR:	r = _mm256_xor_si256(a, b);	failed = 0;	break;
+		case OPC_MIN:	r = _mm256_min_epi32(a, b);	failed = 0;	break;
+		case OPC_MAX:	r = _mm256_max_epi32(a, b);	failed = 0;	break;
+
+		default:
+			// There is no vector integer division, and the checks of powers
+			// and shifts depend on the values of each lane
+			return scalar_binop(op, dst, src, COLUMN_LANES);
+	}
+
+	_mm256_storeu_si256((__m256i *)dst, r);
+
+	return failed;
+}
+
+// Negation overflows only for INT_MIN, which is its own negation
+AVX2 unsigned avx2_neg(int *dst)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *)dst);
+	__m256i r = _mm256_sub_epi32(_mm256_setzero_si256(), a);
+
+	_mm256_storeu_si256((__m256i *)dst, r);
+
+	return avx2_sign_mask(_mm256_and_si256(a, r));
+}
+
+AVX2 unsigned avx2_block(const struct pcalc_program *prog, lanes *stack,
+						 const int *ans, int *results, size_t n)
+{
+	const int *k = prog->consts;
+	const int *vars = program_vars(prog);
+	size_t top = 0;
+	unsigned failed = 0;
+
+	if (n < COLUMN_LANES)
+		return scalar_block(prog, stack, ans, results, n);
+
+	for (size_t i = 0; i < prog->code_len; i++) {
+		switch (prog->code[i]) {
+			case OPC_PUSH:
+				_mm256_storeu_si256((__m256i *)stack[top++],
+									_mm256_set1_epi32(*k++));
+				break;
+
+			case OPC_VAR:
+				_mm256_storeu_si256((__m256i *)stack[top++],
+									_mm256_set1_epi32(vars[*k++]));
+				break;
+
+			case OPC_ANS:
+				_mm256_storeu_si256((__m256i *)stack[top++],
+									_mm256_loadu_si256((const __m256i *)ans));
+				break;
+
+			case OPC_NEG:
+				failed |= avx2_neg(stack[top - 1]);
+				break;
+
+			default:
+				top--;
+				failed |= avx2_binop(prog->code[i], stack[top - 1],
+									 stack[top]);
+				break;
+		}
+	}
+
+	memcpy(results, stack[0], COLUMN_LANES * sizeof(int));
+
+	return failed;
+}
+
+column_block run_block = scalar_block;
+
+// Runs before main, so run_block is never written while other threads read it
+__attribute__((constructor)) void column_init(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		run_block = avx2_block;
+}
+
+#else
+
+column_block run_block = scalar_block;
+
+#endif
+
+// Evaluate prog once for each of the n values of ans, which stand in for the
+// ans keyword. results[i] is only defined if rets[i] is PCALC_OK, the only
+// other per value result is PCALC_OUT_OF_BOUNDS, as from pcalc_exec. Returns
+// PCALC_MEMORY_ALLOC if the stack could not be allocated.
+enum retcode pcalc_exec_column(const struct pcalc_program *prog,
+							   const int *ans, int *results,
+							   enum retcode *rets, size_t n)
+{
+	lanes local_stack[EXEC_STACK_SIZE / COLUMN_LANES];
+	lanes *stack = local_stack;
+
+	if (prog->depth > EXEC_STACK_SIZE / COLUMN_LANES) {
+		stack = malloc(prog->depth * sizeof(*stack));
+
+		if (stack == NULL)
+			return PCALC_MEMORY_ALLOC;
+	}
+
+	for (size_t i = 0; i < n; i += COLUMN_LANES) {
+		size_t len = n - i < COLUMN_LANES ? n - i : COLUMN_LANES;
+		unsigned failed = run_block(prog, stack, ans + i, results + i, len);
+
+		for (size_t j = 0; j < len; j++)
+			rets[i + j] = failed & 1u << j ? PCALC_OUT_OF_BOUNDS : PCALC_OK;
+	}
+
+	if (stack != local_stack)
+		free(stack);
+
+	return PCALC_OK;
+}
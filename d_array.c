@@ -9,28 +9,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include "d_array.h"
+#include "profile.h"
 
 struct d_array {
 	void  *array;
 	size_t size;
 	size_t elem_num;
 	size_t elem_size;
+	struct arena *arena;	// NULL for heap memory
 };
 
-void da_init(d_array *da, size_t elem_size, size_t initial_count)
+void da_init(d_array *da, size_t elem_size, size_t initial_count,
+			 struct arena *arena)
 {
 	da->size = elem_size * initial_count;
 	da->elem_num = 0;
 	da->elem_size = elem_size;
-	da->array = malloc(da->size);
+	da->arena = arena;
+
+	if (arena)
+		da->array = arena_alloc(arena, da->size);
+	else
+		da->array = malloc(da->size);
 }
 
-d_array *da_new(size_t elem_size, size_t initial_count)
+d_array *da_new(size_t elem_size, size_t initial_count, struct arena *arena)
 {
-	d_array *da = malloc(sizeof(d_array));
+	d_array *da;
+
+	if (arena)
+		da = arena_alloc(arena, sizeof(d_array));
+	else
+		da = malloc(sizeof(d_array));
 
-	if (da)
-		da_init(da, elem_size, initial_count);
+	if (da) {
+		da_init(da, elem_size, initial_count, arena);
+
+		if (da->array == NULL)
+			da_free(&da);
+	}
 
 	return da;
 }
@@ -38,8 +55,10 @@ d_array *da_new(size_t elem_size, size_t initial_count)
 void da_free(d_array **dapp)
 {
 	if (dapp && *dapp) {
-		free((*dapp)->array);
-		free(*dapp);
+		if ((*dapp)->arena == NULL) {
+			free((*dapp)->array);
+			free(*dapp);
+		}
 		*dapp = NULL;
 	}
 }
@@ -51,7 +70,14 @@ size_t da_get_size(d_array *da)
 
 d_array *da_set_size(d_array *da, size_t max_num)
 {
-	void *new_array = realloc(da->array, max_num * da->elem_size);
+	void *new_array;
+
+	if (da->arena)
+		new_array = arena_realloc(da->arena, da->array,
+								  da->elem_num * da->elem_size,
+								  max_num * da->elem_size);
+	else
+		new_array = realloc(da->array, max_num * da->elem_size);
 
 	if (new_array) {
 		if (da->elem_num > max_num)
@@ -68,9 +94,16 @@ d_array *da_set_size(d_array *da, size_t max_num)
 
 d_array *da_append(d_array *da, void *elem)
 {
-	if (da->elem_num * da->elem_size >= da->size)
-		if (da_set_size(da, da->elem_num * 2) == NULL)
+	if (da->elem_num * da->elem_size >= da->size) {
+		PROFILE_START(start);
+		d_array *grown = da_set_size(da, da->elem_num * 2);
+
+		PROFILE_STOP(PROF_T_GROW, start);
+		PROFILE_COUNT(PROF_ARRAY_GROW);
+
+		if (grown == NULL)
 			return NULL;
+	}
 
 	memcpy((char *) da->array + da->elem_num * da->elem_size,
 		   elem, da->elem_size);
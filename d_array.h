@@ -9,11 +9,14 @@
 #ifndef DYNAMIC_ARRAY_H
 #define DYNAMIC_ARRAY_H
 
+#include "arena.h"
+
 struct d_array;
 typedef struct d_array d_array;
 
-void		da_init(d_array *da, size_t elem_size, size_t initial_count);
-d_array *	da_new(size_t elem_size, size_t initial_count);
+void		da_init(d_array *da, size_t elem_size, size_t initial_count,
+					struct arena *arena);
+d_array *	da_new(size_t elem_size, size_t initial_count, struct arena *arena);
 void		da_free(d_array **dapp);
 size_t		da_get_size(d_array *da);
 d_array *	da_set_size(d_array *da, size_t max_num);
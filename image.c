@@ -0,0 +1,260 @@
+//
+//  image.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pcalc.h"
+#include "program.h"
+
+// Compiled expressions stored in a file, so that a process can load many
+// fixed expressions without tokenizing them again. The file is meant to be
+// mapped into memory, and the constant pools and code of the programs are run
+// where they lie. Loading only checks the file and sets up a program header
+// pointing into it for each expression.
+//
+// The fields are in the byte order of the machine that built the file, and
+// every part starts at a multiple of 8 bytes:
+//
+//     header     struct image_header
+//     index      struct image_entry for each program
+//     programs   constant pool of ints followed by the code of each program,
+//                padded with zeroes to a multiple of 8 bytes
+//     checksum   uint64_t, see image_checksum
+//
+// The code is checked when the file is loaded like pcalc_compile would have
+// produced it, so that a damaged file can't make pcalc_exec read outside the
+// program or its value stack. Programs with variables are not stored, as the
+// slots mean nothing without the table they were compiled with.
+
+#define IMAGE_MAGIC "pcalcimg"
+#define IMAGE_VERSION 1
+#define IMAGE_ORDER 0x01020304
+
+// Flags of an image_entry
+#define IMAGE_USES_ANS 1
+
+#define IMAGE_ALIGN sizeof(uint64_t)
+#define IMAGE_PAD(n) (((n) + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1))
+
+struct image_header {
+	char magic[8];		// IMAGE_MAGIC without the terminator
+	uint32_t version;	// IMAGE_VERSION
+	uint32_t order;		// IMAGE_ORDER, in another order if built elsewhere
+	uint32_t int_size;	// Of the constants
+	uint32_t reserved;	// Zero
+	uint64_t count;		// Programs
+	uint64_t size;		// Of the file, including the checksum
+};
+
+struct image_entry {
+	uint64_t offset;	// Of the constant pool from the start of the file
+	uint32_t const_len;
+	uint32_t code_len;
+	uint32_t depth;
+	uint32_t flags;
+};
+
+struct pcalc_image {
+	size_t len;
+	struct pcalc_program progs[];
+};
+
+// FNV-1a over 64-bit words rather than bytes, which is fast enough to check
+// on every load
+uint64_t image_checksum(const uint64_t *words, size_t n)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < n; i++) {
+		hash ^= words[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// Build a file of the n programs at progs in a buffer allocated with malloc,
+// which is stored in *datap and its size in *sizep
+enum retcode pcalc_image_build(void **datap, size_t *sizep,
+							   struct pcalc_program *const *progs, size_t n)
+{
+	uint64_t size = sizeof(struct image_header) +
+		n * sizeof(struct image_entry);
+	struct image_header *header;
+	struct image_entry *index;
+	unsigned char *data;
+	uint64_t offset;
+
+	for (size_t i = 0; i < n; i++) {
+		if (pcalc_program_vars(progs[i], NULL) > 0)
+			return PCALC_UNBOUND_VARIABLE;
+
+		if (progs[i]->const_len > UINT32_MAX ||
+			progs[i]->code_len > UINT32_MAX || progs[i]->depth > UINT32_MAX)
+			return PCALC_OUT_OF_BOUNDS;
+
+		size += IMAGE_PAD(progs[i]->const_len * sizeof(int) +
+						  progs[i]->code_len);
+	}
+
+	size += sizeof(uint64_t);
+
+	if (size > SIZE_MAX)
+		return PCALC_OUT_OF_BOUNDS;
+
+	data = calloc(1, size);
+
+	if (data == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	header = (struct image_header *)data;
+	memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+	header->version = IMAGE_VERSION;
+	header->order = IMAGE_ORDER;
+	header->int_size = sizeof(int);
+	header->count = n;
+	header->size = size;
+
+	index = (struct image_entry *)(header + 1);
+	offset = sizeof(*header) + n * sizeof(*index);
+
+	for (size_t i = 0; i < n; i++) {
+		const struct pcalc_program *prog = progs[i];
+		size_t const_size = prog->const_len * sizeof(int);
+
+		index[i].offset = offset;
+		index[i].const_len = prog->const_len;
+		index[i].code_len = prog->code_len;
+		index[i].depth = prog->depth;
+		index[i].flags = prog->uses_ans ? IMAGE_USES_ANS : 0;
+
+		memcpy(data + offset, prog->consts, const_size);
+		memcpy(data + offset + const_size, prog->code, prog->code_len);
+		offset += IMAGE_PAD(const_size + prog->code_len);
+	}
+
+	*(uint64_t *)(data + offset) =
+		image_checksum((uint64_t *)data, offset / sizeof(uint64_t));
+
+	*datap = data;
+	*sizep = size;
+
+	return PCALC_OK;
+}
+
+// Whether the program of entry lies within the size bytes at data and its
+// code is valid. The program is set up in prog.
+int image_program(struct pcalc_program *prog, const unsigned char *data,
+				  uint64_t size, const struct image_entry *entry)
+{
+	uint64_t const_size = (uint64_t)entry->const_len * sizeof(int);
+	size_t depth = 0;
+	size_t max_depth = 0;
+	size_t pushes = 0;
+	int reads_ans = 0;
+
+	if (entry->offset % IMAGE_ALIGN != 0 || entry->offset > size ||
+		const_size + entry->code_len > size - entry->offset ||
+		entry->code_len == 0 || entry->flags & ~IMAGE_USES_ANS)
+		return 0;
+
+	prog->code_len = entry->code_len;
+	prog->const_len = entry->const_len;
+	prog->depth = entry->depth;
+	prog->uses_ans = entry->flags & IMAGE_USES_ANS;
+	prog->folded = 0;
+	prog->vars = NULL;
+	prog->consts = (int *)(data + entry->offset);
+	prog->code = (unsigned char *)(data + entry->offset + const_size);
+
+	// Every instruction takes its operands and leaves one value. The checks
+	// are written without branches on the opcode, which would mispredict.
+	for (size_t i = 0; i < prog->code_len; i++) {
+		unsigned char op = prog->code[i];
+		size_t pops = op == OPC_NEG ? 1 : op > OPC_VAR ? 2 : 0;
+
+		// OPC_NEG is the last opcode
+		if (op == OPC_VAR || op > OPC_NEG || depth < pops)
+			return 0;
+
+		depth = depth - pops + 1;
+		pushes += op == OPC_PUSH;
+		reads_ans |= op == OPC_ANS;
+		max_depth = depth > max_depth ? depth : max_depth;
+	}
+
+	return depth == 1 && max_depth == prog->depth &&
+		pushes == prog->const_len && (prog->uses_ans || !reads_ans);
+}
+
+// Load the file of size bytes at data, see pcalc_image_build. data must be
+// aligned to 8 bytes, as mmap and malloc return it, and the programs of the
+// image point into it, so it must outlive the image.
+enum retcode pcalc_image_load(struct pcalc_image **imagep, const void *data,
+							  size_t size)
+{
+	const struct image_header *header = data;
+	const struct image_entry *index = (const struct image_entry *)(header + 1);
+	const unsigned char *bytes = data;
+	struct pcalc_image *image;
+	uint64_t body;
+
+	if ((uintptr_t)data % IMAGE_ALIGN != 0 || size % IMAGE_ALIGN != 0 ||
+		size < sizeof(*header) + sizeof(uint64_t) ||
+		memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != IMAGE_VERSION || header->order != IMAGE_ORDER ||
+		header->int_size != sizeof(int) || header->reserved != 0 ||
+		header->size != size)
+		return PCALC_INVALID_IMAGE;
+
+	body = size - sizeof(uint64_t);
+
+	if (header->count > (body - sizeof(*header)) / sizeof(*index) ||
+		image_checksum(data, body / sizeof(uint64_t)) !=
+		*(const uint64_t *)(bytes + body))
+		return PCALC_INVALID_IMAGE;
+
+	image = malloc(sizeof(*image) + header->count * sizeof(image->progs[0]));
+
+	if (image == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	image->len = header->count;
+
+	for (size_t i = 0; i < image->len; i++) {
+		if (!image_program(&image->progs[i], bytes, body, &index[i])) {
+			free(image);
+			return PCALC_INVALID_IMAGE;
+		}
+	}
+
+	*imagep = image;
+
+	return PCALC_OK;
+}
+
+// Number of programs in image
+size_t pcalc_image_len(const struct pcalc_image *image)
+{
+	return image->len;
+}
+
+// Program i of image, which can be run as long as the image is loaded
+const struct pcalc_program *pcalc_image_program(const struct pcalc_image *img,
+												size_t i)
+{
+	return &img->progs[i];
+}
+
+// Free the program headers of image, but not the file data it was loaded from
+void pcalc_image_free(struct pcalc_image *image)
+{
+	free(image);
+}
@@ -0,0 +1,333 @@
+//
+//  jit.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#define _DEFAULT_SOURCE		// MAP_ANONYMOUS
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pcalc.h"
+#include "program.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+#define JIT_X86_64
+#endif
+
+// Deepest program that is compiled to native code. Values live on the
+// machine stack, so this bounds the stack used by pcalc_jit_exec.
+#define JIT_MAX_DEPTH 4096
+
+// Longest machine code emitted for one instruction
+#define JIT_INSN_SIZE 32
+
+// Native code takes the result pointer, ans and the values of the variables in
+// the registers of the System V ABI and returns nonzero if the result is out
+// of bounds
+typedef int (*jit_func)(int *result, int ans, const int *vars);
+
+// A program and its machine code, NULL if it is run by pcalc_exec
+struct pcalc_jit {
+	const struct pcalc_program *prog;
+	void *code;
+	size_t size;
+	jit_func func;
+};
+
+#ifdef JIT_X86_64
+
+struct jit_buf {
+	unsigned char *start;
+	unsigned char *p;
+};
+
+void jit_emit(struct jit_buf *b, const char *bytes, size_t n)
+{
+	memcpy(b->p, bytes, n);
+	b->p += n;
+}
+
+void jit_emit_imm32(struct jit_buf *b, int32_t imm)
+{
+	memcpy(b->p, &imm, sizeof(imm));
+	b->p += sizeof(imm);
+}
+
+// Emit a conditional jump with a 32-bit displacement to target. cc is the
+// second opcode byte, e.g. 0x80 for jo.
+void jit_emit_jcc(struct jit_buf *b, unsigned char cc, unsigned char *target)
+{
+	*b->p++ = 0x0F;
+	*b->p++ = cc;
+	jit_emit_imm32(b, target - (b->p + 4));
+}
+
+// The top of the value stack is kept in eax and the values below it are
+// pushed on the machine stack, ans stays in esi and the variables are read
+// through r9, since division clobbers rdx. The error exit comes first so that
+// every jump to it is backwards and needs no patching.
+void jit_emit_program(struct jit_buf *b, const struct pcalc_program *prog,
+					  unsigned char **entry)
+{
+	const int *k = prog->consts;
+	unsigned char *error = b->p;
+	size_t depth = 0;
+
+	jit_emit(b, "\x48\x89\xEC", 3);				// mov rsp, rbp
+	jit_emit(b, "\x5D", 1);						// pop rbp
+	jit_emit(b, "\xB8\x01\x00\x00\x00", 5);		// mov eax, 1
+	jit_emit(b, "\xC3", 1);						// ret
+
+	*entry = b->p;
+	jit_emit(b, "\x55", 1);						// push rbp
+	jit_emit(b, "\x48\x89\xE5", 3);				// mov rbp, rsp
+	jit_emit(b, "\x49\x89\xD1", 3);				// mov r9, rdx
+
+	for (size_t i = 0; i < prog->code_len; i++) {
+		switch (prog->code[i]) {
+			case OPC_PUSH:
+			case OPC_ANS:
+			case OPC_VAR:
+				if (depth++ > 0)
+					jit_emit(b, "\x50", 1);		// push rax
+
+				if (prog->code[i] == OPC_PUSH) {
+					jit_emit(b, "\xB8", 1);		// mov eax, imm32
+					jit_emit_imm32(b, *k++);
+				}
+				else if (prog->code[i] == OPC_VAR) {
+					jit_emit(b, "\x41\x8B\x81", 3);	// mov eax, [r9 + disp32]
+					jit_emit_imm32(b, *k++ * sizeof(int));
+				}
+				else {
+					jit_emit(b, "\x89\xF0", 2);	// mov eax, esi
+				}
+				continue;
+
+			case OPC_NEG:
+				jit_emit(b, "\xF7\xD8", 2);		// neg eax
+				jit_emit_jcc(b, 0x80, error);	// jo error
+				continue;
+
+			default:
+				// The left operand goes to ecx and the right one stays in
+				// eax. The swapped opcodes such as OPC_RSUB swap them.
+				jit_emit(b, "\x59", 1);			// pop rcx
+				depth--;
+				break;
+		}
+
+		switch (prog->code[i]) {
+			case OPC_ADD:
+				jit_emit(b, "\x01\xC8", 2);		// add eax, ecx
+				jit_emit_jcc(b, 0x80, error);	// jo error
+				break;
+
+			case OPC_SUB:
+				jit_emit(b, "\x29\xC1", 2);		// sub ecx, eax
+				jit_emit_jcc(b, 0x80, error);	// jo error
+				jit_emit(b, "\x89\xC8", 2);		// mov eax, ecx
+				break;
+
+			case OPC_RSUB:
+				jit_emit(b, "\x29\xC8", 2);		// sub eax, ecx
+				jit_emit_jcc(b, 0x80, error);	// jo error
+				break;
+
+			case OPC_MULT:
+				jit_emit(b, "\x0F\xAF\xC1", 3);	// imul eax, ecx
+				jit_emit_jcc(b, 0x80, error);	// jo error
+				break;
+
+			case OPC_DIV:
+			case OPC_RDIV:
+			case OPC_MOD:
+			case OPC_RMOD:
+				// Dividend in eax and divisor in ecx, checked like
+				// is_undefined_div since idiv would trap
+				if (prog->code[i] == OPC_DIV || prog->code[i] == OPC_MOD)
+					jit_emit(b, "\x91", 1);		// xchg eax, ecx
+
+				jit_emit(b, "\x85\xC9", 2);		// test ecx, ecx
+				jit_emit_jcc(b, 0x84, error);	// jz error
+				jit_emit(b, "\x83\xF9\xFF", 3);	// cmp ecx, -1
+				jit_emit(b, "\x75\x0B", 2);		// jne divide
+				jit_emit(b, "\x3D", 1);			// cmp eax, INT_MIN
+				jit_emit_imm32(b, INT32_MIN);
+				jit_emit_jcc(b, 0x84, error);	// je error
+				jit_emit(b, "\x99", 1);			// divide: cdq
+				jit_emit(b, "\xF7\xF9", 2);		// idiv ecx
+
+				if (prog->code[i] == OPC_MOD || prog->code[i] == OPC_RMOD)
+					jit_emit(b, "\x89\xD0", 2);	// mov eax, edx
+				break;
+
+			case OPC_SHL:
+			case OPC_RSHL:
+			case OPC_SHR:
+			case OPC_RSHR:
+				// Value in eax and count in ecx, which must be 0 to 31
+				if (prog->code[i] == OPC_SHL || prog->code[i] == OPC_SHR)
+					jit_emit(b, "\x91", 1);		// xchg eax, ecx
+
+				jit_emit(b, "\x83\xF9\x1F", 3);	// cmp ecx, 31
+				jit_emit_jcc(b, 0x87, error);	// ja error
+
+				if (prog->code[i] == OPC_SHR || prog->code[i] == OPC_RSHR) {
+					jit_emit(b, "\xD3\xF8", 2);	// sar eax, cl
+					break;
+				}
+
+				// Overflow if shifting back does not give the value
+				jit_emit(b, "\x89\xC2", 2);		// mov edx, eax
+				jit_emit(b, "\xD3\xE0", 2);		// shl eax, cl
+				jit_emit(b, "\x41\x89\xC0", 3);	// mov r8d, eax
+				jit_emit(b, "\x41\xD3\xF8", 3);	// sar r8d, cl
+				jit_emit(b, "\x41\x39\xD0", 3);	// cmp r8d, edx
+				jit_emit_jcc(b, 0x85, error);	// jne error
+				break;
+
+			case OPC_AND:
+				jit_emit(b, "\x21\xC8", 2);		// and eax, ecx
+				break;
+
+			case OPC_OR:
+				jit_emit(b, "\x09\xC8", 2);		// or eax, ecx
+				break;
+
+			case OPC_XOR:
+				jit_emit(b, "\x31\xC8", 2);		// xor eax, ecx
+				break;
+
+			case OPC_MIN:
+				jit_emit(b, "\x39\xC1", 2);		// cmp ecx, eax
+				jit_emit(b, "\x0F\x4C\xC1", 3);	// cmovl eax, ecx
+				break;
+
+			case OPC_MAX:
+				jit_emit(b, "\x39\xC1", 2);		// cmp ecx, eax
+				jit_emit(b, "\x0F\x4F\xC1", 3);	// cmovg eax, ecx
+				break;
+
+			default:
+				assert(0);
+		}
+	}
+
+	jit_emit(b, "\x89\x07", 2);					// mov [rdi], eax
+	jit_emit(b, "\x48\x89\xEC", 3);				// mov rsp, rbp
+	jit_emit(b, "\x5D", 1);						// pop rbp
+	jit_emit(b, "\x31\xC0", 2);					// xor eax, eax
+	jit_emit(b, "\xC3", 1);						// ret
+}
+
+// Compile prog to machine code in a mapping that is made executable once it
+// is written. Leaves jit->func NULL if the code cannot be mapped.
+void jit_compile_native(struct pcalc_jit *jit)
+{
+	const struct pcalc_program *prog = jit->prog;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t size = (prog->code_len + 2) * JIT_INSN_SIZE;
+	struct jit_buf b;
+	unsigned char *entry;
+	void *code;
+
+	if (prog->depth > JIT_MAX_DEPTH || page <= 0)
+		return;
+
+	// Powers are left to pcalc_exec, they would need a loop
+	if (memchr(prog->code, OPC_POW, prog->code_len) ||
+		memchr(prog->code, OPC_RPOW, prog->code_len))
+		return;
+
+	size = (size + page - 1) / page * page;
+	code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+				-1, 0);
+
+	if (code == MAP_FAILED)
+		return;
+
+	b.start = b.p = code;
+	jit_emit_program(&b, prog, &entry);
+	assert(b.p <= b.start + size);
+
+	if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(code, size);
+		return;
+	}
+
+	jit->code = code;
+	jit->size = size;
+	jit->func = (jit_func)(uintptr_t)entry;
+}
+
+#else
+
+void jit_compile_native(struct pcalc_jit *jit)
+{
+	// Only x86-64 code is generated
+}
+
+#endif
+
+// Compile prog to native code. Where that is not possible the program is run
+// by pcalc_exec instead, so the result can always be used with pcalc_jit_exec.
+// prog must not be freed before the result.
+enum retcode pcalc_jit_compile(struct pcalc_jit **jitp,
+							   const struct pcalc_program *prog)
+{
+	struct pcalc_jit *jit = malloc(sizeof(*jit));
+
+	if (jit == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	jit->prog = prog;
+	jit->code = NULL;
+	jit->size = 0;
+	jit->func = NULL;
+
+	jit_compile_native(jit);
+
+	*jitp = jit;
+
+	return PCALC_OK;
+}
+
+// Same results as pcalc_exec on the program
+enum retcode pcalc_jit_exec(int *result, const struct pcalc_jit *jit,
+							const int *last_ans)
+{
+	if (jit->func == NULL)
+		return pcalc_exec(result, jit->prog, last_ans);
+
+	if (jit->prog->uses_ans && last_ans == NULL)
+		return PCALC_NO_LAST_ANS;
+
+	if (jit->func(result, last_ans ? *last_ans : 0,
+				  program_vars(jit->prog)) != 0)
+		return PCALC_OUT_OF_BOUNDS;
+
+	return PCALC_OK;
+}
+
+// Whether the program runs as native code
+int pcalc_jit_native(const struct pcalc_jit *jit)
+{
+	return jit->func != NULL;
+}
+
+void pcalc_jit_free(struct pcalc_jit *jit)
+{
+	if (jit && jit->code)
+		munmap(jit->code, jit->size);
+
+	free(jit);
+}
@@ -0,0 +1,365 @@
+//
+//  lexer.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "profile.h"
+
+// Value of c as a digit, 16 or more if it is not a digit in any base
+unsigned digit_value(char c)
+{
+	if (IS_DIGIT(c))
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return 16;
+}
+
+// Skip the sign and base prefix of an integer literal in the format accepted
+// by strtol with base 0: an optional sign followed by a decimal, octal (leading
+// 0) or hexadecimal (leading 0x) number. Returns the first digit.
+char *lex_prefix(char *head, char *end, int *negative, unsigned *base)
+{
+	*negative = 0;
+	*base = 10;
+
+	if (head < end && (*head == '+' || *head == '-')) {
+		*negative = *head == '-';
+		head++;
+	}
+
+	if (end - head >= 3 && head[0] == '0' && (head[1] == 'x' || head[1] == 'X')
+		&& digit_value(head[2]) < 16) {
+		*base = 16;
+		head += 2;
+	}
+	else if (head < end && head[0] == '0') {
+		*base = 8;
+	}
+
+	return head;
+}
+
+// Scan an integer literal, see lex_prefix. *endp is set to the first
+// character after the literal.
+enum retcode lex_number(int *value, char *head, char *end, char **endp)
+{
+	unsigned long long acc = 0;
+	unsigned long long limit = INT_MAX;
+	unsigned base;
+	int negative;
+	int overflow = 0;
+	char *digits;
+
+	digits = head = lex_prefix(head, end, &negative, &base);
+
+	if (negative)
+		limit = -(long long)INT_MIN;
+
+	while (head < end) {
+		unsigned d = digit_value(*head);
+
+		if (d >= base)
+			break;
+
+		// Saturate so that acc can never wrap around
+		acc = acc * base + d;
+		if (acc > limit) {
+			acc = limit;
+			overflow = 1;
+		}
+
+		head++;
+	}
+
+	*endp = head;
+
+	if (head == digits)
+		return PCALC_UKNOWN_TOKEN;
+	else if (overflow)
+		return PCALC_OUT_OF_BOUNDS;
+
+	*value = negative ? (int)-(long long)acc : (int)acc;
+
+	return PCALC_OK;
+}
+
+// 64-bit version of lex_number
+enum retcode lex_int64(int64_t *value, char *head, char *end, char **endp)
+{
+	uint64_t acc = 0;
+	uint64_t limit = INT64_MAX;
+	unsigned base;
+	int negative;
+	int overflow = 0;
+	char *digits;
+
+	digits = head = lex_prefix(head, end, &negative, &base);
+
+	if (negative)
+		limit = (uint64_t)INT64_MAX + 1;
+
+	while (head < end) {
+		unsigned d = digit_value(*head);
+
+		if (d >= base)
+			break;
+
+		// Below limit / 16 the next digit can not wrap acc around, so the
+		// division is only needed close to the limit
+		if (acc <= limit >> 4 || acc <= (limit - d) / base)
+			acc = acc * base + d;
+		else
+			overflow = 1;
+
+		if (acc > limit) {
+			acc = limit;
+			overflow = 1;
+		}
+
+		head++;
+	}
+
+	*endp = head;
+
+	if (head == digits)
+		return PCALC_UKNOWN_TOKEN;
+	else if (overflow)
+		return PCALC_OUT_OF_BOUNDS;
+
+	if (negative)
+		*value = acc == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)acc;
+	else
+		*value = acc;
+
+	return PCALC_OK;
+}
+
+// Type of the name of len characters at name: one of the keywords, or VAR.
+// ^ is the power, so exclusive or is spelled out like min and max.
+enum token_type lex_name(const char *name, size_t len)
+{
+	static const struct {
+		const char *name;
+		enum token_type type;
+	} keywords[] = {
+		{"ans", ANS},
+		{"xor", OP_XOR},
+		{"min", OP_MIN},
+		{"max", OP_MAX}
+	};
+
+	for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+		if (strlen(keywords[i].name) == len &&
+			memcmp(keywords[i].name, name, len) == 0)
+			return keywords[i].type;
+
+	return VAR;
+}
+
+// Whether the len characters at name can name a variable: an identifier that
+// is not a keyword
+int lex_is_var(const char *name, size_t len)
+{
+	if (len == 0 || !IS_NAME_START(name[0]))
+		return 0;
+
+	for (size_t i = 1; i < len; i++)
+		if (!IS_NAME_CHAR(name[i]))
+			return 0;
+
+	return lex_name(name, len) == VAR;
+}
+
+static enum retcode lex_token(struct token *token, char *expr, char *end,
+							  char **endp, int wide)
+{
+	// Parentheses end the token before them and need no space around them
+#define IS_DELIM(p) \
+	((p) == end || IS_SPACE(*(p)) || *(p) == '(' || *(p) == ')')
+
+	char *head = expr;
+	int is_number = 0;
+
+	token->pos = expr;
+
+	switch (head[0]) {
+		case '+':
+			if (head + 1 < end && IS_DIGIT(head[1])) {
+				is_number = 1;
+			}
+			else {
+				token->type = OP_ADD;
+				head++;
+			}
+			break;
+
+		case '-':
+			if (head + 1 < end && IS_DIGIT(head[1])) {
+				is_number = 1;
+			}
+			else {
+				token->type = OP_SUB;
+				head++;
+			}
+			break;
+
+		case '*':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_MULT;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '/':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_DIV;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '^':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_POW;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '%':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_MOD;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '<':
+		case '>':
+			if (end - head >= 2 && head[1] == head[0] && IS_DELIM(head + 2)) {
+				token->type = head[0] == '<' ? OP_SHL : OP_SHR;
+				head += 2;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '&':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_AND;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '|':
+			if (IS_DELIM(head + 1)) {
+				token->type = OP_OR;
+				head++;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+
+		case '(':
+			token->type = OP_LPAREN;
+			head++;
+			break;
+
+		case ')':
+			token->type = OP_RPAREN;
+			head++;
+			break;
+
+		default:
+			if (IS_DIGIT(head[0])) {
+				is_number = 1;
+			}
+			else if (IS_NAME_START(head[0])) {
+				while (head < end && IS_NAME_CHAR(*head))
+					head++;
+
+				token->type = lex_name(expr, head - expr);
+				token->value = head - expr;
+			}
+			else {
+				return PCALC_UKNOWN_TOKEN;
+			}
+			break;
+	}
+
+	if (is_number) {
+		enum retcode ret = lex_number(&token->value, head, end, &head);
+
+		if (ret == PCALC_OUT_OF_BOUNDS && wide)
+			ret = PCALC_OK;
+
+		// A value out of range takes precedence over trailing garbage
+		if (ret == PCALC_OK && !IS_DELIM(head))
+			ret = PCALC_UKNOWN_TOKEN;
+
+		if (ret != PCALC_OK)
+			return ret;
+
+		token->type = VALUE;
+	}
+
+	if (endp)
+		*endp = head;
+
+	// A sign may be written directly before its operand
+	if (IS_DELIM(head) || token->type == OP_LPAREN ||
+		token->type == OP_RPAREN || token->type == OP_ADD ||
+		token->type == OP_SUB)
+		return PCALC_OK;
+	else
+		return PCALC_UKNOWN_TOKEN;
+
+#undef IS_DELIM
+}
+
+// Read the token pointed to by expr, which must be before end. Token parameter
+// must be allocated memory. The ans keyword gives an ANS token and other names
+// a VAR token, which the caller has to resolve. On errors in numbers *endp is
+// not set, so that the error position is the start of the token. If wide is
+// set, numbers that do not fit in an int are accepted and their value is left
+// undefined, for the numeric backends to read again from pos.
+enum retcode read_token(struct token *token, char *expr, char *end,
+						char **endp, int wide)
+{
+	PROFILE_START(start);
+	enum retcode ret = lex_token(token, expr, end, endp, wide);
+
+	PROFILE_STOP(PROF_T_LEX, start);
+
+	if (ret == PCALC_OK)
+		PROFILE_COUNT(PROF_TOKENS);
+
+	return ret;
+}
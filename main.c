@@ -13,24 +13,19 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pcalc.h"
 #include "settings.h"
-
-const char *retcode_str(enum retcode ret)
-{
-	switch(ret) {
-		case PCALC_OK:					return "No errors occurred";
-		case PCALC_MEMORY_ALLOC:		return "Memory allocation failed";
-		case PCALC_OUT_OF_BOUNDS:		return "Value out of bounds";
-		case PCALC_NOT_ENOUGH_VALUES:	return "Not enough values";
-		case PCALC_UKNOWN_TOKEN:		return "Uknown token";
-		case PCALC_INVALID_EXPRESSION:	return "Invalid expression";
-		case PCALC_NO_LAST_ANS:			return "No previous answer";
-		default: assert(0);
-	}
-}
+#include "batch.h"
+#include "num.h"
+#include "profile.h"
+#include "server.h"
+#include "sheet.h"
 
 void print_error(char *expr, char *errp, enum retcode ret)
 {
@@ -56,6 +51,36 @@ void print_error(char *expr, char *errp, enum retcode ret)
 	}
 }
 
+// Print an error in the expression made up of the n strings at args in the
+// same format as print_error. errp points into args[index], or is NULL to
+// point past the end.
+void print_args_error(char **args, size_t n, size_t index, char *errp,
+					  enum retcode ret)
+{
+	size_t col = 0;
+
+	fprintf(stderr, "Error: %s\n\t", retcode_str(ret));
+
+	for (size_t i = 0; i < n; i++) {
+		size_t len = strlen(args[i]);
+
+		if (errp == NULL || i < index)
+			col += len + 1;
+		else if (i == index)
+			col += errp - args[i];
+
+		fwrite(args[i], 1, len, stderr);
+		fputc(' ', stderr);
+	}
+
+	fprintf(stderr, "\n\t");
+
+	for (size_t i = 0; i < col; i++)
+		fputc(' ', stderr);
+
+	fprintf(stderr, "^\n");
+}
+
 void print_number(struct settings *s, int n)
 {
 	switch (s->output) {
@@ -84,6 +109,24 @@ void print_number(struct settings *s, int n)
 	}
 }
 
+// Print a value of the wide numeric backends in the same format as
+// print_number
+void print_num(struct settings *s, union num *n)
+{
+	char *str = num_to_str(s->arith, n, s->output == BASE_HEX ? 16 : 10);
+
+	if (str == NULL)
+		print_error(NULL, NULL, PCALC_MEMORY_ALLOC);
+	else if (s->output == BASE_HEX && str[0] == '-')
+		printf("0x-%s\n", str + 1);
+	else if (s->output == BASE_HEX)
+		printf("0x%s\n", str);
+	else
+		printf("%s", str);
+
+	free(str);
+}
+
 void usage(int exit_value)
 {
 	printf("Usage: pcalc [<option>...]\n"
@@ -92,27 +135,116 @@ void usage(int exit_value)
 		   "       -i  infix notation (default)\n"
 		   "       -r  postfix notation (rpn)\n"
 		   "       -p  prefix notation\n"
+		   "       -b  batch mode, evaluate one expression per line of input\n"
+		   "       -s, --stats  print throughput statistics after batch mode\n"
+		   "       -j  number of threads in batch mode, 0 for all cores\n"
+		   "       -f  batch mode reading expressions from a file\n"
 		   "       -c  print config path and exit\n"
 		   "       -w  print settings and exit\n"
 		   "       -h  show this help\n"
+		   "       --profile  print evaluation counters and timings on exit\n"
+		   "       --server <socket>  serve expressions on a Unix socket\n"
+		   "       --client <socket>  evaluate through a running server\n"
+		   "       --cache <entries>  cache results in batch and server modes\n"
+		   "       --stream  evaluate a postfix expression of any length from\n"
+		   "                 standard input, or the file of -f\n"
+		   "       --column <file>  run the expression with ans set to each\n"
+		   "                        value of file, - for standard input\n"
+		   "       --var <name>=<value>  bind a variable, may be repeated\n"
+		   "       --vars <file>  bind the variables of file, one per line\n"
+		   "       --sheet <file>  compute the formulas of file, then set the\n"
+		   "                       formulas read from standard input and\n"
+		   "                       print those that change\n"
+		   "       --compile <file>  compile the expressions of standard\n"
+		   "                         input, or the file of -f, into file\n"
+		   "       --load <file>  evaluate the compiled expressions of file\n"
 		   );
 
 	exit(exit_value);
 }
 
+// Bind the variable of a --var option or a line of a --vars file, which is
+// printed if the binding is invalid. Exits on errors.
+void bind_var(struct settings *s, char *binding, size_t len)
+{
+	char *errp = NULL;
+	enum retcode ret = PCALC_MEMORY_ALLOC;
+
+	if (s->vars == NULL)
+		s->vars = pcalc_vars_new();
+
+	if (s->vars)
+		ret = pcalc_vars_bind(s->vars, &errp, binding, len);
+
+	if (ret != PCALC_OK) {
+		print_error(binding, errp, ret);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Bind the variables of the file at path, one name = value binding per line.
+// Blank lines are skipped. Exits on errors.
+void read_vars(struct settings *s, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	if (file == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((len = getline(&line, &size, file)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (!is_blank(line, len))
+			bind_var(s, line, len);
+	}
+
+	if (ferror(file)) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	free(line);
+	fclose(file);
+}
+
 void parse_argv(int *argcp, char ***argvp, struct settings *s)
 {
 	const char *optstr =
 		"r"		// postfix (rpn)
 		"p"		// prefix (pn)
 		"i"		// infix
+		"b"		// batch mode
+		"s"		// batch statistics
+		"j:"	// batch threads
+		"f:"	// batch input file
 		"c"		// print config path
 		"w"		// print settings
 		"h"		// show help
 		;
+	const struct option longopts[] = {
+		{"stats", no_argument, NULL, 's'},
+		{"profile", no_argument, NULL, 'P'},
+		{"server", required_argument, NULL, 'S'},
+		{"client", required_argument, NULL, 'C'},
+		{"cache", required_argument, NULL, 'K'},
+		{"stream", no_argument, NULL, 'T'},
+		{"column", required_argument, NULL, 'L'},
+		{"var", required_argument, NULL, 'V'},
+		{"vars", required_argument, NULL, 'F'},
+		{"sheet", required_argument, NULL, 'H'},
+		{"compile", required_argument, NULL, 'O'},
+		{"load", required_argument, NULL, 'D'},
+		{NULL, 0, NULL, 0}
+	};
 	int c;
 
-	while ((c = getopt(*argcp, *argvp, optstr)) != -1)
+	while ((c = getopt_long(*argcp, *argvp, optstr, longopts, NULL)) != -1)
 		switch (c) {
 			case 'r':
 				s->notation = POSTFIX;
@@ -126,6 +258,33 @@ void parse_argv(int *argcp, char ***argvp, struct settings *s)
 				s->notation = INFIX;
 				break;
 
+			case 'b':
+				s->batch = 1;
+				break;
+
+			case 's':
+				s->stats = 1;
+				break;
+
+			case 'j':
+			{
+				char *endp;
+				long jobs = strtol(optarg, &endp, 10);
+
+				if (*endp != '\0' || jobs < 0 || jobs > 1024)
+					usage(EXIT_FAILURE);
+				else if (jobs == 0)
+					jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+				s->jobs = jobs > 0 ? jobs : 1;
+				break;
+			}
+
+			case 'f':
+				s->batch = 1;
+				s->input = optarg;
+				break;
+
 			case 'c':
 			{
 				char path[PATH_MAX];
@@ -144,6 +303,62 @@ void parse_argv(int *argcp, char ***argvp, struct settings *s)
 			case 'h':
 				usage(EXIT_SUCCESS);
 
+			case 'P':
+#ifndef PCALC_PROFILE
+				fprintf(stderr, "Warning: Built without profiling, rebuild "
+						"with make PROFILE=1\n");
+#endif
+				s->profile = 1;
+				break;
+
+			case 'S':
+				s->server = optarg;
+				break;
+
+			case 'C':
+				s->client = optarg;
+				break;
+
+			case 'K':
+			{
+				char *endp;
+				long entries = strtol(optarg, &endp, 10);
+
+				if (*endp != '\0' || entries < 0)
+					usage(EXIT_FAILURE);
+
+				s->cache = entries;
+				break;
+			}
+
+			case 'T':
+				s->stream = 1;
+				break;
+
+			case 'L':
+				s->column = optarg;
+				break;
+
+			case 'V':
+				bind_var(s, optarg, strlen(optarg));
+				break;
+
+			case 'F':
+				read_vars(s, optarg);
+				break;
+
+			case 'H':
+				s->sheet = optarg;
+				break;
+
+			case 'O':
+				s->compile = optarg;
+				break;
+
+			case 'D':
+				s->load = optarg;
+				break;
+
 			case '?':
 			default:
 				usage(EXIT_FAILURE);
@@ -160,6 +375,16 @@ int prompt_loop(struct settings *s)
 	char *expr = NULL;
 	size_t len = 0;
 	int result;
+	union num num_ans;
+	int has_num_ans = 0;
+	struct pcalc_ctx *ctx = pcalc_ctx_new();
+
+	if (ctx == NULL) {
+		print_error(NULL, NULL, PCALC_MEMORY_ALLOC);
+		return EXIT_FAILURE;
+	}
+
+	pcalc_ctx_set_vars(ctx, s->vars);
 
 	switch (s->notation) {
 		case PREFIX:
@@ -188,29 +413,38 @@ int prompt_loop(struct settings *s)
 			}
 			else if (strcmp(expr, "q\n") == 0 || strcmp(expr, "quit\n") == 0) {
 				free(expr);
+				pcalc_ctx_free(ctx);
+				if (has_num_ans)
+					num_free(s->arith, &num_ans);
 				return EXIT_SUCCESS;
 			}
-			else {
-				char *errp;
+			else if (s->arith != ARITH_INT) {
+				char *errp = NULL;
+				union num value;
 				enum retcode ret;
 
-				switch (s->notation) {
-					case PREFIX:
-						ret = pn_eval_str(&result, &errp, expr, 0, last_ans);
-						break;
+				ret = num_evaln(s->arith, &value, &errp, expr, strlen(expr),
+								s->notation, has_num_ans ? &num_ans : NULL);
 
-					case POSTFIX:
-						ret = pn_eval_str(&result, &errp, expr,
-										  PCALC_REVERSED, last_ans);
-						break;
+				if (ret == PCALC_OK) {
+					print_num(s, &value);
 
-					case INFIX:
-						ret = inf_eval_str(&result, &errp, expr, last_ans);
-						break;
+					if (has_num_ans)
+						num_free(s->arith, &num_ans);
 
-					default:
-						assert(0);
+					num_ans = value;
+					has_num_ans = 1;
+				}
+				else {
+					print_error(expr, errp, ret);
 				}
+			}
+			else {
+				char *errp = NULL;
+				enum retcode ret;
+
+				ret = pcalc_eval(ctx, &result, &errp, expr, s->notation,
+								 last_ans);
 
 				if (ret == PCALC_OK) {
 					print_number(s, result);
@@ -223,6 +457,9 @@ int prompt_loop(struct settings *s)
 		}
 		else {
 			free(expr);
+			pcalc_ctx_free(ctx);
+			if (has_num_ans)
+				num_free(s->arith, &num_ans);
 
 			if (feof(stdin)) {
 				putc('\n', stdout);
@@ -236,6 +473,340 @@ int prompt_loop(struct settings *s)
 	}
 }
 
+// Compile expr and run it over the values of ans in s->column
+int column_run(struct settings *s, char *expr)
+{
+	struct pcalc_program *prog;
+	char *errp = NULL;
+	enum retcode ret;
+	int fd = STDIN_FILENO;
+	int status;
+
+	if (s->arith != ARITH_INT) {
+		fprintf(stderr, "Error: Column mode only supports int arithmetic\n");
+		return EXIT_FAILURE;
+	}
+
+	ret = pcalc_compilen(&prog, &errp, expr, strlen(expr), s->notation,
+						 s->vars);
+
+	if (ret != PCALC_OK) {
+		print_error(expr, errp, ret);
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(s->column, "-") != 0 && (fd = open(s->column, O_RDONLY)) < 0) {
+		perror(s->column);
+		pcalc_program_free(prog);
+		return EXIT_FAILURE;
+	}
+
+	status = batch_run_column(s, prog, fd, stdout, stderr);
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+	pcalc_program_free(prog);
+
+	return status;
+}
+
+// Evaluate a postfix expression read from fd in chunks, so that only the value
+// stack is kept in memory
+int stream_run(struct settings *s, int fd)
+{
+	struct pcalc_stream *stream;
+	char *chunk;
+	ssize_t n = 0;
+	int result;
+	enum retcode ret = PCALC_OK;
+
+	if (s->arith != ARITH_INT) {
+		fprintf(stderr, "Error: Stream mode only supports int arithmetic\n");
+		return EXIT_FAILURE;
+	}
+
+	stream = pcalc_stream_new(NULL);
+	chunk = malloc(BATCH_CHUNK_SIZE);
+
+	if (stream == NULL || chunk == NULL) {
+		pcalc_stream_free(stream);
+		free(chunk);
+		print_error(NULL, NULL, PCALC_MEMORY_ALLOC);
+		return EXIT_FAILURE;
+	}
+
+	while (ret == PCALC_OK && (n = batch_read(fd, chunk, BATCH_CHUNK_SIZE)) > 0)
+		ret = pcalc_stream_feed(stream, chunk, n);
+
+	if (n < 0) {
+		perror("Reading input failed");
+		pcalc_stream_free(stream);
+		free(chunk);
+		return EXIT_FAILURE;
+	}
+
+	if (ret == PCALC_OK)
+		ret = pcalc_stream_finish(stream, &result);
+
+	if (ret == PCALC_OK)
+		print_number(s, result);
+	else
+		fprintf(stderr, "Error: %s\n\tat byte %zu\n", retcode_str(ret),
+				pcalc_stream_offset(stream));
+
+	pcalc_stream_free(stream);
+	free(chunk);
+
+	return ret == PCALC_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// The n strings at args joined with spaces, for the modes that need the
+// expression as one string. Returns NULL if out of memory.
+char *join_args(char **args, size_t n)
+{
+	size_t len = 0;
+	char *str, *p;
+
+	for (size_t i = 0; i < n; i++)
+		len += strlen(args[i]) + 1;
+
+	str = p = malloc(len + 1);
+
+	if (str == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		size_t arg_len = strlen(args[i]);
+
+		memcpy(p, args[i], arg_len);
+		p += arg_len;
+		*p++ = ' ';
+	}
+
+	*p = '\0';
+
+	return str;
+}
+
+// Evaluate the expression made up of the command line arguments at args in
+// place
+int args_run(struct settings *s, char **args, size_t n)
+{
+	int result;
+	size_t index;
+	char *errp;
+	enum retcode ret;
+
+	ret = pcalc_evalv(NULL, &result, &index, &errp, args, n, s->notation,
+					  NULL);
+
+	if (ret != PCALC_OK) {
+		print_args_error(args, n, index, errp, ret);
+		return EXIT_FAILURE;
+	}
+
+	print_number(s, result);
+
+	return EXIT_SUCCESS;
+}
+
+// Evaluate expr with the bound variables
+int vars_run(struct settings *s, char *expr)
+{
+	int result;
+	char *errp = NULL;
+	enum retcode ret;
+
+	ret = pcalc_eval_vars(&result, &errp, expr, strlen(expr), s->notation,
+						  s->vars, NULL);
+
+	if (ret != PCALC_OK) {
+		print_error(expr, errp, ret);
+		return EXIT_FAILURE;
+	}
+
+	print_number(s, result);
+
+	return EXIT_SUCCESS;
+}
+
+// Compile the expressions read from in, one per line, and write them to the
+// file at path, see image.c. Blank lines are skipped. Every line that fails
+// is reported as in batch mode, and then nothing is written. load_run has no
+// previous answer to give, so expressions using ans fail.
+int compile_run(struct settings *s, FILE *in, const char *path)
+{
+	struct pcalc_program **progs = NULL;
+	size_t n = 0;
+	size_t cap = 0;
+	size_t lineno = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	void *data = NULL;
+	size_t size;
+	FILE *out;
+	enum retcode ret;
+	int status = EXIT_SUCCESS;
+
+	while ((len = getline(&line, &line_size, in)) > 0) {
+		char *errp = NULL;
+
+		lineno++;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (is_blank(line, len))
+			continue;
+
+		if (n == cap) {
+			size_t new_cap = cap ? cap * 2 : 64;
+			struct pcalc_program **new_progs =
+				realloc(progs, new_cap * sizeof(*progs));
+
+			if (new_progs == NULL) {
+				print_error(NULL, NULL, PCALC_MEMORY_ALLOC);
+				status = EXIT_FAILURE;
+				break;
+			}
+
+			progs = new_progs;
+			cap = new_cap;
+		}
+
+		ret = pcalc_compilen(&progs[n], &errp, line, len, s->notation, NULL);
+
+		if (ret == PCALC_OK && pcalc_program_uses_ans(progs[n])) {
+			pcalc_program_free(progs[n]);
+			errp = NULL;
+			ret = PCALC_NO_LAST_ANS;
+		}
+
+		if (ret == PCALC_OK) {
+			n++;
+		}
+		else {
+			if (errp)
+				fprintf(stderr, "%zu:%zu: %s\n", lineno,
+						(size_t)(errp - line + 1), retcode_str(ret));
+			else
+				fprintf(stderr, "%zu: %s\n", lineno, retcode_str(ret));
+
+			status = EXIT_FAILURE;
+		}
+	}
+
+	if (ferror(in)) {
+		perror("Reading input failed");
+		status = EXIT_FAILURE;
+	}
+
+	if (status == EXIT_SUCCESS) {
+		ret = pcalc_image_build(&data, &size, progs, n);
+
+		if (ret != PCALC_OK) {
+			print_error(NULL, NULL, ret);
+			status = EXIT_FAILURE;
+		}
+	}
+
+	if (status == EXIT_SUCCESS) {
+		out = fopen(path, "wb");
+
+		if (out == NULL || fwrite(data, 1, size, out) != size ||
+			fclose(out) != 0) {
+			perror(path);
+			status = EXIT_FAILURE;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		pcalc_program_free(progs[i]);
+
+	free(progs);
+	free(line);
+	free(data);
+
+	return status;
+}
+
+// Map the compiled file at path into memory and run each of its programs once
+// in place. Results and errors are printed as in batch mode, with the number
+// of the program instead of the line, and any error fails the run.
+int load_run(struct settings *s, const char *path)
+{
+	struct pcalc_image *image;
+	struct stat st;
+	void *map;
+	size_t size;
+	size_t failed = 0;
+	enum retcode ret;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		fprintf(stderr, "%s: %s\n", path, retcode_str(PCALC_INVALID_IMAGE));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	ret = pcalc_image_load(&image, map, size);
+
+	if (ret != PCALC_OK) {
+		fprintf(stderr, "%s: %s\n", path, retcode_str(ret));
+		munmap(map, size);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < pcalc_image_len(image); i++) {
+		int result;
+
+		ret = pcalc_exec(&result, pcalc_image_program(image, i), NULL);
+
+		if (ret == PCALC_OK && s->output == BASE_HEX && result == INT_MIN)
+			ret = PCALC_OUT_OF_BOUNDS;
+
+		if (ret == PCALC_OK) {
+			print_number(s, result);
+		}
+		else {
+			putchar('\n');
+			fprintf(stderr, "%zu: %s\n", i + 1, retcode_str(ret));
+			failed++;
+		}
+	}
+
+	pcalc_image_free(image);
+	munmap(map, size);
+
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Print the profiling counters if asked to and pass on the exit status
+int finish(struct settings *s, int status)
+{
+	if (s->profile)
+		PROFILE_DUMP(stderr);
+
+	return status;
+}
+
 int main(int argc, char **argv)
 {
 	struct settings settings;
@@ -243,47 +814,173 @@ int main(int argc, char **argv)
 	read_settings(&settings);
 	parse_argv(&argc, &argv, &settings);
 
-	if (argc == 1) {
-		return prompt_loop(&settings);
+	// Variables are bound in the programs of the int backend, which are not
+	// used to serve or stream expressions and whose slots are not stored in
+	// compiled files. A sheet binds its own.
+	if (settings.vars && (settings.server || settings.client ||
+						  settings.stream || settings.sheet ||
+						  settings.compile || settings.load)) {
+		usage(EXIT_FAILURE);
 	}
-	else {
-		char str[1024];
+	else if (settings.compile && settings.load) {
+		usage(EXIT_FAILURE);
+	}
+	else if ((settings.compile || settings.load) &&
+			 settings.arith != ARITH_INT) {
+		fprintf(stderr, "Error: Compiled files only support int arithmetic\n");
+		return EXIT_FAILURE;
+	}
+	else if (settings.vars && settings.arith != ARITH_INT) {
+		fprintf(stderr, "Error: Variables only support int arithmetic\n");
+		return EXIT_FAILURE;
+	}
+	else if (settings.sheet && settings.arith != ARITH_INT) {
+		fprintf(stderr, "Error: Sheets only support int arithmetic\n");
+		return EXIT_FAILURE;
+	}
+
+	if (settings.server) {
+		return finish(&settings, server_run(&settings, settings.server));
+	}
+	else if (settings.sheet) {
+		return finish(&settings, sheet_run(&settings, settings.sheet, stdin,
+										   stdout, stderr));
+	}
+	else if (settings.compile) {
+		FILE *in = settings.input ? fopen(settings.input, "r") : stdin;
+		int status;
+
+		if (in == NULL) {
+			perror(settings.input);
+			return EXIT_FAILURE;
+		}
+
+		status = compile_run(&settings, in, settings.compile);
+
+		if (settings.input)
+			fclose(in);
+
+		return finish(&settings, status);
+	}
+	else if (settings.load) {
+		return finish(&settings, load_run(&settings, settings.load));
+	}
+	else if (settings.stream) {
+		int fd = settings.input ? open(settings.input, O_RDONLY) : STDIN_FILENO;
+		int status;
+
+		if (fd < 0) {
+			perror(settings.input);
+			return EXIT_FAILURE;
+		}
+
+		status = stream_run(&settings, fd);
 
-		str[0] = '\0';
-		for (int i = 1; i < argc; i++) {
-			strcat(str, argv[i]);
-			strcat(str, " ");
+		if (settings.input)
+			close(fd);
+
+		return finish(&settings, status);
+	}
+	else if (settings.client && settings.batch) {
+		int fd = settings.input ? open(settings.input, O_RDONLY) : STDIN_FILENO;
+		int status;
+
+		if (fd < 0) {
+			perror(settings.input);
+			return EXIT_FAILURE;
 		}
 
-		int result = 0;
-		char *errp;
+		status = client_batch(&settings, settings.client, fd, stdout, stderr);
+
+		if (settings.input)
+			close(fd);
+
+		return finish(&settings, status);
+	}
+	else if (settings.batch && settings.input) {
+		return finish(&settings, batch_run_file(&settings, settings.input,
+												stdout, stderr));
+	}
+	else if (settings.batch) {
+		return finish(&settings,
+					  batch_run(&settings, STDIN_FILENO, stdout, stderr));
+	}
+	else if (argc == 1 && (settings.client || settings.column)) {
+		// The prompt is not served, only expressions and batch input, and a
+		// column needs an expression
+		usage(EXIT_FAILURE);
+	}
+	else if (argc == 1) {
+		return finish(&settings, prompt_loop(&settings));
+	}
+	else if (settings.arith == ARITH_INT && !settings.client &&
+			 !settings.column && !settings.vars) {
+		return finish(&settings, args_run(&settings, argv + 1, argc - 1));
+	}
+	else {
+		char *str = join_args(argv + 1, argc - 1);
+		union num value;
+		char *errp = NULL;
 		enum retcode ret;
+		int status;
 
-		switch (settings.notation) {
-			case PREFIX:
-				ret = pn_eval_str(&result, &errp, str, 0, NULL);
-				break;
+		if (str == NULL) {
+			print_error(NULL, NULL, PCALC_MEMORY_ALLOC);
+			return EXIT_FAILURE;
+		}
 
-			case POSTFIX:
-				ret = pn_eval_str(&result, &errp, str,
-								  PCALC_REVERSED, NULL);
-				break;
+		if (settings.column && settings.client) {
+			usage(EXIT_FAILURE);
+		}
+		else if (settings.column) {
+			status = column_run(&settings, str);
+			free(str);
+			return finish(&settings, status);
+		}
+		else if (settings.vars) {
+			status = vars_run(&settings, str);
+			free(str);
+			return finish(&settings, status);
+		}
 
-			case INFIX:
-				ret = inf_eval_str(&result, &errp, str, NULL);
-				break;
+		if (settings.client) {
+			char *value_str;
 
-			default:
-				assert(0);
+			if (!client_eval(settings.client, settings.notation, str, &ret,
+							 &value_str, &errp)) {
+				free(str);
+				return finish(&settings, EXIT_FAILURE);
+			}
+
+			// In the format of print_number
+			if (ret == PCALC_OK) {
+				printf(settings.output == BASE_HEX ? "%s\n" : "%s", value_str);
+				free(value_str);
+				status = EXIT_SUCCESS;
+			}
+			else {
+				print_error(str, errp, ret);
+				status = EXIT_FAILURE;
+			}
+
+			free(str);
+			return finish(&settings, status);
 		}
 
+		ret = num_evaln(settings.arith, &value, &errp, str, strlen(str),
+						settings.notation, NULL);
+
 		if (ret == PCALC_OK) {
-			print_number(&settings, result);
-			return EXIT_SUCCESS;
+			print_num(&settings, &value);
+			num_free(settings.arith, &value);
+			status = EXIT_SUCCESS;
 		}
 		else {
 			print_error(str, errp, ret);
-			return EXIT_FAILURE;
+			status = EXIT_FAILURE;
 		}
+
+		free(str);
+		return finish(&settings, status);
 	}
 }
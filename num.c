@@ -0,0 +1,431 @@
+//
+//  num.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "pcalc.h"
+#include "d_array.h"
+#include "token.h"
+#include "bignum.h"
+#include "num.h"
+#include "profile.h"
+
+#ifdef HAVE_OVERFLOW_BUILTINS
+
+#define add_overflow(a, b, r) __builtin_add_overflow(a, b, r)
+#define sub_overflow(a, b, r) __builtin_sub_overflow(a, b, r)
+#define mul_overflow(a, b, r) __builtin_mul_overflow(a, b, r)
+
+#else
+
+// Same checks as is_undefined_add, _sub and _mult for int64_t
+static int add_overflow(int64_t a, int64_t b, int64_t *r)
+{
+	if (b > 0 && a > INT64_MAX - b || b < 0 && a < INT64_MIN - b)
+		return 1;
+
+	*r = a + b;
+	return 0;
+}
+
+static int sub_overflow(int64_t a, int64_t b, int64_t *r)
+{
+	if (b > 0 && a < INT64_MIN + b || b < 0 && a > INT64_MAX + b)
+		return 1;
+
+	*r = a - b;
+	return 0;
+}
+
+static int mul_overflow(int64_t a, int64_t b, int64_t *r)
+{
+	if (a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+			  : (b > 0 ? a < INT64_MIN / b : a != 0 && b < INT64_MAX / a))
+		return 1;
+
+	*r = a * b;
+	return 0;
+}
+
+#endif
+
+// Same as checked_pow for int64_t
+static int pow_overflow(int64_t base, int64_t exp, int64_t *r)
+{
+	int64_t value = 1;
+
+	if (exp < 0) {
+		if (base == 0)
+			return 1;
+		else if (base == 1 || base == -1)
+			*r = exp % 2 ? base : 1;
+		else
+			*r = 0;
+
+		return 0;
+	}
+
+	while (exp > 0) {
+		if (exp & 1 && mul_overflow(value, base, &value))
+			return 1;
+
+		exp >>= 1;
+
+		if (exp > 0 && mul_overflow(base, base, &base))
+			return 1;
+	}
+
+	*r = value;
+	return 0;
+}
+
+// Same as is_undefined_shl and shift_right for int64_t
+static int shl_overflow(int64_t a, int64_t b, int64_t *r)
+{
+	if (b < 0 || b >= 64 || a > INT64_MAX >> b || a < ~(~INT64_MIN >> b))
+		return 1;
+
+	*r = (int64_t)((uint64_t)a << b);
+	return 0;
+}
+
+static int shr_overflow(int64_t a, int64_t b, int64_t *r)
+{
+	if (b < 0 || b >= 64)
+		return 1;
+
+	*r = a < 0 ? ~(~a >> b) : a >> b;
+	return 0;
+}
+
+enum retcode int64_binop(int64_t *result, enum token_type op, int64_t lval,
+						 int64_t rval)
+{
+	switch (op) {
+		case OP_ADD:
+			if (add_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_SUB:
+			if (sub_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_MULT:
+			if (mul_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_DIV:
+			if (rval == 0 || lval == INT64_MIN && rval == -1)
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = lval / rval;
+			break;
+
+		case OP_POW:
+			if (pow_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_MOD:
+			if (rval == 0 || lval == INT64_MIN && rval == -1)
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = lval % rval;
+			break;
+
+		case OP_SHL:
+			if (shl_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_SHR:
+			if (shr_overflow(lval, rval, result))
+				return PCALC_OUT_OF_BOUNDS;
+			break;
+
+		case OP_AND:	*result = lval & rval;	break;
+		case OP_OR:		*result = lval | rval;	break;
+		case OP_XOR:	*result = lval ^ rval;	break;
+		case OP_MIN:	*result = lval < rval ? lval : rval;	break;
+		case OP_MAX:	*result = lval > rval ? lval : rval;	break;
+
+		default:
+			assert(0);
+	}
+
+	return PCALC_OK;
+}
+
+// Read the integer literal at head
+enum retcode num_parse(enum arith arith, union num *n, char *head, char *end)
+{
+	char *endp;
+
+	switch (arith) {
+		case ARITH_INT64:	return lex_int64(&n->i64, head, end, &endp);
+		case ARITH_BIG:		return big_parse(&n->big, head, end);
+
+		default: assert(0);
+	}
+}
+
+enum retcode num_copy(enum arith arith, union num *to, const union num *from)
+{
+	if (arith == ARITH_BIG) {
+		to->big = big_copy(from->big);
+
+		if (to->big == NULL)
+			return PCALC_MEMORY_ALLOC;
+	}
+	else {
+		*to = *from;
+	}
+
+	return PCALC_OK;
+}
+
+enum retcode num_binop(enum arith arith, union num *result,
+					   enum token_type op, const union num *lval,
+					   const union num *rval)
+{
+	PROFILE_START(start);
+	enum retcode ret;
+
+	switch (arith) {
+		case ARITH_INT64:
+			ret = int64_binop(&result->i64, op, lval->i64, rval->i64);
+			break;
+
+		case ARITH_BIG:
+			ret = big_binop(&result->big, op, lval->big, rval->big);
+			break;
+
+		default:
+			assert(0);
+	}
+
+	PROFILE_STOP(PROF_T_ARITH, start);
+
+	if (ret == PCALC_OUT_OF_BOUNDS)
+		PROFILE_COUNT(PROF_OVERFLOW_ADD + (op - OP_ADD));
+
+	return ret;
+}
+
+// Checked unary operation, OP_NEG is the only one
+enum retcode num_unop(enum arith arith, union num *result, enum token_type op,
+					  const union num *val)
+{
+	enum retcode ret = PCALC_OK;
+
+	assert(op == OP_NEG);
+
+	switch (arith) {
+		case ARITH_INT64:
+			if (val->i64 == INT64_MIN)
+				ret = PCALC_OUT_OF_BOUNDS;
+			else
+				result->i64 = -val->i64;
+			break;
+
+		case ARITH_BIG:
+			ret = big_neg(&result->big, val->big);
+			break;
+
+		default:
+			assert(0);
+	}
+
+	if (ret == PCALC_OUT_OF_BOUNDS)
+		PROFILE_COUNT(PROF_OVERFLOW_NEG);
+
+	return ret;
+}
+
+void num_free(enum arith arith, union num *n)
+{
+	if (arith == ARITH_BIG)
+		big_free(n->big);
+}
+
+// Digits of n in radix 10 or 16, with a leading minus sign if negative. The
+// string is allocated with malloc.
+char *num_to_str(enum arith arith, const union num *n, unsigned radix)
+{
+	switch (arith) {
+		case ARITH_INT64:
+		{
+			char *str = malloc(24);
+			uint64_t u = n->i64 < 0 ? -(uint64_t)n->i64 : (uint64_t)n->i64;
+
+			if (str)
+				sprintf(str, radix == 16 ? "%s%" PRIX64 : "%s%" PRIu64,
+						n->i64 < 0 ? "-" : "", u);
+
+			return str;
+		}
+
+		case ARITH_BIG:
+			return big_to_str(n->big, radix);
+
+		default:
+			assert(0);
+	}
+}
+
+// Evaluate tokens in postfix order, or in prefix order if is_prefix is set.
+// Values are read from the expression text, which ends at end.
+enum retcode num_eval_tokens(enum arith arith, union num *result, char **errp,
+							 struct token *tokens, size_t len, int is_prefix,
+							 char *end, const union num *last_ans)
+{
+	// The stack can never hold more values than there are tokens
+	union num *stack = malloc((len ? len : 1) * sizeof(*stack));
+	size_t top = 0;
+	enum retcode ret = PCALC_OK;
+
+	if (stack == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i < len && ret == PCALC_OK; i++) {
+		struct token *token = &tokens[is_prefix ? len - 1 - i : i];
+
+		switch (token->type) {
+			case VALUE:
+				ret = num_parse(arith, &stack[top], token->pos, end);
+				if (ret == PCALC_OK)
+					top++;
+				break;
+
+			case ANS:
+				if (last_ans == NULL)
+					ret = PCALC_NO_LAST_ANS;
+				else
+					ret = num_copy(arith, &stack[top], last_ans);
+
+				if (ret == PCALC_OK)
+					top++;
+				break;
+
+			case VAR:
+				ret = PCALC_UNBOUND_VARIABLE;
+				break;
+
+			case OP_NEG:
+				if (top < 1) {
+					ret = PCALC_NOT_ENOUGH_VALUES;
+				}
+				else {
+					union num value;
+
+					ret = num_unop(arith, &value, OP_NEG, &stack[top - 1]);
+
+					if (ret == PCALC_OK) {
+						num_free(arith, &stack[top - 1]);
+						stack[top - 1] = value;
+					}
+				}
+				break;
+
+			default:
+				if (top < 2) {
+					ret = PCALC_NOT_ENOUGH_VALUES;
+				}
+				else {
+					union num *lval = &stack[top - 2];
+					union num *rval = &stack[top - 1];
+					union num value;
+
+					// In prefix order the left operand is read last
+					if (is_prefix) {
+						lval = &stack[top - 1];
+						rval = &stack[top - 2];
+					}
+
+					ret = num_binop(arith, &value, token->type, lval, rval);
+
+					if (ret == PCALC_OK) {
+						num_free(arith, &stack[--top]);
+						num_free(arith, &stack[--top]);
+						stack[top++] = value;
+					}
+				}
+				break;
+		}
+
+		if (ret != PCALC_OK && token->pos)
+			*errp = token->pos;
+	}
+
+	if (ret == PCALC_OK && top != 1)
+		ret = PCALC_INVALID_EXPRESSION;
+
+	if (ret == PCALC_OK)
+		*result = stack[--top];
+
+	while (top > 0)
+		num_free(arith, &stack[--top]);
+
+	free(stack);
+
+	return ret;
+}
+
+// Evaluate the len characters at expr with one of the wide numeric backends.
+// The result must be released with num_free.
+enum retcode num_evaln(enum arith arith, union num *result, char **errp,
+					   char *expr, size_t len, enum notation notation,
+					   const union num *last_ans)
+{
+	PROFILE_START(start);
+	d_array *tokens = da_new(sizeof(struct token), MIN_STACK_SIZE, NULL);
+	char *end = expr + len;
+	enum retcode ret;
+
+	assert(arith != ARITH_INT);
+
+	if (tokens == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	switch (notation) {
+		case PREFIX:
+		case POSTFIX:
+			ret = pn_tokenize(tokens, errp, expr, end, 1);
+			break;
+
+		case INFIX:
+		{
+			PROFILE_START(reorder);
+			ret = inf_reorder(NULL, tokens, errp, expr, end, last_ans != NULL,
+							  1, NULL);
+			PROFILE_STOP(PROF_T_REORDER, reorder);
+			break;
+		}
+
+		default:
+			assert(0);
+	}
+
+	if (ret == PCALC_OK)
+		ret = num_eval_tokens(arith, result, errp, da_get_array(tokens),
+							  da_get_size(tokens), notation == PREFIX, end,
+							  last_ans);
+
+	da_free(&tokens);
+
+	PROFILE_STOP(PROF_T_EVAL, start);
+	PROFILE_COUNT(PROF_EXPRS);
+
+	return ret;
+}
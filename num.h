@@ -0,0 +1,31 @@
+//
+//  num.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef NUM_H
+#define NUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcalc.h"
+#include "bignum.h"
+
+// Value in one of the wide numeric backends. Only the member for the backend
+// in use is defined.
+union num {
+	int64_t i64;
+	struct bignum *big;
+};
+
+enum retcode num_evaln(enum arith arith, union num *result, char **errp,
+					   char *expr, size_t len, enum notation notation,
+					   const union num *last_ans);
+char *num_to_str(enum arith arith, const union num *n, unsigned radix);
+void num_free(enum arith arith, union num *n);
+
+#endif
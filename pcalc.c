@@ -7,31 +7,44 @@
 //
 
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
-#include <errno.h>
 
 #include "pcalc.h"
 #include "stack.h"
 #include "d_array.h"
+#include "token.h"
+#include "arena.h"
+#include "scan.h"
+#include "profile.h"
 
-#define MIN_STACK_SIZE 16
+// Shift counts must be less than this
+#define INT_BITS ((int)(sizeof(int) * CHAR_BIT))
 
-enum token_type {
-	NONE,
-	VALUE,
-	OP_ADD,
-	OP_SUB,
-	OP_MULT,
-	OP_DIV
+// Initial arena size, grows to fit the expressions evaluated
+#define CTX_ARENA_SIZE 4096
+
+struct pcalc_ctx {
+	struct arena *arena;
+	const struct pcalc_vars *vars;	// Names are looked up in, may be NULL
 };
 
-// value will only be defined if type is VALUE
-struct token {
-	enum token_type type;
-	int value;
+// Longest token that may be split across the chunks of a stream
+#define STREAM_TOKEN_SIZE 256
+
+// Postfix expression evaluated as it is read. Only the value stack and a
+// token split by the end of a chunk are kept.
+struct pcalc_stream {
+	struct stack v_stack;
+	int ans;
+	int has_ans;
+	size_t offset;		// Of the next chunk in the stream
+	size_t err_offset;	// Of the token that failed
+	enum retcode ret;	// Evaluation stops at the first error
+	size_t token_start;	// Offset of the split token
+	size_t token_len;
+	char token[STREAM_TOKEN_SIZE];
 };
 
 int is_undefined_add(int a, int b)
@@ -85,412 +98,1210 @@ int is_undefined_div(int a, int b)
 	return b == 0;
 }
 
-// str is a null terminated string accepted by strtol
-enum retcode parse_int(int *result, char *str)
+// The remainder has the sign of a, like the quotient it is undefined if b is
+// zero or the division overflows
+int is_undefined_mod(int a, int b)
 {
-	char *endp;
-	long value;
+	return is_undefined_div(a, b);
+}
 
-	value = strtol(str, &endp, 0);
+// a >> b rounded towards negative infinity, which C leaves to the
+// implementation for negative a
+int shift_right(int a, int b)
+{
+	return a < 0 ? ~(~a >> b) : a >> b;
+}
 
-	if (errno == ERANGE || value > INT_MAX || value < INT_MIN) {
-		return PCALC_OUT_OF_BOUNDS;
-	}
-	else if (*endp != '\0') {
-		return PCALC_UKNOWN_TOKEN;
-	}
-	else {
-		*result = (int)value;
-		return PCALC_OK;
+// a << b is a multiplied by two to the power of b, so unlike in C a may be
+// negative as long as the product fits
+int is_undefined_shl(int a, int b)
+{
+	return b < 0 || b >= INT_BITS ||
+		   a > INT_MAX >> b || a < shift_right(INT_MIN, b);
+}
+
+int is_undefined_shr(int a, int b)
+{
+	return b < 0 || b >= INT_BITS;
+}
+
+#ifdef HAVE_OVERFLOW_BUILTINS
+
+// *result is only written if no overflow occurs
+static enum retcode checked_binop(int *result, enum token_type op, int lval,
+								  int rval)
+{
+	int value;
+	int overflow;
+
+	switch (op) {
+		case OP_ADD:
+			overflow = __builtin_add_overflow(lval, rval, &value);
+			break;
+
+		case OP_SUB:
+			overflow = __builtin_sub_overflow(lval, rval, &value);
+			break;
+
+		case OP_MULT:
+			overflow = __builtin_mul_overflow(lval, rval, &value);
+			break;
+
+		case OP_DIV:
+			overflow = is_undefined_div(lval, rval);
+			if (!overflow)
+				value = lval / rval;
+			break;
+
+		default:
+			assert(0);
 	}
+
+	if (overflow)
+		return PCALC_OUT_OF_BOUNDS;
+
+	*result = value;
+
+	return PCALC_OK;
 }
 
-int op_cmp(enum token_type op1, enum token_type op2)
+#else
+
+static enum retcode checked_binop(int *result, enum token_type op, int lval,
+								  int rval)
 {
-	switch (op1) {
+	switch (op) {
 		case OP_ADD:
+			if (is_undefined_add(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = lval + rval;
+			break;
+
 		case OP_SUB:
-			if (op2 == OP_ADD || op2 == OP_SUB)
-				return 0;
+			if (is_undefined_sub(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
 			else
-				return -1;
+				*result = lval - rval;
+			break;
 
 		case OP_MULT:
+			if (is_undefined_mult(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = lval * rval;
+			break;
+
 		case OP_DIV:
-			if (op2 == OP_ADD || op2 == OP_SUB)
-				return 1;
+			if (is_undefined_div(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
 			else
-				return 0;
+				*result = lval / rval;
+			break;
 
 		default:
 			assert(0);
 	}
+
+	return PCALC_OK;
 }
 
-// Read the token pointed to by expr. Token parameter must be allocated memory.
-enum retcode read_token(struct token *token, char *expr,
-						char **endp, int *last_ans)
+#endif
+
+// Power by repeated squaring. A negative exponent gives the reciprocal of the
+// power, truncated towards zero like division.
+static enum retcode checked_pow(int *result, int base, int exp)
 {
-#define IS_DELIM(c) (isspace(c) || (c) == '\0')
+	int value = 1;
 
-	char *head = expr;
+	if (exp < 0) {
+		if (base == 0)
+			return PCALC_OUT_OF_BOUNDS;
+		else if (base == 1 || base == -1)
+			*result = exp % 2 ? base : 1;
+		else
+			*result = 0;
 
-	if (head[0] == '+' && IS_DELIM(head[1])) {
-		token->type = OP_ADD;
-		head++;
-	}
-	else if (head[0] == '-' && IS_DELIM(head[1])) {
-		token->type = OP_SUB;
-		head++;
-	}
-	else if (head[0] == '*' && IS_DELIM(head[1])) {
-		token->type = OP_MULT;
-		head++;
+		return PCALC_OK;
 	}
-	else if (head[0] == '/' && IS_DELIM(head[1])) {
-		token->type = OP_DIV;
-		head++;
+
+	// The base is only squared if a higher bit of the exponent is set, so it
+	// can only overflow if the result does
+	while (exp > 0) {
+		if (exp & 1 && checked_binop(&value, OP_MULT, value, base) != PCALC_OK)
+			return PCALC_OUT_OF_BOUNDS;
+
+		exp >>= 1;
+
+		if (exp > 0 && checked_binop(&base, OP_MULT, base, base) != PCALC_OK)
+			return PCALC_OUT_OF_BOUNDS;
 	}
-	else if (strncmp(head, "ans", strlen("ans")) == 0) {
-		if (last_ans) {
-			token->value = *last_ans;
-			token->type = VALUE;
-			head += strlen("ans");
-		}
-		else {
-			return PCALC_NO_LAST_ANS;
-		}
+
+	*result = value;
+
+	return PCALC_OK;
+}
+
+// The operators that have no overflow builtin
+static enum retcode checked_intop(int *result, enum token_type op, int lval,
+								  int rval)
+{
+	switch (op) {
+		case OP_POW:
+			return checked_pow(result, lval, rval);
+
+		case OP_MOD:
+			if (is_undefined_mod(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = lval % rval;
+			break;
+
+		case OP_SHL:
+			if (is_undefined_shl(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = (int)((unsigned)lval << rval);
+			break;
+
+		case OP_SHR:
+			if (is_undefined_shr(lval, rval))
+				return PCALC_OUT_OF_BOUNDS;
+			else
+				*result = shift_right(lval, rval);
+			break;
+
+		case OP_AND:	*result = lval & rval;	break;
+		case OP_OR:		*result = lval | rval;	break;
+		case OP_XOR:	*result = lval ^ rval;	break;
+		case OP_MIN:	*result = lval < rval ? lval : rval;	break;
+		case OP_MAX:	*result = lval > rval ? lval : rval;	break;
+
+		default:
+			assert(0);
 	}
-	else if (isdigit(head[0]) || head[0] == '+' || head[0] == '-') {
-		char buf[32];
-		int result;
-		enum retcode ret;
 
-		// buf will always be zero terminated
-		memset(buf, 0, sizeof(buf));
+	return PCALC_OK;
+}
 
-		for (int i = 0; i + 1 < sizeof(buf) && !IS_DELIM(*head); i++) {
-			buf[i] = *head++;
-		}
+enum retcode pcalc_binop(int *result, enum token_type op, int lval, int rval)
+{
+	PROFILE_START(start);
+	enum retcode ret = op <= OP_DIV ? checked_binop(result, op, lval, rval)
+									: checked_intop(result, op, lval, rval);
 
-		ret = parse_int(&result, buf);
+	PROFILE_STOP(PROF_T_ARITH, start);
 
-		if (ret == PCALC_OUT_OF_BOUNDS)
-			return PCALC_OUT_OF_BOUNDS;
-		else if (ret == PCALC_UKNOWN_TOKEN)
-			return PCALC_UKNOWN_TOKEN;
-		else
-			token->value = result;
+	if (ret == PCALC_OUT_OF_BOUNDS)
+		PROFILE_COUNT(PROF_OVERFLOW_ADD + (op - OP_ADD));
+
+	return ret;
+}
 
-		token->type = VALUE;
+// Checked unary operation, OP_NEG is the only one
+enum retcode pcalc_unop(int *result, enum token_type op, int val)
+{
+	assert(op == OP_NEG);
+
+	if (val < -INT_MAX) {
+		PROFILE_COUNT(PROF_OVERFLOW_NEG);
+		return PCALC_OUT_OF_BOUNDS;
 	}
-	else {
-		return PCALC_UKNOWN_TOKEN;
+
+	*result = -val;
+
+	return PCALC_OK;
+}
+
+const char *retcode_str(enum retcode ret)
+{
+	switch(ret) {
+		case PCALC_OK:					return "No errors occurred";
+		case PCALC_MEMORY_ALLOC:		return "Memory allocation failed";
+		case PCALC_OUT_OF_BOUNDS:		return "Value out of bounds";
+		case PCALC_NOT_ENOUGH_VALUES:	return "Not enough values";
+		case PCALC_UKNOWN_TOKEN:		return "Uknown token";
+		case PCALC_INVALID_EXPRESSION:	return "Invalid expression";
+		case PCALC_NO_LAST_ANS:			return "No previous answer";
+		case PCALC_UNBOUND_VARIABLE:	return "Unbound variable";
+		case PCALC_CIRCULAR_DEPENDENCY:	return "Circular dependency";
+		case PCALC_INVALID_IMAGE:		return "Invalid compiled file";
+		default: assert(0);
 	}
+}
 
-	if (endp)
-		*endp = head;
+// Precedence and associativity of the infix operators, operators of higher
+// precedence bind tighter. Unary minus binds tighter than the operators
+// around it except ^, so - 2 ^ 2 is -4 and 2 ^ - 2 is 2 ^ (-2). The bitwise
+// operators are ordered as in C, and min and max bind loosest so that
+// x max 0 min 255 clamps x.
+struct op_info {
+	int prec;
+	int right_assoc;
+};
 
-	if (IS_DELIM(*head))
-		return PCALC_OK;
-	else if (token->type == VALUE && isdigit(*head))
-		return PCALC_OUT_OF_BOUNDS;
+const struct op_info op_table[] = {
+	[OP_MIN]	= {1, 0},
+	[OP_MAX]	= {1, 0},
+	[OP_OR]		= {2, 0},
+	[OP_XOR]	= {3, 0},
+	[OP_AND]	= {4, 0},
+	[OP_SHL]	= {5, 0},
+	[OP_SHR]	= {5, 0},
+	[OP_ADD]	= {6, 0},
+	[OP_SUB]	= {6, 0},
+	[OP_MULT]	= {7, 0},
+	[OP_DIV]	= {7, 0},
+	[OP_MOD]	= {7, 0},
+	[OP_NEG]	= {8, 1},
+	[OP_POW]	= {9, 1},
+	[OP_RPAREN]	= {0, 0},	// Outputs everything back to the left parenthesis
+};
+
+// Whether the operator top on the operator stack is output before op is
+// pushed. Parentheses stop the operators inside them from being output.
+int op_pops(enum token_type op, enum token_type top)
+{
+	if (top == OP_LPAREN)
+		return 0;
+	else if (op_table[top].prec != op_table[op].prec)
+		return op_table[top].prec > op_table[op].prec;
 	else
-		return PCALC_UKNOWN_TOKEN;
+		return !op_table[op].right_assoc;
+}
 
-#undef IS_DELIM
+// Parentheses are only allowed in infix expressions
+int is_paren(enum token_type type)
+{
+	return type == OP_LPAREN || type == OP_RPAREN;
 }
 
+// Replace the two top values of v_stack with the result of the operator. The
+// top value is the left operand, or the right operand if is_reversed is set.
+// The stack shrinks, so this can not fail to allocate memory.
 enum retcode pn_eval_binary_op(struct stack *v_stack, enum token_type type,
 							   int is_reversed)
 {
-	if (stack_size(v_stack) >= 2) {
-		int lval = stack_pop(v_stack);
-		int rval = stack_pop(v_stack);
-		int result = 0;
+	if (v_stack->top >= 2) {
+		int *top = &v_stack->array[v_stack->top - 1];
+		int lval = is_reversed ? top[-1] : top[0];
+		int rval = is_reversed ? top[0] : top[-1];
+		enum retcode ret = pcalc_binop(&top[-1], type, lval, rval);
+
+		if (ret == PCALC_OK)
+			v_stack->top--;
+
+		return ret;
+	}
+	else {
+		return PCALC_NOT_ENOUGH_VALUES;
+	}
+}
+
+// Turn a VAR token, whose value is the length of the name, into a SLOT token
+// if the name is bound in vars, so that evaluation only indexes the values of
+// vars. Names are resolved once as they are read. vars may be NULL.
+void var_resolve(struct token *token, const struct pcalc_vars *vars)
+{
+	size_t slot;
+
+	if (token->type == VAR && vars &&
+		pcalc_vars_slot(vars, token->pos, token->value, &slot)) {
+		token->type = SLOT;
+		token->value = slot;
+	}
+}
+
+// Values of vars indexed by the value of SLOT tokens, NULL without vars
+const int *var_values(const struct pcalc_vars *vars)
+{
+	return vars ? pcalc_vars_values(vars) : NULL;
+}
+
+// Push a value token or apply an operator token to v_stack. ANS tokens are
+// resolved to *last_ans and SLOT tokens index values.
+enum retcode pn_eval_token(struct stack *v_stack, struct token *token,
+						   int is_reversed, int *last_ans, const int *values)
+{
+	switch (token->type) {
+		case ANS:
+			if (last_ans == NULL)
+				return PCALC_NO_LAST_ANS;
+			else
+				return stack_push(v_stack, *last_ans);
+
+		case VAR:
+			return PCALC_UNBOUND_VARIABLE;
+
+		case SLOT:
+			return stack_push(v_stack, values[token->value]);
+
+		case VALUE:
+			return stack_push(v_stack, token->value);
+
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MULT:
+		case OP_DIV:
+		case OP_POW:
+		case OP_MOD:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_MIN:
+		case OP_MAX:
+			return pn_eval_binary_op(v_stack, token->type, is_reversed);
+
+		case OP_NEG:
+			if (stack_is_empty(v_stack))
+				return PCALC_NOT_ENOUGH_VALUES;
+			else
+				return pcalc_unop(&v_stack->array[v_stack->top - 1],
+								  OP_NEG, stack_peek(v_stack));
+
+		case OP_LPAREN:
+		case OP_RPAREN:
+			return PCALC_UKNOWN_TOKEN;
+
+		default:
+			assert(0);
+	}
+}
+
+// The single value left on v_stack after evaluation is the result. v_stack is
+// destroyed.
+enum retcode pn_eval_result(int *result, struct stack *v_stack)
+{
+	enum retcode ret = PCALC_INVALID_EXPRESSION;
+
+	if (stack_size(v_stack) == 1) {
+		*result = stack_pop(v_stack);
+		ret = PCALC_OK;
+	}
+
+	stack_destroy(v_stack);
+
+	return ret;
+}
+
+// Parse and evaluate a string Reverse Polish Notation expression in a single
+// pass. If an error occurs, *errp will point to the offending part of expr.
+enum retcode rpn_eval(struct arena *arena, int *result, char **errp,
+					  char *expr, char *end, int *last_ans,
+					  const struct pcalc_vars *vars)
+{
+	const int *values = var_values(vars);
+	struct stack v_stack;
+
+	// The depth is not known before the end of the stream, the stack grows
+	// past its inline slots if it has to
+	if (stack_init(&v_stack, 0, arena) != PCALC_OK)
+		return PCALC_MEMORY_ALLOC;
+
+	*errp = scan_skip_space(expr, end);
 
-		if (is_reversed) {
-			int cpy = rval;
-			rval = lval;
-			lval = cpy;
+	while (*errp < end) {
+		struct token token;
+		// read_token leaves *errp at the delimiter after the token
+		enum retcode ret = read_token(&token, *errp, end, errp, 0);
+
+		if (ret == PCALC_OK) {
+			var_resolve(&token, vars);
+			ret = pn_eval_token(&v_stack, &token, PCALC_REVERSED, last_ans,
+								values);
+
+			if (ret == PCALC_NO_LAST_ANS || ret == PCALC_UKNOWN_TOKEN ||
+				ret == PCALC_UNBOUND_VARIABLE)
+				*errp = token.pos;
 		}
 
-		switch (type) {
-			case OP_ADD:
-				if (is_undefined_add(lval, rval))
-					return PCALC_OUT_OF_BOUNDS;
-				else
-					result = lval + rval;
+		if (ret != PCALC_OK) {
+			stack_destroy(&v_stack);
+			return ret;
+		}
+
+		*errp = scan_skip_space(*errp, end);
+	}
+
+	return pn_eval_result(result, &v_stack);
+}
+
+// Start of token number index in expr, counting from zero
+char *pre_token_pos(char *expr, char *end, size_t index)
+{
+	char *p = scan_skip_space(expr, end);
+
+	while (index-- > 0)
+		p = scan_skip_space(scan_find_space(p, end), end);
+
+	return p;
+}
+
+// Parse and evaluate a string Polish Notation expression. The expression is
+// read forwards once into a compact array of token types and an array of the
+// values and variable slots, which are then evaluated from right to left.
+// Token positions are not stored but found again if an error occurs. If an
+// error occurs, *errp will point to the offending part of expr.
+enum retcode pre_eval(struct arena *arena, int *result, char **errp,
+					  char *expr, char *end, int *last_ans,
+					  const struct pcalc_vars *vars)
+{
+	// Every token but the last is followed by at least one space
+	size_t max_tokens = (end - expr) / 2 + 1;
+	size_t size = max_tokens * (sizeof(int) + 1);
+	int *values = arena ? arena_alloc(arena, size) : malloc(size);
+	unsigned char *types = (unsigned char *)(values + max_tokens);
+	const int *bound = var_values(vars);
+	struct stack v_stack;
+	size_t n = 0;
+	size_t k = 0;
+	size_t pushes = 0;
+	enum retcode ret = PCALC_OK;
+
+	if (values == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	*errp = scan_skip_space(expr, end);
+
+	while (*errp < end && ret == PCALC_OK) {
+		struct token token;
+
+		ret = read_token(&token, *errp, end, errp, 0);
+
+		if (ret == PCALC_OK && is_paren(token.type)) {
+			*errp = token.pos;
+			ret = PCALC_UKNOWN_TOKEN;
+		}
+
+		// Bound variables keep their slot in values, unbound ones fail when
+		// they are reached
+		if (ret == PCALC_OK) {
+			var_resolve(&token, vars);
+
+			types[n++] = token.type;
+			if (token.type == VALUE || token.type == SLOT)
+				values[k++] = token.value;
+			if (token.type == VALUE || token.type == ANS ||
+				token.type == VAR || token.type == SLOT)
+				pushes++;
+
+			*errp = scan_skip_space(*errp, end);
+		}
+	}
+
+	// The stack can never hold more values than are pushed, so it is sized
+	// once and never grows
+	if (stack_init(&v_stack, pushes, arena) != PCALC_OK) {
+		if (arena == NULL)
+			free(values);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	while (n > 0 && ret == PCALC_OK) {
+		switch (types[--n]) {
+			case VALUE:
+				ret = stack_push(&v_stack, values[--k]);
 				break;
 
-			case OP_SUB:
-				if (is_undefined_sub(lval, rval))
-					return PCALC_OUT_OF_BOUNDS;
+			case ANS:
+				if (last_ans == NULL)
+					ret = PCALC_NO_LAST_ANS;
 				else
-					result = lval - rval;
+					ret = stack_push(&v_stack, *last_ans);
 				break;
 
-			case OP_MULT:
-				if (is_undefined_mult(lval, rval))
-					return PCALC_OUT_OF_BOUNDS;
-				else
-					result = lval * rval;
+			case VAR:
+				ret = PCALC_UNBOUND_VARIABLE;
 				break;
 
-			case OP_DIV:
-				if (is_undefined_div(lval, rval))
-					return PCALC_OUT_OF_BOUNDS;
-				else
-					result = lval / rval;
+			case SLOT:
+				ret = stack_push(&v_stack, bound[values[--k]]);
 				break;
 
 			default:
-				assert(0);
+				ret = pn_eval_binary_op(&v_stack, types[n], 0);
+				break;
 		}
 
-		if (stack_push(v_stack, result) == PCALC_MEMORY_ALLOC)
-			return PCALC_MEMORY_ALLOC;
-		else
-			return PCALC_OK;
+		if (ret != PCALC_OK)
+			*errp = pre_token_pos(expr, end, n);
+	}
+
+	if (ret == PCALC_OK) {
+		*errp = pre_token_pos(expr, end, 0);
+		ret = pn_eval_result(result, &v_stack);
 	}
 	else {
-		return PCALC_NOT_ENOUGH_VALUES;
+		stack_destroy(&v_stack);
 	}
+
+	if (arena == NULL)
+		free(values);
+
+	return ret;
 }
 
-// Parse and evaluate a string Polish Notation expression
-// If an error occurs, *errp will point to the offending part of exrp
-enum retcode pn_eval_str(int *result, char **errp, char *expr,
-						 int is_reversed, int *last_ans)
+enum retcode pn_eval(struct arena *arena, int *result, char **errp, char *expr,
+					 char *end, int is_reversed, int *last_ans,
+					 const struct pcalc_vars *vars)
+{
+	PROFILE_START(start);
+	enum retcode ret;
+
+	if (is_reversed)
+		ret = rpn_eval(arena, result, errp, expr, end, last_ans, vars);
+	else
+		ret = pre_eval(arena, result, errp, expr, end, last_ans, vars);
+
+	PROFILE_STOP(PROF_T_EVAL, start);
+	PROFILE_COUNT(PROF_EXPRS);
+
+	return ret;
+}
+
+// Deepest the value stack gets while evaluating n postfix tokens. Evaluation
+// stops at an operator with too few values, which is counted as reducing the
+// stack to one value.
+size_t pn_max_depth(struct token *tokens, size_t n)
 {
-	struct stack *v_stack = stack_new(MIN_STACK_SIZE);
+	size_t depth = 0;
+	size_t max_depth = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (tokens[i].type == VALUE || tokens[i].type == ANS ||
+			tokens[i].type == VAR || tokens[i].type == SLOT)
+			depth++;
+		else if (tokens[i].type != OP_NEG && depth > 1)
+			depth--;
+
+		if (depth > max_depth)
+			max_depth = depth;
+	}
 
-	if (v_stack == NULL) {
+	return max_depth;
+}
+
+// Evaluate a postfix token queue produced by inf_reorder. Operators are
+// reordered without their positions, so *errp is only set for an unbound
+// variable.
+enum retcode inf_eval_outq(struct arena *arena, int *result, char **errp,
+						   d_array *outq, int *last_ans,
+						   const struct pcalc_vars *vars)
+{
+	const int *values = var_values(vars);
+	struct stack v_stack;
+	struct token *array = da_get_array(outq);
+	size_t elem_num = da_get_size(outq);
+
+	if (stack_init(&v_stack, pn_max_depth(array, elem_num), arena)
+		!= PCALC_OK)
 		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i < elem_num; i++) {
+		enum retcode ret;
+
+		assert(array[i].type != ANS || last_ans);
+
+		ret = pn_eval_token(&v_stack, &array[i], PCALC_REVERSED, last_ans,
+							values);
+
+		if (ret == PCALC_UNBOUND_VARIABLE)
+			*errp = array[i].pos;
+
+		if (ret != PCALC_OK) {
+			stack_destroy(&v_stack);
+			return ret;
+		}
 	}
 
-	if (is_reversed) {
-		*errp = expr;
-		while (isspace(**errp))
-			*errp += 1;
+	return pn_eval_result(result, &v_stack);
+}
+
+// Shunting yard algorithm
+// The state is kept between calls of inf_reorder_str, so that an expression
+// can be reordered a piece at a time. Operators wait on op_stack for their
+// right operand.
+struct reorder {
+	struct stack op_stack;
+	int expect_operand;		// The next token starts an operand
+};
+
+enum retcode reorder_init(struct reorder *r, struct arena *arena)
+{
+	r->expect_operand = 1;
+
+	return stack_init(&r->op_stack, 0, arena);
+}
+
+// Move the operators that go before op from the operator stack to outq
+enum retcode reorder_pop(struct reorder *r, d_array *outq, enum token_type op)
+{
+	while (stack_size(&r->op_stack) > 0 &&
+		   op_pops(op, stack_peek(&r->op_stack))) {
+		struct token token;
+
+		token.type = stack_pop(&r->op_stack);
+		token.pos = NULL;
+		if (da_append(outq, &token) == NULL)
+			return PCALC_MEMORY_ALLOC;
 	}
-	else {
-		*errp = expr + strlen(expr) - 1;
-		// Skip to beginning of last token
-		while (*errp > expr && isspace(**errp))
-			*errp -= 1;
-		while (*errp > expr && !isspace((*errp)[-1]))
-			*errp -= 1;
+
+	return PCALC_OK;
+}
+
+// Reorder a single token. Misplaced parentheses are invalid, other errors are
+// left for the evaluation of outq to find.
+enum retcode reorder_token(struct reorder *r, d_array *outq,
+						   struct token *token)
+{
+	enum token_type type = token->type;
+	enum retcode ret;
+
+	// In front of an operand + and - are signs
+	if (r->expect_operand && type == OP_ADD)
+		return PCALC_OK;
+	else if (r->expect_operand && type == OP_SUB)
+		type = OP_NEG;
+
+	switch (type) {
+		case VALUE:
+		case ANS:
+		case VAR:
+		case SLOT:
+			r->expect_operand = 0;
+
+			if (da_append(outq, token) == NULL)
+				return PCALC_MEMORY_ALLOC;
+			return PCALC_OK;
+
+		case OP_LPAREN:
+			if (!r->expect_operand)
+				return PCALC_INVALID_EXPRESSION;
+			return stack_push(&r->op_stack, OP_LPAREN);
+
+		case OP_RPAREN:
+			if (r->expect_operand)
+				return PCALC_INVALID_EXPRESSION;
+
+			ret = reorder_pop(r, outq, OP_RPAREN);
+
+			// Without a matching left parenthesis the stack is emptied
+			if (ret == PCALC_OK && stack_is_empty(&r->op_stack))
+				return PCALC_INVALID_EXPRESSION;
+			else if (ret == PCALC_OK)
+				stack_pop(&r->op_stack);
+			return ret;
+
+		case OP_NEG:
+			// A prefix operator has no left operand to wait for
+			return stack_push(&r->op_stack, OP_NEG);
+
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MULT:
+		case OP_DIV:
+		case OP_POW:
+		case OP_MOD:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_MIN:
+		case OP_MAX:
+			r->expect_operand = 1;
+
+			ret = reorder_pop(r, outq, type);
+
+			if (ret == PCALC_OK)
+				ret = stack_push(&r->op_stack, type);
+			return ret;
+
+		default:
+			assert(0);
 	}
+}
 
-	while (!is_reversed && *errp >= expr
-		||  is_reversed && **errp != '\0') {
-		struct token token;
-		enum retcode ret;
+// Reorder the tokens of the infix expression expr into postfix order in outq.
+// ANS tokens are only accepted if has_ans is true. wide is passed on to
+// read_token. Names bound in vars, which may be NULL, are resolved.
+enum retcode inf_reorder_str(struct reorder *r, d_array *outq, char **errp,
+							 char *expr, char *end, int has_ans, int wide,
+							 const struct pcalc_vars *vars)
+{
+	*errp = scan_skip_space(expr, end);
 
-		if (is_reversed)
-			ret = read_token(&token, *errp, errp, last_ans);
-		else
-			ret = read_token(&token, *errp, NULL, last_ans);
+	while (*errp < end) {
+		struct token token;
+		enum retcode ret = read_token(&token, *errp, end, errp, wide);
 
 		if (ret == PCALC_OK) {
-			switch (token.type) {
-				case VALUE:
-					if (stack_push(v_stack, token.value) ==
-						PCALC_MEMORY_ALLOC) {
-						stack_free(v_stack);
-						return PCALC_MEMORY_ALLOC;
-					}
-					break;
-
-				case OP_ADD:
-				case OP_SUB:
-				case OP_MULT:
-				case OP_DIV:
-				{
-					enum retcode ret = pn_eval_binary_op(v_stack, token.type,
-														 is_reversed);
-
-					if (ret != PCALC_OK) {
-						stack_free(v_stack);
-						return ret;
-					}
-				}
-					break;
-
-				default:
-					assert(0);
-			}
-		}
-		else {
-			stack_free(v_stack);
+			var_resolve(&token, vars);
 
-			switch (ret) {
-				case PCALC_UKNOWN_TOKEN:	return PCALC_UKNOWN_TOKEN;
-				case PCALC_OUT_OF_BOUNDS:	return PCALC_OUT_OF_BOUNDS;
-				case PCALC_NO_LAST_ANS:		return PCALC_NO_LAST_ANS;
+			if (token.type == ANS && !has_ans)
+				ret = PCALC_NO_LAST_ANS;
+			else
+				ret = reorder_token(r, outq, &token);
 
-				default:   assert(0);
-			}
+			if (ret == PCALC_NO_LAST_ANS || ret == PCALC_INVALID_EXPRESSION)
+				*errp = token.pos;
+			else
+				*errp = scan_skip_space(*errp, end);
 		}
 
-		if (is_reversed) {
-			*errp += 1;
-			while (isspace(**errp))
-				*errp += 1;
+		if (ret != PCALC_OK)
+			return ret;
+	}
+
+	return PCALC_OK;
+}
+
+// Move the operators left on the operator stack to outq once the whole
+// expression has been reordered. An unclosed parenthesis is invalid.
+enum retcode inf_reorder_end(struct reorder *r, d_array *outq)
+{
+	enum retcode ret = reorder_pop(r, outq, OP_RPAREN);
+
+	if (ret == PCALC_OK && !stack_is_empty(&r->op_stack))
+		ret = PCALC_INVALID_EXPRESSION;
+
+	return ret;
+}
+
+// Reorder the whole infix expression expr into postfix order in outq, see
+// inf_reorder_str
+enum retcode inf_reorder(struct arena *arena, d_array *outq, char **errp,
+						 char *expr, char *end, int has_ans, int wide,
+						 const struct pcalc_vars *vars)
+{
+	struct reorder r;
+	enum retcode ret;
+
+	if (reorder_init(&r, arena) != PCALC_OK)
+		return PCALC_MEMORY_ALLOC;
+
+	ret = inf_reorder_str(&r, outq, errp, expr, end, has_ans, wide, vars);
+
+	if (ret == PCALC_OK)
+		ret = inf_reorder_end(&r, outq);
+
+	stack_destroy(&r.op_stack);
+
+	return ret;
+}
+
+enum retcode inf_eval(struct arena *arena, int *result, char **errp,
+					  char *expr, char *end, int *last_ans,
+					  const struct pcalc_vars *vars)
+{
+	PROFILE_START(start);
+	d_array *outq = da_new(sizeof(struct token), MIN_STACK_SIZE, arena);
+	enum retcode ret;
+
+	if (outq == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	PROFILE_START(reorder);
+	ret = inf_reorder(arena, outq, errp, expr, end, last_ans != NULL, 0,
+					  vars);
+	PROFILE_STOP(PROF_T_REORDER, reorder);
+
+	if (ret == PCALC_OK)
+		ret = inf_eval_outq(arena, result, errp, outq, last_ans, vars);
+
+	da_free(&outq);
+
+	PROFILE_STOP(PROF_T_EVAL, start);
+	PROFILE_COUNT(PROF_EXPRS);
+
+	return ret;
+}
+
+enum retcode pn_eval_str(int *result, char **errp, char *expr,
+						 int is_reversed, int *last_ans)
+{
+	return pn_eval(NULL, result, errp, expr, expr + strlen(expr), is_reversed,
+				   last_ans, NULL);
+}
+
+enum retcode inf_eval_str(int *result, char **errp, char *expr, int *last_ans)
+{
+	return inf_eval(NULL, result, errp, expr, expr + strlen(expr), last_ans,
+					NULL);
+}
+
+// Split a prefix or postfix expression into tokens in reading order. wide is
+// passed on to read_token.
+enum retcode pn_tokenize(d_array *tokens, char **errp, char *expr, char *end,
+						 int wide)
+{
+	*errp = scan_skip_space(expr, end);
+
+	while (*errp < end) {
+		struct token token;
+		enum retcode ret = read_token(&token, *errp, end, errp, wide);
+
+		if (ret == PCALC_OK && is_paren(token.type)) {
+			*errp = token.pos;
+			ret = PCALC_UKNOWN_TOKEN;
 		}
-		else {
-			*errp -= 1;
-			while (*errp > expr && isspace(**errp))
-				*errp -= 1;
-			while (*errp > expr && !isspace((*errp)[-1]))
-				*errp -= 1;
 
-			if (*errp == expr && isspace(**errp))
-				break;
+		if (ret != PCALC_OK)
+			return ret;
+		else if (da_append(tokens, &token) == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		*errp = scan_skip_space(*errp, end);
+	}
+
+	return PCALC_OK;
+}
+
+struct pcalc_ctx *pcalc_ctx_new(void)
+{
+	struct pcalc_ctx *ctx = malloc(sizeof(*ctx));
+
+	if (ctx) {
+		ctx->arena = arena_new(CTX_ARENA_SIZE);
+		ctx->vars = NULL;
+
+		if (ctx->arena == NULL) {
+			free(ctx);
+			return NULL;
 		}
 	}
 
-	if (stack_size(v_stack) == 1) {
-		*result = stack_pop(v_stack);
-		stack_free(v_stack);
-		return PCALC_OK;
+	return ctx;
+}
+
+void pcalc_ctx_free(struct pcalc_ctx *ctx)
+{
+	if (ctx) {
+		arena_free(ctx->arena);
+		free(ctx);
 	}
-	else {
-		stack_free(v_stack);
-		return PCALC_INVALID_EXPRESSION;
+}
+
+// Number of heap allocations made through ctx since it was created
+size_t pcalc_ctx_allocs(struct pcalc_ctx *ctx)
+{
+	return arena_allocs(ctx->arena);
+}
+
+// Look up the names of the expressions evaluated with ctx in vars, which may
+// be NULL for none. The table must outlive its use by ctx, and it is read on
+// every evaluation, so ctx sees the values set later.
+void pcalc_ctx_set_vars(struct pcalc_ctx *ctx, const struct pcalc_vars *vars)
+{
+	ctx->vars = vars;
+}
+
+// Evaluate the len characters at expr in any notation. expr does not need to
+// be zero terminated. All working memory is taken from ctx, which is reset
+// first. ctx may be NULL to use the heap directly.
+enum retcode pcalc_evaln(struct pcalc_ctx *ctx, int *result, char **errp,
+						 char *expr, size_t len, enum notation notation,
+						 int *last_ans)
+{
+	struct arena *arena = NULL;
+	const struct pcalc_vars *vars = NULL;
+	char *end = expr + len;
+
+	if (ctx) {
+		arena = ctx->arena;
+		vars = ctx->vars;
+		arena_reset(arena);
+	}
+
+	switch (notation) {
+		case PREFIX:
+			return pn_eval(arena, result, errp, expr, end, 0, last_ans, vars);
+
+		case POSTFIX:
+			return pn_eval(arena, result, errp, expr, end, PCALC_REVERSED,
+						   last_ans, vars);
+
+		case INFIX:
+			return inf_eval(arena, result, errp, expr, end, last_ans, vars);
+
+		default:
+			assert(0);
 	}
 }
 
-enum retcode inf_eval_outq(int *result, d_array *outq)
+enum retcode pcalc_eval(struct pcalc_ctx *ctx, int *result, char **errp,
+						char *expr, enum notation notation, int *last_ans)
 {
-	struct stack *v_stack = stack_new(MIN_STACK_SIZE);
-	struct token *array = da_get_array(outq);
-	size_t elem_num = da_get_size(outq);
+	return pcalc_evaln(ctx, result, errp, expr, strlen(expr), notation,
+					   last_ans);
+}
+
+// Evaluate prefix or postfix tokens, setting *errp to the position of the
+// token that fails
+enum retcode pn_eval_tokens(struct arena *arena, int *result, char **errp,
+							struct token *tokens, size_t n, int is_reversed,
+							int *last_ans, const struct pcalc_vars *vars)
+{
+	const int *values = var_values(vars);
+	struct stack v_stack;
+	size_t pushes = 0;
+	enum retcode ret = PCALC_OK;
+
+	for (size_t i = 0; i < n; i++)
+		if (tokens[i].type == VALUE || tokens[i].type == ANS ||
+			tokens[i].type == VAR || tokens[i].type == SLOT)
+			pushes++;
+
+	if (stack_init(&v_stack, pushes, arena) != PCALC_OK)
+		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i < n && ret == PCALC_OK; i++) {
+		struct token *token = &tokens[is_reversed ? i : n - 1 - i];
 
-	if (v_stack == NULL) {
+		ret = pn_eval_token(&v_stack, token, is_reversed, last_ans, values);
+
+		if (ret != PCALC_OK)
+			*errp = token->pos;
+	}
+
+	if (ret != PCALC_OK) {
+		stack_destroy(&v_stack);
+		return ret;
+	}
+
+	return pn_eval_result(result, &v_stack);
+}
+
+// Tokenize the n strings at args as one expression, resolving the names bound
+// in vars, see pcalc_evalv
+enum retcode evalv_tokenize(struct arena *arena, d_array *tokens,
+							size_t *indexp, char **errp, char **args, size_t n,
+							enum notation notation, int has_ans,
+							const struct pcalc_vars *vars)
+{
+	struct reorder r;
+	enum retcode ret = PCALC_OK;
+
+	if (reorder_init(&r, arena) != PCALC_OK)
 		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i < n && ret == PCALC_OK; i++) {
+		char *end = args[i] + strlen(args[i]);
+
+		*indexp = i;
+
+		if (notation == INFIX)
+			ret = inf_reorder_str(&r, tokens, errp, args[i], end,
+								  has_ans, 0, vars);
+		else
+			ret = pn_tokenize(tokens, errp, args[i], end, 0);
 	}
 
-	for (size_t i = 0; i < elem_num; i++) {
-		switch (array[i].type) {
-			case VALUE:
-				if (stack_push(v_stack, array[i].value) == PCALC_MEMORY_ALLOC) {
-					stack_free(v_stack);
-					return PCALC_MEMORY_ALLOC;
-				}
-				break;
+	if (ret == PCALC_OK)
+		ret = inf_reorder_end(&r, tokens);
+
+	if (ret == PCALC_OK && notation != INFIX) {
+		struct token *array = da_get_array(tokens);
+
+		for (size_t i = 0; i < da_get_size(tokens); i++)
+			var_resolve(&array[i], vars);
+	}
+
+	stack_destroy(&r.op_stack);
+
+	return ret;
+}
+
+// Evaluate the expression made up of the n strings at args, as if they were
+// joined with spaces, without copying them. Tokens can not span strings, as
+// with the arguments of a command. If an error occurs, *errp will point to
+// the offending part of args[*indexp], or be NULL if the error has no
+// position.
+enum retcode pcalc_evalv(struct pcalc_ctx *ctx, int *result, size_t *indexp,
+						 char **errp, char **args, size_t n,
+						 enum notation notation, int *last_ans)
+{
+	struct arena *arena = NULL;
+	const struct pcalc_vars *vars = NULL;
+	d_array *tokens;
+	enum retcode ret;
+
+	if (ctx) {
+		arena = ctx->arena;
+		vars = ctx->vars;
+		arena_reset(arena);
+	}
+
+	*indexp = 0;
+	*errp = NULL;
 
-			case OP_ADD:
-			case OP_SUB:
-			case OP_MULT:
-			case OP_DIV:
-			{
-				enum retcode ret = pn_eval_binary_op(v_stack, array[i].type,
-													 PCALC_REVERSED);
-
-				if (ret != PCALC_OK) {
-					stack_free(v_stack);
-					return ret;
-				}
+	tokens = da_new(sizeof(struct token), MIN_STACK_SIZE, arena);
+
+	if (tokens == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	ret = evalv_tokenize(arena, tokens, indexp, errp, args, n, notation,
+						 last_ans != NULL, vars);
+
+	if (ret == PCALC_OK) {
+		*errp = NULL;
+
+		if (notation == INFIX)
+			ret = inf_eval_outq(arena, result, errp, tokens, last_ans,
+								vars);
+		else
+			ret = pn_eval_tokens(arena, result, errp, da_get_array(tokens),
+								 da_get_size(tokens), notation == POSTFIX,
+								 last_ans, vars);
+
+		// Find the string of the token that failed
+		for (size_t i = 0; ret != PCALC_OK && *errp && i < n; i++) {
+			if (*errp >= args[i] && *errp < args[i] + strlen(args[i])) {
+				*indexp = i;
 				break;
 			}
-
-			default:
-				assert(0);
 		}
 	}
 
-	if (stack_size(v_stack) == 1) {
-		*result = stack_pop(v_stack);
-		stack_free(v_stack);
-		return PCALC_OK;
-	}
-	else {
-		stack_free(v_stack);
-		return PCALC_INVALID_EXPRESSION;
+	da_free(&tokens);
+	PROFILE_COUNT(PROF_EXPRS);
+
+	return ret;
+}
+
+// Start evaluating a postfix expression that is passed in chunks to
+// pcalc_stream_feed. last_ans may be NULL.
+struct pcalc_stream *pcalc_stream_new(const int *last_ans)
+{
+	struct pcalc_stream *stream = malloc(sizeof(*stream));
+
+	if (stream == NULL)
+		return NULL;
+
+	// Without an arena and with an initial size of zero this can not fail
+	stack_init(&stream->v_stack, 0, NULL);
+	stream->ans = last_ans ? *last_ans : 0;
+	stream->has_ans = last_ans != NULL;
+	stream->offset = 0;
+	stream->err_offset = 0;
+	stream->ret = PCALC_OK;
+	stream->token_len = 0;
+
+	return stream;
+}
+
+void pcalc_stream_free(struct pcalc_stream *stream)
+{
+	if (stream) {
+		stack_destroy(&stream->v_stack);
+		free(stream);
 	}
 }
 
-// Shunting yard algorithm
-enum retcode inf_eval_str(int *result, char **errp, char *expr, int *last_ans)
+// Evaluate the complete token from p to end, which starts at offset in the
+// stream
+void stream_token(struct pcalc_stream *stream, char *p, char *end,
+				  size_t offset)
 {
-	struct stack *op_stack = stack_new(MIN_STACK_SIZE);
-	d_array *outq = da_new(sizeof(struct token), MIN_STACK_SIZE);
+	struct token token;
+	char *endp;
+	enum retcode ret = read_token(&token, p, end, &endp, 0);
 
-	if (op_stack == NULL || outq == NULL)
-		return PCALC_MEMORY_ALLOC;
+	// Parentheses end a token, but are not allowed in postfix anyway
+	if (ret == PCALC_OK && endp != end)
+		ret = PCALC_UKNOWN_TOKEN;
 
-	*errp = expr;
+	if (ret == PCALC_OK)
+		ret = pn_eval_token(&stream->v_stack, &token, PCALC_REVERSED,
+							stream->has_ans ? &stream->ans : NULL, NULL);
 
-	while (isspace(**errp))
-		*errp += 1;
+	if (ret != PCALC_OK) {
+		stream->ret = ret;
+		stream->err_offset = offset;
+	}
+}
 
-	while (**errp != '\0') {
-		struct token token;
-		enum retcode ret = read_token(&token, *errp, errp, last_ans);
+// Evaluate the tokens in the next len bytes of the stream. Tokens may be split
+// anywhere between chunks, but may not be longer than STREAM_TOKEN_SIZE.
+// Returns the first error of the stream, after which the rest of the input
+// is ignored.
+enum retcode pcalc_stream_feed(struct pcalc_stream *stream, char *chunk,
+							   size_t len)
+{
+	char *p = chunk;
+	char *end = chunk + len;
 
-		if (ret == PCALC_OK) {
-			switch (token.type) {
-				case VALUE:
-					da_append(outq, &token);
-					break;
-
-				case OP_ADD:
-				case OP_SUB:
-				case OP_MULT:
-				case OP_DIV:
-					while (stack_size(op_stack) > 0) {
-						enum token_type op2 = stack_peek(op_stack);
-
-						if (op_cmp(token.type, op2) <= 0) {
-							struct token token;
-
-							token.type = stack_pop(op_stack);
-							da_append(outq, &token);
-						}
-						else {
-							break;
-						}
-					}
-
-					stack_push(op_stack, token.type);
-					break;
-
-				default:
-					assert(0);
-			}
+	while (stream->ret == PCALC_OK && p < end) {
+		char *q;
+
+		// A split token goes on until the first space of the chunk
+		if (stream->token_len == 0) {
+			p = scan_skip_space(p, end);
 
-			*errp += 1;
-			while (isspace(**errp))
-				*errp += 1;
+			if (p == end)
+				break;
 		}
-		else {
-			stack_free(op_stack);
-			da_free(&outq);
 
-			switch (ret) {
-				case PCALC_UKNOWN_TOKEN:	return PCALC_UKNOWN_TOKEN;
-				case PCALC_OUT_OF_BOUNDS:	return PCALC_OUT_OF_BOUNDS;
-				case PCALC_NO_LAST_ANS:		return PCALC_NO_LAST_ANS;
+		q = scan_find_space(p, end);
+
+		if (stream->token_len == 0)
+			stream->token_start = stream->offset + (p - chunk);
 
-				default:   assert(0);
+		if (q < end && stream->token_len == 0) {
+			stream_token(stream, p, q, stream->token_start);
+		}
+		else if (stream->token_len + (q - p) > STREAM_TOKEN_SIZE) {
+			stream->ret = PCALC_UKNOWN_TOKEN;
+			stream->err_offset = stream->token_start;
+		}
+		else {
+			memcpy(stream->token + stream->token_len, p, q - p);
+			stream->token_len += q - p;
+
+			// The token is complete once a space is seen
+			if (q < end) {
+				stream_token(stream, stream->token,
+							 stream->token + stream->token_len,
+							 stream->token_start);
+				stream->token_len = 0;
 			}
 		}
+
+		p = q;
 	}
 
-	while (stack_size(op_stack) > 0) {
-		struct token token;
+	stream->offset += len;
 
-		token.type = stack_pop(op_stack);
-		da_append(outq, &token);
-	}
+	return stream->ret;
+}
 
-	stack_free(op_stack);
+// End the stream and get the result. The stream must still be freed.
+enum retcode pcalc_stream_finish(struct pcalc_stream *stream, int *result)
+{
+	if (stream->ret == PCALC_OK && stream->token_len > 0) {
+		stream_token(stream, stream->token, stream->token + stream->token_len,
+					 stream->token_start);
+		stream->token_len = 0;
+	}
 
-	{
-		enum retcode ret = inf_eval_outq(result, outq);
-		da_free(&outq);
-		return ret;
+	if (stream->ret == PCALC_OK && stack_size(&stream->v_stack) != 1) {
+		stream->ret = PCALC_INVALID_EXPRESSION;
+		stream->err_offset = stream->offset;
 	}
+
+	if (stream->ret == PCALC_OK)
+		*result = stack_peek(&stream->v_stack);
+
+	PROFILE_COUNT(PROF_EXPRS);
+
+	return stream->ret;
+}
+
+// Offset in the stream of the token that caused the error, or of the end of
+// the stream if it does not hold a single expression
+size_t pcalc_stream_offset(const struct pcalc_stream *stream)
+{
+	return stream->err_offset;
 }
@@ -9,6 +9,8 @@
 #ifndef PCALC_H
 #define PCALC_H
 
+#include <stddef.h>
+
 #define PCALC_REVERSED 1
 
 enum retcode {
@@ -18,11 +20,115 @@ enum retcode {
 	PCALC_NOT_ENOUGH_VALUES,
 	PCALC_UKNOWN_TOKEN,
 	PCALC_INVALID_EXPRESSION,
-	PCALC_NO_LAST_ANS
+	PCALC_NO_LAST_ANS,
+	PCALC_UNBOUND_VARIABLE,
+	PCALC_CIRCULAR_DEPENDENCY,
+	PCALC_INVALID_IMAGE
+};
+
+enum notation {
+	PREFIX,
+	POSTFIX,
+	INFIX
+};
+
+// Numeric backend for values and arithmetic. The int backend is evaluated by
+// the pcalc_eval functions, the wider ones by num_evaln in num.h.
+enum arith {
+	ARITH_INT,
+	ARITH_INT64,
+	ARITH_BIG		// Arbitrary precision
 };
 
+// Compiled expression, see program.c
+struct pcalc_program;
+
+// Compiled expression in native code, see jit.c
+struct pcalc_jit;
+
+// Compiled expressions stored in a file, see image.c
+struct pcalc_image;
+
+// Named variables of compiled expressions, see vars.c
+struct pcalc_vars;
+
+// Incremental postfix evaluation, see pcalc_stream_new
+struct pcalc_stream;
+
+// Reusable evaluation context owning the working memory of pcalc_eval
+// The library has no global state, but a context must only be used by one
+// thread at a time.
+struct pcalc_ctx;
+
+const char *retcode_str(enum retcode ret);
 enum retcode pn_eval_str(int *result, char **errp, char *expr,
 						 int is_reversed, int *last_ans);
 enum retcode inf_eval_str(int *result, char **errp, char *expr, int *last_ans);
 
+struct pcalc_ctx *pcalc_ctx_new(void);
+void pcalc_ctx_free(struct pcalc_ctx *ctx);
+size_t pcalc_ctx_allocs(struct pcalc_ctx *ctx);
+void pcalc_ctx_set_vars(struct pcalc_ctx *ctx, const struct pcalc_vars *vars);
+enum retcode pcalc_eval(struct pcalc_ctx *ctx, int *result, char **errp,
+						char *expr, enum notation notation, int *last_ans);
+enum retcode pcalc_evaln(struct pcalc_ctx *ctx, int *result, char **errp,
+						 char *expr, size_t len, enum notation notation,
+						 int *last_ans);
+enum retcode pcalc_evalv(struct pcalc_ctx *ctx, int *result, size_t *indexp,
+						 char **errp, char **args, size_t n,
+						 enum notation notation, int *last_ans);
+
+struct pcalc_stream *pcalc_stream_new(const int *last_ans);
+void pcalc_stream_free(struct pcalc_stream *stream);
+enum retcode pcalc_stream_feed(struct pcalc_stream *stream, char *chunk,
+							   size_t len);
+enum retcode pcalc_stream_finish(struct pcalc_stream *stream, int *result);
+size_t pcalc_stream_offset(const struct pcalc_stream *stream);
+
+enum retcode pcalc_compile(struct pcalc_program **progp, char **errp,
+						   char *expr, enum notation notation);
+enum retcode pcalc_compilen(struct pcalc_program **progp, char **errp,
+							char *expr, size_t len, enum notation notation,
+							const struct pcalc_vars *vars);
+enum retcode pcalc_exec(int *result, const struct pcalc_program *prog,
+						const int *last_ans);
+enum retcode pcalc_exec_column(const struct pcalc_program *prog,
+							   const int *ans, int *results,
+							   enum retcode *rets, size_t n);
+void pcalc_program_free(struct pcalc_program *prog);
+enum retcode pcalc_eval_vars(int *result, char **errp, char *expr, size_t len,
+							 enum notation notation,
+							 const struct pcalc_vars *vars,
+							 const int *last_ans);
+int pcalc_program_uses_ans(const struct pcalc_program *prog);
+size_t pcalc_program_folded(const struct pcalc_program *prog);
+size_t pcalc_program_vars(const struct pcalc_program *prog, size_t *slots);
+
+enum retcode pcalc_jit_compile(struct pcalc_jit **jitp,
+							   const struct pcalc_program *prog);
+enum retcode pcalc_jit_exec(int *result, const struct pcalc_jit *jit,
+							const int *last_ans);
+int pcalc_jit_native(const struct pcalc_jit *jit);
+void pcalc_jit_free(struct pcalc_jit *jit);
+
+enum retcode pcalc_image_build(void **datap, size_t *sizep,
+							   struct pcalc_program *const *progs, size_t n);
+enum retcode pcalc_image_load(struct pcalc_image **imagep, const void *data,
+							  size_t size);
+size_t pcalc_image_len(const struct pcalc_image *image);
+const struct pcalc_program *pcalc_image_program(const struct pcalc_image *img,
+												size_t i);
+void pcalc_image_free(struct pcalc_image *image);
+
+struct pcalc_vars *pcalc_vars_new(void);
+void pcalc_vars_free(struct pcalc_vars *vars);
+enum retcode pcalc_vars_set(struct pcalc_vars *vars, const char *name,
+							size_t len, int value);
+enum retcode pcalc_vars_bind(struct pcalc_vars *vars, char **errp,
+							 char *binding, size_t len);
+int pcalc_vars_slot(const struct pcalc_vars *vars, const char *name,
+					size_t len, size_t *slot);
+void pcalc_vars_set_slot(struct pcalc_vars *vars, size_t slot, int value);
+const int *pcalc_vars_values(const struct pcalc_vars *vars);
+
 #endif
@@ -0,0 +1,259 @@
+//
+// pool.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "pool.h"
+
+// Every worker owns a range of the jobs in a round. It takes jobs from the
+// front of its own range and, when that is empty, steals from the back of the
+// other workers' ranges. Jobs are therefore mostly finished in order, which
+// lets the caller consume results with pool_wait_job while the round runs.
+// A range is tagged with its round, so that a worker still looking for jobs
+// of the previous round never takes one of the next.
+struct pool_worker {
+	pthread_mutex_t lock;
+	unsigned long round;
+	size_t head;
+	size_t tail;
+	unsigned id;
+	pthread_t thread;
+	struct pool *pool;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned long round;
+	int quit;
+
+	pool_func func;
+	void *arg;
+	size_t njobs;
+	size_t finished;
+	unsigned char *job_done;
+	size_t job_size;
+
+	unsigned nthreads;
+	struct pool_worker workers[];
+};
+
+int pool_take(struct pool *pool, struct pool_worker *self, unsigned long round,
+			  size_t *job)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&self->lock);
+	if (self->round == round && self->head < self->tail) {
+		*job = self->head++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	for (unsigned i = 1; !found && i < pool->nthreads; i++) {
+		struct pool_worker *victim =
+			&pool->workers[(self->id + i) % pool->nthreads];
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->round == round && victim->head < victim->tail) {
+			*job = --victim->tail;
+			found = 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+
+	return found;
+}
+
+void *pool_thread(void *p)
+{
+	struct pool_worker *self = p;
+	struct pool *pool = self->pool;
+	unsigned long round = 0;
+
+	for (;;) {
+		size_t job;
+		int quit;
+		pool_func func;
+		void *arg;
+
+		// The next round may be started while this one's jobs are still
+		// being taken, so its function is read with the round
+		pthread_mutex_lock(&pool->lock);
+		while (pool->round == round && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		round = pool->round;
+		quit = pool->quit;
+		func = pool->func;
+		arg = pool->arg;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (quit)
+			return NULL;
+
+		while (pool_take(pool, self, round, &job)) {
+			func(arg, job, self->id);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->job_done[job] = 1;
+			pool->finished++;
+			pthread_cond_broadcast(&pool->done);
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+}
+
+struct pool *pool_new(unsigned nthreads)
+{
+	struct pool *pool;
+	sigset_t all, old;
+	unsigned i;
+
+	if (nthreads == 0)
+		nthreads = 1;
+
+	pool = malloc(sizeof(*pool) + nthreads * sizeof(pool->workers[0]));
+
+	if (pool == NULL)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->round = 0;
+	pool->quit = 0;
+	pool->func = NULL;
+	pool->arg = NULL;
+	pool->njobs = 0;
+	pool->finished = 0;
+	pool->job_done = NULL;
+	pool->job_size = 0;
+	pool->nthreads = nthreads;
+
+	// Workers inherit a mask blocking all signals, so that signals are
+	// handled by the threads of the caller, such as the event loop of the
+	// server
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < nthreads; i++) {
+		struct pool_worker *w = &pool->workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		w->round = 0;
+		w->head = w->tail = 0;
+		w->id = i;
+		w->pool = pool;
+
+		if (pthread_create(&w->thread, NULL, pool_thread, w) != 0)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (i < nthreads) {
+		// Stop the threads that did start
+		pool->nthreads = i;
+		pool_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void pool_free(struct pool *pool)
+{
+	if (pool) {
+		pthread_mutex_lock(&pool->lock);
+		pool->quit = 1;
+		pthread_cond_broadcast(&pool->start);
+		pthread_mutex_unlock(&pool->lock);
+
+		// Idle workers may still be looking for jobs to steal, so no lock can
+		// be destroyed before all threads have stopped
+		for (unsigned i = 0; i < pool->nthreads; i++)
+			pthread_join(pool->workers[i].thread, NULL);
+
+		for (unsigned i = 0; i < pool->nthreads; i++)
+			pthread_mutex_destroy(&pool->workers[i].lock);
+
+		pthread_cond_destroy(&pool->done);
+		pthread_cond_destroy(&pool->start);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool->job_done);
+		free(pool);
+	}
+}
+
+unsigned pool_size(struct pool *pool)
+{
+	return pool->nthreads;
+}
+
+// Run func for jobs 0 to njobs - 1 on the worker threads. The previous round
+// must have been waited for. Returns 0 if memory could not be allocated.
+int pool_start(struct pool *pool, size_t njobs, pool_func func, void *arg)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	if (njobs > pool->job_size) {
+		unsigned char *job_done = realloc(pool->job_done, njobs);
+
+		if (job_done == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			return 0;
+		}
+
+		pool->job_done = job_done;
+		pool->job_size = njobs;
+	}
+
+	memset(pool->job_done, 0, njobs);
+	pool->func = func;
+	pool->arg = arg;
+	pool->njobs = njobs;
+	pool->finished = 0;
+
+	for (unsigned i = 0; i < pool->nthreads; i++) {
+		struct pool_worker *w = &pool->workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->round = pool->round + 1;
+		w->head = njobs * i / pool->nthreads;
+		w->tail = njobs * (i + 1) / pool->nthreads;
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	pool->round++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 1;
+}
+
+void pool_wait_job(struct pool *pool, size_t job)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->job_done[job])
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->finished < pool->njobs)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,26 @@
+//
+// pool.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+struct pool;
+
+// Called once for every job of a round, worker is in [0, pool_size)
+typedef void (*pool_func)(void *arg, size_t job, unsigned worker);
+
+struct pool *pool_new(unsigned nthreads);
+void pool_free(struct pool *pool);
+unsigned pool_size(struct pool *pool);
+int pool_start(struct pool *pool, size_t njobs, pool_func func, void *arg);
+void pool_wait_job(struct pool *pool, size_t job);
+void pool_wait(struct pool *pool);
+
+#endif
@@ -0,0 +1,121 @@
+//
+// profile.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include "profile.h"
+
+#ifdef PCALC_PROFILE
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+// Every thread counts into its own record, so that batch workers do not
+// contend. The records are linked together and summed by profile_dump. They
+// are never freed, as they must outlive their threads.
+struct profile {
+	size_t counts[PROF_COUNTERS];
+	double seconds[PROF_TIMERS];
+	struct profile *next;
+};
+
+static __thread struct profile *local;
+static struct profile *profiles;
+static pthread_mutex_t profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *counter_names[PROF_COUNTERS] = {
+	"expressions",
+	"tokens",
+	"stack_grows",
+	"array_grows",
+	"overflows_add",
+	"overflows_sub",
+	"overflows_mult",
+	"overflows_div",
+	"overflows_pow",
+	"overflows_mod",
+	"overflows_shl",
+	"overflows_shr",
+	"overflows_neg",
+	"folded_nodes",
+};
+
+static const char *timer_names[PROF_TIMERS] = {
+	"seconds_eval",
+	"seconds_lex",
+	"seconds_reorder",
+	"seconds_grow",
+	"seconds_arith",
+};
+
+// The record of the calling thread, NULL if it could not be allocated
+static struct profile *profile_local(void)
+{
+	if (local == NULL) {
+		local = calloc(1, sizeof(*local));
+
+		if (local) {
+			pthread_mutex_lock(&profiles_lock);
+			local->next = profiles;
+			profiles = local;
+			pthread_mutex_unlock(&profiles_lock);
+		}
+	}
+
+	return local;
+}
+
+void profile_count(enum prof_counter counter, size_t n)
+{
+	struct profile *p = profile_local();
+
+	if (p)
+		p->counts[counter] += n;
+}
+
+double profile_start(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void profile_stop(enum prof_timer timer, double start)
+{
+	struct profile *p = profile_local();
+
+	if (p)
+		p->seconds[timer] += profile_start() - start;
+}
+
+// Print the sums over all threads as "<name> <value>" lines. Threads that are
+// still evaluating may be missed.
+void profile_dump(FILE *stream)
+{
+	size_t counts[PROF_COUNTERS] = {0};
+	double seconds[PROF_TIMERS] = {0};
+
+	pthread_mutex_lock(&profiles_lock);
+	for (struct profile *p = profiles; p; p = p->next) {
+		for (int i = 0; i < PROF_COUNTERS; i++)
+			counts[i] += p->counts[i];
+		for (int i = 0; i < PROF_TIMERS; i++)
+			seconds[i] += p->seconds[i];
+	}
+	pthread_mutex_unlock(&profiles_lock);
+
+	for (int i = 0; i < PROF_COUNTERS; i++)
+		fprintf(stream, "%s %zu\n", counter_names[i], counts[i]);
+	for (int i = 0; i < PROF_TIMERS; i++)
+		fprintf(stream, "%s %.6f\n", timer_names[i], seconds[i]);
+}
+
+#endif
@@ -0,0 +1,69 @@
+//
+// profile.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+// Counters and timers of the evaluation pipeline. They are only compiled in
+// when PCALC_PROFILE is defined, e.g. with make PROFILE=1. Otherwise the
+// macros below expand to nothing.
+
+enum prof_counter {
+	PROF_EXPRS,			// Expressions evaluated
+	PROF_TOKENS,		// Tokens read by read_token
+	PROF_STACK_GROW,	// Value and operator stack reallocations
+	PROF_ARRAY_GROW,	// d_array reallocations
+	PROF_OVERFLOW_ADD,	// Rejected operations, one counter per operator in
+	PROF_OVERFLOW_SUB,	// token_type order up to OP_SHR, the bitwise
+	PROF_OVERFLOW_MULT,	// operators and min and max can not fail
+	PROF_OVERFLOW_DIV,
+	PROF_OVERFLOW_POW,
+	PROF_OVERFLOW_MOD,
+	PROF_OVERFLOW_SHL,
+	PROF_OVERFLOW_SHR,
+	PROF_OVERFLOW_NEG,
+	PROF_FOLDED,		// Nodes removed by constant folding
+	PROF_COUNTERS
+};
+
+// Timers nest, e.g. PROF_T_LEX is included in PROF_T_EVAL
+enum prof_timer {
+	PROF_T_EVAL,		// Whole evaluations
+	PROF_T_LEX,			// read_token
+	PROF_T_REORDER,		// Shunting yard, including the tokens it reads
+	PROF_T_GROW,		// Stack and d_array reallocations
+	PROF_T_ARITH,		// Checked arithmetic
+	PROF_TIMERS
+};
+
+#ifdef PCALC_PROFILE
+
+void profile_count(enum prof_counter counter, size_t n);
+double profile_start(void);
+void profile_stop(enum prof_timer timer, double start);
+void profile_dump(FILE *stream);
+
+#define PROFILE_COUNT(counter) profile_count(counter, 1)
+#define PROFILE_COUNT_N(counter, n) profile_count(counter, n)
+#define PROFILE_START(var) double var = profile_start()
+#define PROFILE_STOP(timer, var) profile_stop(timer, var)
+#define PROFILE_DUMP(stream) profile_dump(stream)
+
+#else
+
+#define PROFILE_COUNT(counter) ((void)0)
+#define PROFILE_COUNT_N(counter, n) ((void)0)
+#define PROFILE_START(var)
+#define PROFILE_STOP(timer, var) ((void)0)
+#define PROFILE_DUMP(stream) ((void)0)
+
+#endif
+
+#endif
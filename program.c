@@ -0,0 +1,532 @@
+//
+//  program.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pcalc.h"
+#include "d_array.h"
+#include "token.h"
+#include "program.h"
+#include "profile.h"
+
+enum opcode op_to_opcode(enum token_type type, int is_prefix)
+{
+	switch (type) {
+		case VALUE:		return OPC_PUSH;
+		case ANS:		return OPC_ANS;
+		case VAR:		return OPC_VAR;
+		case OP_ADD:	return OPC_ADD;
+		case OP_SUB:	return is_prefix ? OPC_RSUB : OPC_SUB;
+		case OP_MULT:	return OPC_MULT;
+		case OP_DIV:	return is_prefix ? OPC_RDIV : OPC_DIV;
+		case OP_POW:	return is_prefix ? OPC_RPOW : OPC_POW;
+		case OP_MOD:	return is_prefix ? OPC_RMOD : OPC_MOD;
+		case OP_SHL:	return is_prefix ? OPC_RSHL : OPC_SHL;
+		case OP_SHR:	return is_prefix ? OPC_RSHR : OPC_SHR;
+		case OP_AND:	return OPC_AND;
+		case OP_OR:		return OPC_OR;
+		case OP_XOR:	return OPC_XOR;
+		case OP_MIN:	return OPC_MIN;
+		case OP_MAX:	return OPC_MAX;
+		case OP_NEG:	return OPC_NEG;
+
+		default: assert(0);
+	}
+}
+
+// An instruction of a program being built, with its constant if it is a push
+struct fold_insn {
+	enum opcode op;
+	int value;
+};
+
+// A value on the stack of fold_code. Its code is the instructions from start
+// to the start of the next value, or to the end for the top value.
+struct fold_value {
+	size_t start;
+	int is_const;		// Computed only from constants
+	int is_leaf;		// A single push, ans or variable, which can not fail
+	int value;			// If is_const
+};
+
+// Remove the constant of a folded identity, keeping the other operand. Both
+// operands are the two top values of stack, and the constant is a single
+// instruction.
+void fold_drop(struct fold_insn *code, size_t *len, struct fold_value *stack,
+			   size_t *top, int drop_top)
+{
+	struct fold_value *below = &stack[*top - 2];
+	struct fold_value *above = &stack[*top - 1];
+
+	if (drop_top) {
+		*len = above->start;
+	}
+	else {
+		memmove(code + below->start, code + above->start,
+				(*len - above->start) * sizeof(*code));
+		(*len)--;
+		above->start = below->start;
+		*below = *above;
+	}
+
+	(*top)--;
+}
+
+// Fold constant subexpressions and identities of the tokens, given in
+// evaluation order, into code, which must hold len instructions. Errors are
+// left for pcalc_exec to report: a constant operation that overflows or
+// divides by zero is not folded, and 0 * x is only folded when x is a leaf.
+// Returns the length of the code. *folded is the number of removed nodes.
+size_t fold_code(struct fold_insn *code, struct fold_value *stack,
+				 struct token *tokens, size_t len, int is_prefix,
+				 size_t *folded)
+{
+	size_t n = 0;
+	size_t top = 0;
+
+	*folded = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		struct token *token = &tokens[is_prefix ? len - 1 - i : i];
+		enum opcode op = op_to_opcode(token->type, is_prefix);
+		struct fold_value *l, *r;
+		int value;
+
+		if (token->type == VALUE || token->type == ANS ||
+			token->type == VAR) {
+			stack[top].start = n;
+			stack[top].is_const = token->type == VALUE;
+			stack[top].is_leaf = 1;
+			stack[top].value = token->value;
+			top++;
+
+			code[n].op = op;
+			code[n].value = token->value;
+			n++;
+			continue;
+		}
+
+		if (token->type == OP_NEG) {
+			struct fold_value *v = &stack[top - 1];
+
+			// A constant is a single push, negated in place
+			if (v->is_const &&
+				pcalc_unop(&value, OP_NEG, v->value) == PCALC_OK) {
+				v->value = value;
+				code[v->start].value = value;
+				(*folded)++;
+			}
+			else {
+				code[n].op = op;
+				n++;
+
+				v->is_const = 0;
+				v->is_leaf = 0;
+			}
+			continue;
+		}
+
+		// In prefix order the left operand is on top
+		l = is_prefix ? &stack[top - 1] : &stack[top - 2];
+		r = is_prefix ? &stack[top - 2] : &stack[top - 1];
+
+		if (l->is_const && r->is_const &&
+			pcalc_binop(&value, token->type, l->value, r->value) == PCALC_OK) {
+			n = stack[top - 2].start;
+		}
+		else if (r->is_const && r->value == 0 &&
+				 (token->type == OP_ADD || token->type == OP_SUB) ||
+				 r->is_const && r->value == 1 &&
+				 (token->type == OP_MULT || token->type == OP_DIV ||
+				  token->type == OP_POW)) {
+			// x + 0, x - 0, x * 1, x / 1 and x ^ 1
+			fold_drop(code, &n, stack, &top, r == &stack[top - 1]);
+			*folded += 2;
+			continue;
+		}
+		else if (l->is_const && l->value == 0 && token->type == OP_ADD ||
+				 l->is_const && l->value == 1 && token->type == OP_MULT) {
+			// 0 + x and 1 * x
+			fold_drop(code, &n, stack, &top, l == &stack[top - 1]);
+			*folded += 2;
+			continue;
+		}
+		else if (token->type == OP_MULT && l->is_leaf && r->is_leaf &&
+				 (l->is_const && l->value == 0 ||
+				  r->is_const && r->value == 0)) {
+			// 0 * x and x * 0
+			value = 0;
+			n = stack[top - 2].start;
+		}
+		else {
+			code[n].op = op;
+			n++;
+
+			top--;
+			stack[top - 1].is_const = 0;
+			stack[top - 1].is_leaf = 0;
+			continue;
+		}
+
+		// The operation was folded to value
+		top--;
+		stack[top - 1].is_const = 1;
+		stack[top - 1].is_leaf = 1;
+		stack[top - 1].value = value;
+
+		code[n].op = OPC_PUSH;
+		code[n].value = value;
+		n++;
+		*folded += 2;
+	}
+
+	return n;
+}
+
+// Build a program from tokens in postfix order, or in prefix order if
+// is_prefix is set. The stack depth is checked here so that pcalc_exec never
+// has to, and variables are resolved to their slots in vars, which may be
+// NULL.
+enum retcode program_emit(struct pcalc_program **progp, char **errp,
+						  struct token *tokens, size_t len, int is_prefix,
+						  const struct pcalc_vars *vars)
+{
+	struct pcalc_program *prog;
+	struct fold_insn *code;
+	struct fold_value *stack;
+	size_t depth = 0;
+	size_t max_depth = 0;
+	size_t const_len = 0;
+	size_t code_len;
+	size_t folded;
+	int uses_ans = 0;
+	size_t slot;
+	int *k;
+
+	for (size_t i = 0; i < len; i++) {
+		struct token *token = &tokens[is_prefix ? len - 1 - i : i];
+
+		switch (token->type) {
+			case VALUE:
+				depth++;
+				break;
+
+			case ANS:
+				uses_ans = 1;
+				depth++;
+				break;
+
+			case VAR:
+				if (vars == NULL ||
+					!pcalc_vars_slot(vars, token->pos, token->value, &slot)) {
+					*errp = token->pos;
+					return PCALC_UNBOUND_VARIABLE;
+				}
+
+				token->value = slot;
+				depth++;
+				break;
+
+			case OP_NEG:
+				if (depth < 1) {
+					if (token->pos)
+						*errp = token->pos;
+					return PCALC_NOT_ENOUGH_VALUES;
+				}
+				break;
+
+			default:
+				if (depth < 2) {
+					if (token->pos)
+						*errp = token->pos;
+					return PCALC_NOT_ENOUGH_VALUES;
+				}
+				depth--;
+				break;
+		}
+
+		if (depth > max_depth)
+			max_depth = depth;
+	}
+
+	if (depth != 1)
+		return PCALC_INVALID_EXPRESSION;
+
+	code = malloc(len * sizeof(*code) + max_depth * sizeof(*stack));
+
+	if (code == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	stack = (struct fold_value *)(code + len);
+	code_len = fold_code(code, stack, tokens, len, is_prefix, &folded);
+
+	// Folding can only make the program shallower
+	depth = max_depth = 0;
+	for (size_t i = 0; i < code_len; i++) {
+		if (code[i].op == OPC_PUSH || code[i].op == OPC_ANS ||
+			code[i].op == OPC_VAR)
+			depth++;
+		else if (code[i].op != OPC_NEG)
+			depth--;
+
+		if (code[i].op == OPC_PUSH || code[i].op == OPC_VAR)
+			const_len++;
+
+		if (depth > max_depth)
+			max_depth = depth;
+	}
+
+	prog = malloc(sizeof(*prog) + const_len * sizeof(int) + code_len);
+
+	if (prog == NULL) {
+		free(code);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	// ans is still required if it was folded away, as before folding
+	prog->code_len = code_len;
+	prog->const_len = const_len;
+	prog->depth = max_depth;
+	prog->uses_ans = uses_ans;
+	prog->folded = folded;
+	prog->vars = vars;
+	prog->consts = (int *)(prog + 1);
+	prog->code = (unsigned char *)(prog->consts + const_len);
+
+	k = prog->consts;
+	for (size_t i = 0; i < code_len; i++) {
+		prog->code[i] = code[i].op;
+
+		if (code[i].op == OPC_PUSH || code[i].op == OPC_VAR)
+			*k++ = code[i].value;
+	}
+
+	PROFILE_COUNT_N(PROF_FOLDED, folded);
+
+	free(code);
+	*progp = prog;
+
+	return PCALC_OK;
+}
+
+// Compile expr into a program that can be evaluated any number of times with
+// pcalc_exec. If an error occurs, *errp will point to the offending part of
+// expr.
+enum retcode pcalc_compile(struct pcalc_program **progp, char **errp,
+						   char *expr, enum notation notation)
+{
+	return pcalc_compilen(progp, errp, expr, strlen(expr), notation, NULL);
+}
+
+// Compile the len characters at expr, see pcalc_compile. The names in expr
+// must be bound in vars, which may be NULL if there are none. The program
+// reads the values of vars each time it is run.
+enum retcode pcalc_compilen(struct pcalc_program **progp, char **errp,
+							char *expr, size_t len, enum notation notation,
+							const struct pcalc_vars *vars)
+{
+	d_array *tokens = da_new(sizeof(struct token), MIN_STACK_SIZE, NULL);
+	char *end = expr + len;
+	enum retcode ret;
+
+	if (tokens == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	switch (notation) {
+		case PREFIX:
+		case POSTFIX:
+			ret = pn_tokenize(tokens, errp, expr, end, 0);
+			break;
+
+		case INFIX:
+			ret = inf_reorder(NULL, tokens, errp, expr, end, 1, 0, NULL);
+			break;
+
+		default:
+			assert(0);
+	}
+
+	if (ret == PCALC_OK)
+		ret = program_emit(progp, errp, da_get_array(tokens),
+						   da_get_size(tokens), notation == PREFIX, vars);
+
+	da_free(&tokens);
+
+	return ret;
+}
+
+// Operator of a binary instruction. *swapped is set if the left operand is
+// the top value.
+enum token_type opcode_to_op(enum opcode op, int *swapped)
+{
+	*swapped = 0;
+
+	switch (op) {
+		case OPC_ADD:	return OP_ADD;
+		case OPC_SUB:	return OP_SUB;
+		case OPC_MULT:	return OP_MULT;
+		case OPC_DIV:	return OP_DIV;
+		case OPC_POW:	return OP_POW;
+		case OPC_MOD:	return OP_MOD;
+		case OPC_SHL:	return OP_SHL;
+		case OPC_SHR:	return OP_SHR;
+		case OPC_AND:	return OP_AND;
+		case OPC_OR:	return OP_OR;
+		case OPC_XOR:	return OP_XOR;
+		case OPC_MIN:	return OP_MIN;
+		case OPC_MAX:	return OP_MAX;
+
+		default:
+			*swapped = 1;
+			break;
+	}
+
+	switch (op) {
+		case OPC_RSUB:	return OP_SUB;
+		case OPC_RDIV:	return OP_DIV;
+		case OPC_RPOW:	return OP_POW;
+		case OPC_RMOD:	return OP_MOD;
+		case OPC_RSHL:	return OP_SHL;
+		case OPC_RSHR:	return OP_SHR;
+
+		default: assert(0);
+	}
+}
+
+enum retcode exec_binop(int *result, enum opcode op, int lval, int rval)
+{
+	int swapped;
+	enum token_type type = opcode_to_op(op, &swapped);
+
+	if (swapped)
+		return pcalc_binop(result, type, rval, lval);
+	else
+		return pcalc_binop(result, type, lval, rval);
+}
+
+// Values of the variables of prog indexed by slot, NULL if it has none
+const int *program_vars(const struct pcalc_program *prog)
+{
+	return prog->vars ? pcalc_vars_values(prog->vars) : NULL;
+}
+
+// Evaluate a compiled program. No memory is allocated unless the program
+// needs a deeper stack than EXEC_STACK_SIZE.
+enum retcode pcalc_exec(int *result, const struct pcalc_program *prog,
+						const int *last_ans)
+{
+	int local_stack[EXEC_STACK_SIZE];
+	int *stack = local_stack;
+	const int *k = prog->consts;
+	const int *vars = program_vars(prog);
+	size_t top = 0;
+	enum retcode ret = PCALC_OK;
+
+	if (prog->uses_ans && last_ans == NULL)
+		return PCALC_NO_LAST_ANS;
+
+	if (prog->depth > EXEC_STACK_SIZE) {
+		stack = malloc(prog->depth * sizeof(*stack));
+
+		if (stack == NULL)
+			return PCALC_MEMORY_ALLOC;
+	}
+
+	for (size_t i = 0; i < prog->code_len && ret == PCALC_OK; i++) {
+		switch (prog->code[i]) {
+			case OPC_PUSH:
+				stack[top++] = *k++;
+				break;
+
+			case OPC_ANS:
+				stack[top++] = *last_ans;
+				break;
+
+			case OPC_VAR:
+				stack[top++] = vars[*k++];
+				break;
+
+			case OPC_NEG:
+				ret = pcalc_unop(&stack[top - 1], OP_NEG, stack[top - 1]);
+				break;
+
+			default:
+				top--;
+				ret = exec_binop(&stack[top - 1], prog->code[i],
+								 stack[top - 1], stack[top]);
+				break;
+		}
+	}
+
+	if (ret == PCALC_OK)
+		*result = stack[0];
+
+	if (stack != local_stack)
+		free(stack);
+
+	return ret;
+}
+
+void pcalc_program_free(struct pcalc_program *prog)
+{
+	free(prog);
+}
+
+// Compile the len characters at expr with the variables of vars and run the
+// program once, see pcalc_compilen
+enum retcode pcalc_eval_vars(int *result, char **errp, char *expr, size_t len,
+							 enum notation notation,
+							 const struct pcalc_vars *vars,
+							 const int *last_ans)
+{
+	struct pcalc_program *prog;
+	enum retcode ret = pcalc_compilen(&prog, errp, expr, len, notation, vars);
+
+	if (ret != PCALC_OK)
+		return ret;
+
+	ret = pcalc_exec(result, prog, last_ans);
+	pcalc_program_free(prog);
+
+	return ret;
+}
+
+// Whether prog must be run with a previous answer
+int pcalc_program_uses_ans(const struct pcalc_program *prog)
+{
+	return prog->uses_ans;
+}
+
+// Number of nodes removed from the expression by constant folding
+size_t pcalc_program_folded(const struct pcalc_program *prog)
+{
+	return prog->folded;
+}
+
+// Store the slots of the variables read by prog in slots, once for every time
+// they are read, unless it is NULL. Returns their number.
+size_t pcalc_program_vars(const struct pcalc_program *prog, size_t *slots)
+{
+	const int *k = prog->consts;
+	size_t n = 0;
+
+	for (size_t i = 0; i < prog->code_len; i++) {
+		if (prog->code[i] == OPC_VAR && slots)
+			slots[n] = *k;
+
+		if (prog->code[i] == OPC_VAR)
+			n++;
+
+		if (prog->code[i] == OPC_PUSH || prog->code[i] == OPC_VAR)
+			k++;
+	}
+
+	return n;
+}
@@ -0,0 +1,65 @@
+//
+//  program.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stddef.h>
+
+#include "pcalc.h"
+#include "token.h"
+
+// Depth up to which pcalc_exec keeps its value stack in automatic storage
+#define EXEC_STACK_SIZE 256
+
+// Programs are postfix code for a value stack machine. Every OPC_PUSH takes
+// the next value of the constant pool, and every OPC_VAR the slot of its
+// variable. The values are stored in compiled files, see image.c, so changing
+// them requires a new IMAGE_VERSION.
+enum opcode {
+	OPC_PUSH,
+	OPC_ANS,
+	OPC_VAR,
+	OPC_ADD,
+	OPC_SUB,
+	OPC_MULT,
+	OPC_DIV,
+	OPC_POW,
+	OPC_MOD,
+	OPC_SHL,
+	OPC_SHR,
+	OPC_AND,
+	OPC_OR,
+	OPC_XOR,
+	OPC_MIN,
+	OPC_MAX,
+	OPC_RSUB,	// Operands swapped, as produced by prefix notation
+	OPC_RDIV,
+	OPC_RPOW,
+	OPC_RMOD,
+	OPC_RSHL,
+	OPC_RSHR,
+	OPC_NEG		// Negates the top value, the only unary instruction
+};
+
+// Allocated as a single block and never modified after pcalc_compile
+struct pcalc_program {
+	size_t code_len;
+	size_t const_len;
+	size_t depth;		// Maximum value stack depth
+	int uses_ans;
+	size_t folded;		// Nodes removed by fold_code
+	const struct pcalc_vars *vars;	// Of OPC_VAR, outlives the program
+	int *consts;
+	unsigned char *code;
+};
+
+enum token_type opcode_to_op(enum opcode op, int *swapped);
+const int *program_vars(const struct pcalc_program *prog);
+
+#endif
@@ -0,0 +1,127 @@
+//
+//  scan.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdint.h>
+
+#include "token.h"
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+struct scanner {
+	char *(*skip_space)(char *p, char *end);
+	char *(*find_space)(char *p, char *end);
+};
+
+char *scalar_skip_space(char *p, char *end)
+{
+	while (p < end && IS_SPACE(*p))
+		p++;
+	return p;
+}
+
+char *scalar_find_space(char *p, char *end)
+{
+	while (p < end && !IS_SPACE(*p))
+		p++;
+	return p;
+}
+
+struct scanner scan_scalar = {
+	scalar_skip_space,
+	scalar_find_space
+};
+
+#ifdef SCAN_X86
+
+// Define the two scanners for blocks of WIDTH characters. MASK(p) gives a
+// bit for each space character in the block at p. Blocks are only loaded
+// when they lie entirely within the range, the remainder is left to the
+// scalar code.
+#define DEFINE_SCANNERS(NAME, WIDTH, MASK, ATTR)							\
+ATTR char *NAME##_skip_space(char *p, char *end)							\
+{																			\
+	for (; end - p >= WIDTH; p += WIDTH) {									\
+		uint32_t m = ~MASK(p) & (uint32_t)((1ull << WIDTH) - 1);			\
+		if (m)																\
+			return p + __builtin_ctz(m);									\
+	}																		\
+	return scalar_skip_space(p, end);										\
+}																			\
+																			\
+ATTR char *NAME##_find_space(char *p, char *end)							\
+{																			\
+	for (; end - p >= WIDTH; p += WIDTH) {									\
+		uint32_t m = MASK(p);												\
+		if (m)																\
+			return p + __builtin_ctz(m);									\
+	}																		\
+	return scalar_find_space(p, end);										\
+}																			\
+																			\
+struct scanner scan_##NAME = {												\
+	NAME##_skip_space,														\
+	NAME##_find_space														\
+};
+
+// A character c is a space if c == ' ' or if c - '\t' <= '\r' - '\t' when
+// compared unsigned. The unsigned comparison is done as min(x, 4) == x.
+uint32_t sse2_mask(const char *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	__m128i t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+	__m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+	__m128i sp = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+
+	return _mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+__attribute__((target("avx2"))) uint32_t avx2_mask(const char *p)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i *)p);
+	__m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+	__m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)),
+									t);
+	__m256i sp = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+
+	return _mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+// SSE2 is part of x86-64 and needs no runtime check
+DEFINE_SCANNERS(sse2, 16, sse2_mask, )
+DEFINE_SCANNERS(avx2, 32, avx2_mask, __attribute__((target("avx2"))))
+
+struct scanner *scanner = &scan_sse2;
+
+// Runs before main, so scanner is never written while other threads read it
+__attribute__((constructor)) void scan_init(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		scanner = &scan_avx2;
+}
+
+#else
+
+struct scanner *scanner = &scan_scalar;
+
+#endif
+
+char *scan_skip_space_wide(char *p, char *end)
+{
+	return scanner->skip_space(p, end);
+}
+
+char *scan_find_space_wide(char *p, char *end)
+{
+	return scanner->find_space(p, end);
+}
@@ -0,0 +1,44 @@
+//
+//  scan.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "token.h"
+
+// Whitespace scanning over [begin, end) using the widest vector instructions
+// the CPU supports. Whitespace is the same set as IS_SPACE in token.h.
+
+// Tokens are mostly short and separated by single spaces, so this many
+// characters are checked inline before the vector code is called
+#define SCAN_LEAD 8
+
+char *scan_skip_space_wide(char *p, char *end);
+char *scan_find_space_wide(char *p, char *end);
+
+// First non-space character at or after p, or end
+static inline char *scan_skip_space(char *p, char *end)
+{
+	for (int i = 0; i < SCAN_LEAD; i++, p++)
+		if (p == end || !IS_SPACE(*p))
+			return p;
+
+	return scan_skip_space_wide(p, end);
+}
+
+// First space character at or after p, or end
+static inline char *scan_find_space(char *p, char *end)
+{
+	for (int i = 0; i < SCAN_LEAD; i++, p++)
+		if (p == end || IS_SPACE(*p))
+			return p;
+
+	return scan_find_space_wide(p, end);
+}
+
+#endif
@@ -0,0 +1,1043 @@
+//
+// server.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "pcalc.h"
+#include "settings.h"
+#include "batch.h"
+#include "server.h"
+#include "pool.h"
+#include "num.h"
+#include "cache.h"
+
+#define SERVER_MAX_EVENTS 64
+
+struct conn {
+	int fd;
+
+	char *in;
+	size_t in_len;
+	size_t in_size;
+	size_t complete;	// Bytes of whole requests handed to the workers
+
+	char *out;
+	size_t out_pos;		// Bytes already sent
+	size_t out_len;
+	size_t out_size;
+
+	int eof;			// The client will send no more requests
+	int failed;			// Out of memory or the connection broke
+	int ready;			// In the current round
+	unsigned events;	// Registered with epoll
+};
+
+struct server {
+	struct settings *s;
+	int epfd;
+	int listen_fd;
+	struct pool *pool;			// NULL when single threaded
+	unsigned nworkers;
+	struct pcalc_ctx **ctx;		// One per worker
+	struct cache *cache;		// Shared by the workers, NULL if disabled
+
+	struct conn **ready;		// Connections with requests this round
+	size_t ready_num;
+	size_t ready_size;
+};
+
+static volatile sig_atomic_t server_stop;
+
+void server_signal(int sig)
+{
+	(void)sig;
+	server_stop = 1;
+}
+
+// Fill addr with the socket path, which must fit
+int socket_addr(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "%s: Socket path too long\n", path);
+		return 0;
+	}
+
+	strcpy(addr->sun_path, path);
+
+	return 1;
+}
+
+int notation_from_letter(char c, enum notation *notation)
+{
+	switch (c) {
+		case 'i':	*notation = INFIX;		return 1;
+		case 'p':	*notation = PREFIX;		return 1;
+		case 'r':	*notation = POSTFIX;	return 1;
+		default:	return 0;
+	}
+}
+
+char notation_letter(enum notation notation)
+{
+	switch (notation) {
+		case INFIX:		return 'i';
+		case PREFIX:	return 'p';
+		case POSTFIX:	return 'r';
+		default:		assert(0);
+	}
+}
+
+// Make room for at least n more reply bytes
+char *conn_reserve(struct conn *c, size_t n)
+{
+	if (c->out_len + n > c->out_size) {
+		size_t size = c->out_size ? c->out_size * 2 : BATCH_CHUNK_SIZE;
+		char *out;
+
+		while (size < c->out_len + n)
+			size *= 2;
+
+		out = realloc(c->out, size);
+
+		if (out == NULL)
+			return NULL;
+
+		c->out = out;
+		c->out_size = size;
+	}
+
+	return c->out + c->out_len;
+}
+
+enum retcode conn_error(struct conn *c, enum retcode ret, size_t col)
+{
+	const char *msg = retcode_str(ret);
+	char *p = conn_reserve(c, strlen(msg) + 64);
+
+	if (p == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	c->out_len += sprintf(p, "error %d %zu %s\n", (int)ret, col, msg);
+
+	return PCALC_OK;
+}
+
+// Reply "ok " and the len bytes at str, which are prefixed with 0x in hex
+enum retcode conn_ok(struct conn *c, struct settings *s, const char *str,
+					 size_t len)
+{
+	char *p = conn_reserve(c, len + 6);
+
+	if (p == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	memcpy(p, "ok ", 3);
+	p += 3;
+
+	// Same format as format_hex, the sign follows the 0x
+	if (s->arith != ARITH_INT && s->output == BASE_HEX) {
+		*p++ = '0';
+		*p++ = 'x';
+	}
+
+	memcpy(p, str, len);
+	p += len;
+	*p++ = '\n';
+	c->out_len = p - c->out;
+
+	return PCALC_OK;
+}
+
+// Evaluate one request line of len characters and append its reply
+enum retcode server_request(struct settings *s, struct pcalc_ctx *ctx,
+							struct cache *cache, struct conn *c, char *line,
+							size_t len)
+{
+	enum notation notation;
+	char *expr = line + 2;
+	char *errp = NULL;
+	enum retcode ret;
+
+	if (len < 2 || line[1] != ' ' || !notation_from_letter(line[0], &notation))
+		return conn_error(c, PCALC_UKNOWN_TOKEN, 0);
+
+	len -= 2;
+
+	if (s->arith != ARITH_INT) {
+		union num result;
+		char *str;
+
+		ret = num_evaln(s->arith, &result, &errp, expr, len, notation, NULL);
+
+		if (ret == PCALC_OK) {
+			str = num_to_str(s->arith, &result,
+							 s->output == BASE_HEX ? 16 : 10);
+			num_free(s->arith, &result);
+
+			if (str == NULL)
+				return PCALC_MEMORY_ALLOC;
+
+			ret = conn_ok(c, s, str, strlen(str));
+			free(str);
+
+			return ret;
+		}
+	}
+	else {
+		int result;
+
+		ret = cache_eval(cache, ctx, &result, &errp, expr, len, notation,
+						 NULL);
+
+		if (ret == PCALC_OK && s->output == BASE_HEX && result == INT_MIN)
+			ret = PCALC_OUT_OF_BOUNDS;
+
+		if (ret == PCALC_OK) {
+			char buf[32];
+			size_t n;
+
+			if (s->output == BASE_HEX)
+				n = format_hex(buf, result);
+			else
+				n = format_decimal(buf, result);
+
+			return conn_ok(c, s, buf, n);
+		}
+	}
+
+	return conn_error(c, ret, errp && errp >= expr ? errp - expr + 1 : 0);
+}
+
+// Answer the complete requests of a connection
+void server_job_run(void *arg, size_t index, unsigned worker)
+{
+	struct server *srv = arg;
+	struct conn *c = srv->ready[index];
+	char *line = c->in;
+	char *end = c->in + c->complete;
+
+	while (line < end) {
+		char *nl = memchr(line, '\n', end - line);
+
+		if (nl == NULL)
+			nl = end;		// Last request before the client closed
+
+		if (server_request(srv->s, srv->ctx[worker], srv->cache, c, line,
+						   nl - line) != PCALC_OK) {
+			c->failed = 1;
+			return;
+		}
+
+		line = nl + 1;
+	}
+}
+
+void conn_close(struct server *srv, struct conn *c)
+{
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+// Read what the client has sent, at most SERVER_READ_SIZE bytes. A request
+// longer than SERVER_LINE_MAX is dropped and ends the connection, so that a
+// client can't make the server buffer without bound.
+void conn_read(struct conn *c)
+{
+	ssize_t n;
+	size_t complete;
+
+	if (c->in_size - c->in_len < SERVER_READ_SIZE) {
+		size_t size = c->in_size ? c->in_size * 2 : 2 * SERVER_READ_SIZE;
+		char *in = realloc(c->in, size);
+
+		if (in == NULL) {
+			c->failed = 1;
+			return;
+		}
+
+		c->in = in;
+		c->in_size = size;
+	}
+
+	n = read(c->fd, c->in + c->in_len, SERVER_READ_SIZE);
+
+	if (n > 0) {
+		c->in_len += n;
+		complete = complete_lines(c->in, c->in_len);
+
+		if (c->in_len - complete > SERVER_LINE_MAX) {
+			c->in_len = complete;
+			c->eof = 1;
+		}
+	}
+	else if (n == 0) {
+		c->eof = 1;
+	}
+	else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		c->failed = 1;
+}
+
+// Send as much of the pending replies as the socket takes
+void conn_write(struct conn *c)
+{
+	while (c->out_pos < c->out_len) {
+		ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+						 MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			else if (errno != EAGAIN && errno != EWOULDBLOCK)
+				c->failed = 1;
+			break;
+		}
+
+		c->out_pos += n;
+	}
+
+	if (c->out_pos == c->out_len)
+		c->out_pos = c->out_len = 0;
+}
+
+// Wait for what the connection needs next, or close it if it is done
+void conn_update(struct server *srv, struct conn *c)
+{
+	size_t pending = c->out_len - c->out_pos;
+	unsigned events = 0;
+
+	if (c->failed || c->eof && pending == 0) {
+		conn_close(srv, c);
+		return;
+	}
+
+	if (!c->eof && pending < SERVER_OUT_LIMIT)
+		events |= EPOLLIN;
+	if (pending > 0)
+		events |= EPOLLOUT;
+
+	if (events != c->events) {
+		struct epoll_event ev;
+
+		ev.events = events;
+		ev.data.ptr = c;
+
+		if (epoll_ctl(srv->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+			conn_close(srv, c);
+			return;
+		}
+
+		c->events = events;
+	}
+}
+
+void server_accept(struct server *srv)
+{
+	for (;;) {
+		struct epoll_event ev;
+		struct conn *c;
+		int fd = accept(srv->listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			else if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("Accepting connection failed");
+			return;
+		}
+
+		c = calloc(1, sizeof(*c));
+
+		if (c == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+			free(c);
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->events = EPOLLIN;
+		ev.events = c->events;
+		ev.data.ptr = c;
+
+		if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			free(c);
+			close(fd);
+		}
+	}
+}
+
+// Add c to the current round if it has requests to answer
+enum retcode server_add_ready(struct server *srv, struct conn *c)
+{
+	if (c->ready || c->failed)
+		return PCALC_OK;
+
+	c->complete = c->eof ? c->in_len : complete_lines(c->in, c->in_len);
+
+	if (c->complete == 0)
+		return PCALC_OK;
+
+	if (srv->ready_num == srv->ready_size) {
+		size_t size = srv->ready_size ? srv->ready_size * 2 : 64;
+		struct conn **ready = realloc(srv->ready, size * sizeof(*ready));
+
+		if (ready == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		srv->ready = ready;
+		srv->ready_size = size;
+	}
+
+	c->ready = 1;
+	srv->ready[srv->ready_num++] = c;
+
+	return PCALC_OK;
+}
+
+// Answer the requests of all ready connections, one job per connection
+enum retcode server_round(struct server *srv)
+{
+	if (srv->ready_num == 0)
+		return PCALC_OK;
+
+	if (srv->pool && srv->ready_num > 1) {
+		if (!pool_start(srv->pool, srv->ready_num, server_job_run, srv))
+			return PCALC_MEMORY_ALLOC;
+
+		pool_wait(srv->pool);
+	}
+	else {
+		for (size_t i = 0; i < srv->ready_num; i++)
+			server_job_run(srv, i, 0);
+	}
+
+	for (size_t i = 0; i < srv->ready_num; i++) {
+		struct conn *c = srv->ready[i];
+
+		c->in_len -= c->complete;
+		memmove(c->in, c->in + c->complete, c->in_len);
+		c->complete = 0;
+		c->ready = 0;
+
+		conn_write(c);
+		conn_update(srv, c);
+	}
+
+	srv->ready_num = 0;
+
+	return PCALC_OK;
+}
+
+// Bind the listening socket. A socket file left behind by a server that is no
+// longer running is replaced.
+int server_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (!socket_addr(&addr, path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		perror("Creating socket failed");
+		return -1;
+	}
+
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			fprintf(stderr, "%s: A server is already running\n", path);
+			close(fd);
+			return -1;
+		}
+
+		unlink(path);
+	}
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(fd, SOMAXCONN) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+enum retcode server_init(struct server *srv, struct settings *s)
+{
+	memset(srv, 0, sizeof(*srv));
+	srv->s = s;
+	srv->epfd = -1;
+	srv->listen_fd = -1;
+	srv->nworkers = s->jobs > 1 ? s->jobs : 1;
+	srv->ctx = calloc(srv->nworkers, sizeof(*srv->ctx));
+
+	if (srv->ctx == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	for (unsigned i = 0; i < srv->nworkers; i++)
+		if ((srv->ctx[i] = pcalc_ctx_new()) == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+	if (srv->nworkers > 1 && (srv->pool = pool_new(srv->nworkers)) == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (s->cache > 0 && (srv->cache = cache_new(s->cache)) == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	return PCALC_OK;
+}
+
+// Serve requests on the socket at path until interrupted. Settings are only
+// read once, when the server starts. With s->jobs > 1 the requests of
+// different connections are evaluated on that many threads.
+int server_run(struct settings *s, const char *path)
+{
+	struct server srv;
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	struct epoll_event ev;
+	struct sigaction sa;
+	int status = EXIT_SUCCESS;
+	enum retcode ret = server_init(&srv, s);
+
+	if (ret == PCALC_OK) {
+		srv.listen_fd = server_listen(path);
+		srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+
+		if (srv.listen_fd < 0 || srv.epfd < 0 ||
+			epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.listen_fd, &ev) < 0) {
+			if (srv.listen_fd >= 0)
+				perror("Starting event loop failed");
+			status = EXIT_FAILURE;
+		}
+	}
+
+	// Interrupt epoll_wait on termination so that the socket is removed
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = server_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (ret == PCALC_OK && status == EXIT_SUCCESS && !server_stop) {
+		int n = epoll_wait(srv.epfd, events, SERVER_MAX_EVENTS, -1);
+
+		if (n < 0) {
+			if (errno != EINTR) {
+				perror("Waiting for events failed");
+				status = EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		for (int i = 0; i < n && ret == PCALC_OK; i++) {
+			struct conn *c = events[i].data.ptr;
+
+			if (c == NULL) {
+				server_accept(&srv);
+				continue;
+			}
+
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) &&
+				c->events & EPOLLIN)
+				conn_read(c);
+
+			if (events[i].events & EPOLLOUT)
+				conn_write(c);
+
+			ret = server_add_ready(&srv, c);
+
+			if (!c->ready)
+				conn_update(&srv, c);
+		}
+
+		if (ret == PCALC_OK)
+			ret = server_round(&srv);
+	}
+
+	if (ret != PCALC_OK) {
+		fprintf(stderr, "Error: %s\n", retcode_str(ret));
+		status = EXIT_FAILURE;
+	}
+
+	if (srv.listen_fd >= 0) {
+		close(srv.listen_fd);
+		unlink(path);
+	}
+	if (srv.epfd >= 0)
+		close(srv.epfd);
+
+	pool_free(srv.pool);
+	free(srv.ready);
+
+	if (srv.cache) {
+		if (s->stats) {
+			struct cache_stats stats;
+
+			cache_get_stats(srv.cache, &stats);
+			cache_print_stats(&stats, stderr);
+		}
+
+		cache_free(srv.cache);
+	}
+
+	if (srv.ctx) {
+		for (unsigned i = 0; i < srv.nworkers; i++)
+			pcalc_ctx_free(srv.ctx[i]);
+		free(srv.ctx);
+	}
+
+	return status;
+}
+
+int client_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!socket_addr(&addr, path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		perror("Creating socket failed");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Split a reply line of len characters. *value and *value_len are the result
+// on success, *col the error column otherwise. Returns 0 if the line is not
+// a reply.
+int parse_reply(char *line, size_t len, enum retcode *ret, char **value,
+				size_t *value_len, size_t *col)
+{
+	if (len >= 3 && memcmp(line, "ok ", 3) == 0) {
+		*ret = PCALC_OK;
+		*value = line + 3;
+		*value_len = len - 3;
+		return 1;
+	}
+	else if (len >= 6 && memcmp(line, "error ", 6) == 0) {
+		char *p = line + 6;
+		long code = strtol(p, &p, 10);
+
+		if (*p != ' ' || code <= PCALC_OK || code > PCALC_INVALID_IMAGE)
+			return 0;
+
+		*ret = code;
+		*col = strtoul(p, NULL, 10);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Send all len bytes at buf
+int send_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno != EINTR)
+			return 0;
+		else if (n > 0) {
+			buf += n;
+			len -= n;
+		}
+	}
+
+	return 1;
+}
+
+// Growable byte buffer of the clients
+struct client_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+char *client_buf_reserve(struct client_buf *b, size_t n)
+{
+	if (b->len + n > b->size) {
+		size_t size = b->size ? b->size * 2 : BATCH_CHUNK_SIZE;
+		char *data;
+
+		while (size < b->len + n)
+			size *= 2;
+
+		data = realloc(b->data, size);
+
+		if (data == NULL)
+			return NULL;
+
+		b->data = data;
+		b->size = size;
+	}
+
+	return b->data + b->len;
+}
+
+// Read from fd into b until a line is complete. Returns the line break, or
+// NULL if the input ended first.
+char *client_read_line(int fd, struct client_buf *b)
+{
+	for (;;) {
+		char *p = client_buf_reserve(b, 256);
+		char *nl;
+		ssize_t n;
+
+		if (p == NULL)
+			return NULL;
+
+		n = read(fd, p, b->size - b->len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			return NULL;
+
+		b->len += n;
+
+		if ((nl = memchr(p, '\n', n)) != NULL)
+			return nl;
+	}
+}
+
+// Evaluate expr on the server at path. On success *result is the formatted
+// value, which must be freed, otherwise *errp points to the error in expr if
+// it is known. Returns 0 if the server could not be asked.
+int client_eval(const char *path, enum notation notation, char *expr,
+				enum retcode *ret, char **result, char **errp)
+{
+	size_t len = strlen(expr);
+	struct client_buf buf = {0};
+	char *p = client_buf_reserve(&buf, len + 3);
+	char *nl = NULL;
+	char *value;
+	size_t value_len;
+	size_t col = 0;
+	int ok = 0;
+	int fd = client_connect(path);
+
+	*result = NULL;
+	*errp = NULL;
+
+	if (fd < 0) {
+		free(buf.data);
+		return 0;
+	}
+
+	if (p) {
+		// A request is a single line
+		*p++ = notation_letter(notation);
+		*p++ = ' ';
+		for (size_t i = 0; i < len; i++)
+			*p++ = expr[i] == '\n' ? ' ' : expr[i];
+		*p++ = '\n';
+
+		if (send_all(fd, buf.data, len + 3) && shutdown(fd, SHUT_WR) == 0)
+			nl = client_read_line(fd, &buf);
+	}
+
+	if (nl && parse_reply(buf.data, nl - buf.data, ret, &value, &value_len,
+						  &col)) {
+		if (*ret != PCALC_OK) {
+			ok = 1;
+
+			if (col > 0 && col <= len + 1)
+				*errp = expr + col - 1;
+		}
+		else if ((*result = malloc(value_len + 1)) != NULL) {
+			ok = 1;
+			memcpy(*result, value, value_len);
+			(*result)[value_len] = '\0';
+		}
+	}
+
+	if (!ok)
+		fprintf(stderr, "%s: No valid reply from server\n", path);
+
+	close(fd);
+	free(buf.data);
+
+	return ok;
+}
+
+// Turn the complete lines of input, or all of it at the end of the input,
+// into requests. Blank lines are not sent but recorded in kinds.
+enum retcode client_queue(struct settings *s, struct client_buf *in,
+						  struct client_buf *req, struct client_buf *kinds,
+						  int in_eof)
+{
+	char *start = in->data;
+	char *end = in->data + (in_eof ? in->len : complete_lines(in->data,
+															  in->len));
+
+	while (start < end) {
+		char *nl = memchr(start, '\n', end - start);
+		size_t len;
+		char *p;
+
+		if (nl == NULL)
+			nl = end;
+
+		len = nl - start;
+
+		if ((p = client_buf_reserve(kinds, 1)) == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		*p = !is_blank(start, len);
+
+		if (*p) {
+			if ((p = client_buf_reserve(req, len + 3)) == NULL)
+				return PCALC_MEMORY_ALLOC;
+
+			*p++ = notation_letter(s->notation);
+			*p++ = ' ';
+			memcpy(p, start, len);
+			p[len] = '\n';
+			req->len += len + 3;
+		}
+
+		kinds->len++;
+		start = nl < end ? nl + 1 : end;
+	}
+
+	in->len -= start - in->data;
+	memmove(in->data, start, in->len);
+
+	return PCALC_OK;
+}
+
+// Batch mode through the server at path, with the same input and output as
+// batch_run. Requests are sent while earlier replies are still being read.
+int client_batch(struct settings *s, const char *path, int fd, FILE *out,
+				 FILE *err)
+{
+	struct client_buf in = {0};		// Input not yet split into lines
+	struct client_buf req = {0};	// Requests not yet sent
+	struct client_buf rep = {0};	// Replies not yet complete
+	struct client_buf kinds = {0};	// 1 for a request, 0 for a blank line
+	size_t req_pos = 0;
+	size_t kind_pos = 0;
+	size_t line = 0;
+	size_t errors = 0;
+	int in_eof = 0;
+	int shut = 0;
+	int status = EXIT_SUCCESS;
+	enum retcode ret = PCALC_OK;
+	int sock = client_connect(path);
+
+	// A blocking send could wait for the server to read while the server
+	// waits for its replies to be read
+	if (sock < 0 || fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+		if (sock >= 0)
+			close(sock);
+		return EXIT_FAILURE;
+	}
+
+	while (ret == PCALC_OK && status == EXIT_SUCCESS &&
+		   !(in_eof && kind_pos == kinds.len)) {
+		struct pollfd fds[2];
+		char *p;
+
+		// Blank lines are answered without asking the server
+		while (kind_pos < kinds.len && kinds.data[kind_pos] == 0) {
+			fputc('\n', out);
+			kind_pos++;
+			line++;
+		}
+
+		if (in_eof && kind_pos == kinds.len)
+			break;
+
+		if (in_eof && req_pos == req.len && !shut) {
+			shutdown(sock, SHUT_WR);
+			shut = 1;
+		}
+
+		fds[0].fd = !in_eof && req.len - req_pos < SERVER_OUT_LIMIT ? fd : -1;
+		fds[0].events = POLLIN;
+		fds[1].fd = sock;
+		fds[1].events = POLLIN | (req_pos < req.len ? POLLOUT : 0);
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno != EINTR) {
+				perror("Waiting for input failed");
+				status = EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		if (fds[0].revents) {
+			ssize_t n = -1;
+
+			if ((p = client_buf_reserve(&in, SERVER_READ_SIZE)) != NULL)
+				n = read(fd, p, SERVER_READ_SIZE);
+
+			if (p == NULL) {
+				ret = PCALC_MEMORY_ALLOC;
+				continue;
+			}
+			else if (n < 0 && errno != EINTR) {
+				perror("Reading input failed");
+				status = EXIT_FAILURE;
+				continue;
+			}
+			else if (n == 0) {
+				in_eof = 1;
+			}
+			else if (n > 0) {
+				in.len += n;
+			}
+
+			ret = client_queue(s, &in, &req, &kinds, in_eof);
+		}
+
+		if (fds[1].revents & POLLOUT) {
+			ssize_t n = send(sock, req.data + req_pos, req.len - req_pos,
+							 MSG_NOSIGNAL);
+
+			if (n < 0 && errno != EINTR && errno != EAGAIN) {
+				perror(path);
+				status = EXIT_FAILURE;
+				continue;
+			}
+			else if (n > 0) {
+				req_pos += n;
+			}
+
+			if (req_pos == req.len)
+				req_pos = req.len = 0;
+		}
+
+		if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			char *start, *end;
+			ssize_t n;
+
+			if ((p = client_buf_reserve(&rep, SERVER_READ_SIZE)) == NULL) {
+				ret = PCALC_MEMORY_ALLOC;
+				continue;
+			}
+
+			n = read(sock, p, SERVER_READ_SIZE);
+
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			else if (n <= 0) {
+				fprintf(stderr, "%s: Server closed the connection\n", path);
+				status = EXIT_FAILURE;
+				continue;
+			}
+
+			rep.len += n;
+			start = rep.data;
+			end = rep.data + complete_lines(rep.data, rep.len);
+
+			while (start < end) {
+				char *nl = memchr(start, '\n', end - start);
+				enum retcode reply;
+				char *value;
+				size_t value_len;
+				size_t col = 0;
+
+				while (kind_pos < kinds.len && kinds.data[kind_pos] == 0) {
+					fputc('\n', out);
+					kind_pos++;
+					line++;
+				}
+
+				if (kind_pos == kinds.len ||
+					!parse_reply(start, nl - start, &reply, &value, &value_len,
+								 &col)) {
+					fprintf(stderr, "%s: No valid reply from server\n", path);
+					status = EXIT_FAILURE;
+					break;
+				}
+
+				kind_pos++;
+				line++;
+
+				if (reply == PCALC_OK) {
+					fwrite(value, 1, value_len, out);
+				}
+				else if (col) {
+					fprintf(err, "%zu:%zu: %s\n", line, col,
+							retcode_str(reply));
+					errors++;
+				}
+				else {
+					fprintf(err, "%zu: %s\n", line, retcode_str(reply));
+					errors++;
+				}
+
+				fputc('\n', out);
+				start = nl + 1;
+			}
+
+			rep.len -= start - rep.data;
+			memmove(rep.data, start, rep.len);
+		}
+
+		// Keep the bookkeeping of answered lines from growing
+		if (kind_pos == kinds.len)
+			kind_pos = kinds.len = 0;
+	}
+
+	if (ret != PCALC_OK) {
+		fprintf(err, "Error: %s\n", retcode_str(ret));
+		status = EXIT_FAILURE;
+	}
+
+	fflush(out);
+	close(sock);
+	free(in.data);
+	free(req.data);
+	free(rep.data);
+	free(kinds.data);
+
+	if (errors > 0)
+		status = EXIT_FAILURE;
+
+	return status;
+}
@@ -0,0 +1,44 @@
+//
+// server.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+
+#include "settings.h"
+
+// Evaluation server on a Unix domain socket
+//
+// Requests and replies are lines. A request is a notation letter, i, p or r as
+// on the command line, a space and the expression. Every request is answered
+// in order by one of
+//
+//     ok <result>
+//     error <retcode> <column> <message>
+//
+// where the column counts from one in the expression and is zero if unknown.
+// Any number of requests may be sent before reading the replies.
+
+// Most bytes read from a connection at a time
+#define SERVER_READ_SIZE (1 << 16)
+
+// A connection is not read from while it has this many reply bytes unsent
+#define SERVER_OUT_LIMIT (1 << 20)
+
+// Longest request. A connection sending a longer one is closed after the
+// requests before it are answered.
+#define SERVER_LINE_MAX (1 << 20)
+
+int server_run(struct settings *s, const char *path);
+int client_eval(const char *path, enum notation notation, char *expr,
+				enum retcode *ret, char **result, char **errp);
+int client_batch(struct settings *s, const char *path, int fd, FILE *out,
+				 FILE *err);
+
+#endif
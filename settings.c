@@ -45,6 +45,21 @@ void settings_default(struct settings *s)
 {
 	s->notation = INFIX;
 	s->output = BASE_DECIMAL;
+	s->arith = ARITH_INT;
+	s->batch = 0;
+	s->stats = 0;
+	s->profile = 0;
+	s->server = NULL;
+	s->client = NULL;
+	s->cache = 0;
+	s->stream = 0;
+	s->column = NULL;
+	s->sheet = NULL;
+	s->compile = NULL;
+	s->load = NULL;
+	s->jobs = 1;
+	s->input = NULL;
+	s->vars = NULL;
 }
 
 enum retcode read_notation(struct settings *s, char *arg)
@@ -73,6 +88,21 @@ enum retcode read_output(struct settings *s, char *arg)
 	return PCALC_OK;
 }
 
+// int64 is matched first since sstrcmp only compares a prefix
+enum retcode read_arith(struct settings *s, char *arg)
+{
+	if (sstrcmp(arg, "int64") == 0)
+		s->arith = ARITH_INT64;
+	else if (sstrcmp(arg, "int") == 0)
+		s->arith = ARITH_INT;
+	else if (sstrcmp(arg, "bignum") == 0)
+		s->arith = ARITH_BIG;
+	else
+		return PCALC_INVALID_EXPRESSION;
+
+	return PCALC_OK;
+}
+
 enum retcode parse_line(struct settings *s, char *line)
 {
 	struct read_cmd {
@@ -81,7 +111,8 @@ enum retcode parse_line(struct settings *s, char *line)
 	};
 	struct read_cmd cmds[] = {
 		{"notation", read_notation},
-		{"output", read_output}
+		{"output", read_output},
+		{"arithmetic", read_arith}
 	};
 	int error = 0;
 	size_t i;
@@ -164,6 +195,7 @@ void write_settings(struct settings *s, FILE *stream)
 {
 	char *not_str = "";
 	char *output_str = "";
+	char *arith_str = "";
 
 	switch (s->notation) {
 		case INFIX:   not_str = "infix";	break;
@@ -176,7 +208,14 @@ void write_settings(struct settings *s, FILE *stream)
 		case BASE_HEX:		output_str = "hex";		break;
 	}
 
+	switch (s->arith) {
+		case ARITH_INT:		arith_str = "int";		break;
+		case ARITH_INT64:	arith_str = "int64";	break;
+		case ARITH_BIG:		arith_str = "bignum";	break;
+	}
+
 	fprintf(stream, "notation %s\n"
-					"output %s\n",
-					not_str, output_str);
+					"output %s\n"
+					"arithmetic %s\n",
+					not_str, output_str, arith_str);
 }
@@ -13,12 +13,6 @@
 
 #define PCALC_CONFIG ".pcalc-rc"
 
-enum notation {
-	PREFIX,
-	POSTFIX,
-	INFIX
-};
-
 enum base {
 	BASE_DECIMAL,
 	BASE_HEX
@@ -27,6 +21,23 @@ enum base {
 struct settings {
 	enum notation notation;
 	enum base output;
+	enum arith arith;
+
+	// Command line only
+	int batch;
+	int stats;
+	int profile;		// Print the profiling counters before exiting
+	char *server;		// Serve requests on this socket
+	char *client;		// Evaluate through the server on this socket
+	size_t cache;		// Result cache entries, 0 for no cache
+	int stream;			// Evaluate one postfix expression from the input
+	char *column;		// Values of ans to run the expression over, or "-"
+	char *sheet;		// Formulas to compute, see sheet.h
+	char *compile;		// Write the input compiled to this file, see image.c
+	char *load;			// Evaluate the compiled expressions of this file
+	unsigned jobs;		// Worker threads in batch mode
+	char *input;		// Batch input file, NULL for standard input
+	struct pcalc_vars *vars;	// Bound with --var and --vars, NULL if none
 };
 
 void read_settings(struct settings *settings);
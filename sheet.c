@@ -0,0 +1,725 @@
+//
+// sheet.c
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include "pcalc_prefix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "scan.h"
+#include "settings.h"
+#include "batch.h"
+#include "pool.h"
+#include "sheet.h"
+
+// Every name of a sheet is a node, bound to the slot of the same index in the
+// variables of the sheet, which hold the results of the formulas. A name that
+// is used before it is defined is a node without a formula.
+//
+// A node's level is one more than the highest level of the nodes it reads, so
+// the nodes of a level never read each other and are computed in parallel.
+// The levels are found with Kahn's algorithm whenever a formula has been set,
+// and the nodes that are left depend on a cycle. Only dirty nodes are
+// computed, level by level, and a node whose result did not change does not
+// make the nodes reading it dirty.
+
+// Level of the nodes that depend on a cycle, which are never computed
+#define SHEET_CIRCULAR SIZE_MAX
+
+struct sheet_node {
+	char *name;
+	size_t name_len;
+	char *expr;					// NULL if the name has no formula
+	struct pcalc_program *prog;	// NULL if there is no formula or an error
+	enum retcode error;			// Of compiling expr
+	enum retcode ret;			// Result of the last computation
+	size_t level;
+	int dirty;
+	int changed;				// By the last computation
+};
+
+struct sheet {
+	struct pcalc_vars *vars;
+	struct sheet_node *nodes;
+	size_t len;
+	size_t cap;
+	int stale;					// The graph must be built again
+
+	// The graph in compressed rows, all in one block. Node i reads the nodes
+	// deps[dep_start[i]] up to deps[dep_start[i + 1]], and is read by users
+	// in the same way. The dirty nodes of level l are the first
+	// level_dirty[l] of queue[level_start[l]] up to queue[level_start[l + 1]].
+	size_t *graph;
+	size_t *dep_start;
+	size_t *deps;
+	size_t *user_start;
+	size_t *users;
+	size_t nlevels;
+	size_t *level_start;
+	size_t *level_dirty;
+	size_t *queue;
+	size_t *changed;			// Nodes changed by the last update, in order
+	size_t nchanged;
+
+	struct pool *pool;			// NULL for a single thread
+	size_t *level_nodes;		// The dirty nodes of the level being computed
+	size_t level_len;
+};
+
+// A sheet computed by nthreads threads
+struct sheet *sheet_new(unsigned nthreads)
+{
+	struct sheet *sh = calloc(1, sizeof(*sh));
+
+	if (sh == NULL)
+		return NULL;
+
+	sh->vars = pcalc_vars_new();
+
+	if (sh->vars == NULL || nthreads > 1 &&
+		(sh->pool = pool_new(nthreads)) == NULL) {
+		sheet_free(sh);
+		return NULL;
+	}
+
+	return sh;
+}
+
+void sheet_free(struct sheet *sh)
+{
+	if (sh) {
+		for (size_t i = 0; i < sh->len; i++) {
+			free(sh->nodes[i].name);
+			free(sh->nodes[i].expr);
+			pcalc_program_free(sh->nodes[i].prog);
+		}
+
+		pool_free(sh->pool);
+		pcalc_vars_free(sh->vars);
+		free(sh->nodes);
+		free(sh->graph);
+		free(sh);
+	}
+}
+
+// Add a node for the name of len characters at name, setting *index to it
+enum retcode sheet_add(struct sheet *sh, char *name, size_t len,
+					   size_t *index)
+{
+	struct sheet_node *node;
+	enum retcode ret;
+
+	if (!lex_is_var(name, len))
+		return PCALC_UKNOWN_TOKEN;
+
+	if (sh->len == sh->cap) {
+		size_t cap = sh->cap ? sh->cap * 2 : SHEET_CHUNK;
+		struct sheet_node *nodes = realloc(sh->nodes, cap * sizeof(*nodes));
+
+		if (nodes == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		sh->nodes = nodes;
+		sh->cap = cap;
+	}
+
+	node = &sh->nodes[sh->len];
+	node->name = malloc(len);
+
+	if (node->name == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	// Binds the name to the next slot
+	ret = pcalc_vars_set(sh->vars, name, len, 0);
+
+	if (ret != PCALC_OK) {
+		free(node->name);
+		return ret;
+	}
+
+	memcpy(node->name, name, len);
+	node->name_len = len;
+	node->expr = NULL;
+	node->prog = NULL;
+	node->error = PCALC_UNBOUND_VARIABLE;
+	node->ret = PCALC_UNBOUND_VARIABLE;
+	node->level = 0;
+	node->dirty = 0;
+	node->changed = 0;
+
+	*index = sh->len++;
+	sh->stale = 1;
+
+	return PCALC_OK;
+}
+
+// Compile the formula of node index. The names it uses that are not in the
+// sheet yet are added without a formula.
+enum retcode sheet_compile(struct sheet *sh, size_t index, char **errp,
+						   enum notation notation)
+{
+	for (;;) {
+		struct sheet_node *node = &sh->nodes[index];
+		char *expr = node->expr;
+		char *end = expr + strlen(expr);
+		char *p;
+		size_t added;
+		enum retcode ret;
+
+		ret = pcalc_compilen(&node->prog, errp, expr, end - expr, notation,
+							 sh->vars);
+
+		if (ret != PCALC_UNBOUND_VARIABLE)
+			return ret;
+
+		for (p = *errp; p < end && IS_NAME_CHAR(*p); p++)
+			;
+
+		ret = sheet_add(sh, *errp, p - *errp, &added);
+
+		if (ret != PCALC_OK)
+			return ret;
+	}
+}
+
+// Whether the formula of node index reads the same nodes as in the graph
+int sheet_same_deps(struct sheet *sh, size_t index)
+{
+	struct sheet_node *node = &sh->nodes[index];
+	size_t *deps = sh->deps + sh->dep_start[index];
+	size_t n = sh->dep_start[index + 1] - sh->dep_start[index];
+	size_t *slots;
+	int same;
+
+	if (node->prog == NULL)
+		return n == 0;
+	else if (pcalc_program_vars(node->prog, NULL) != n)
+		return 0;
+
+	slots = malloc(n * sizeof(*slots) + 1);
+
+	if (slots == NULL)
+		return 0;
+
+	pcalc_program_vars(node->prog, slots);
+	same = memcmp(slots, deps, n * sizeof(*slots)) == 0;
+	free(slots);
+
+	return same;
+}
+
+// Queue node index to be computed, unless it is already queued or depends on
+// a cycle
+void sheet_mark(struct sheet *sh, size_t index)
+{
+	struct sheet_node *node = &sh->nodes[index];
+
+	if (!node->dirty && node->level != SHEET_CIRCULAR) {
+		node->dirty = 1;
+		sh->queue[sh->level_start[node->level] +
+				  sh->level_dirty[node->level]++] = index;
+	}
+}
+
+// Set a formula from a line of the form name = expression of len characters,
+// replacing the formula of name if it has one. The formula and the ones that
+// depend on it are computed by the next sheet_update. A formula that fails to
+// compile is still set, and its error is its result. If an error occurs, *errp
+// will point to the offending part of line.
+enum retcode sheet_set(struct sheet *sh, char **errp, char *line, size_t len,
+					   enum notation notation)
+{
+	char *end = line + len;
+	char *name = scan_skip_space(line, end);
+	char *p = name;
+	char *err = NULL;
+	struct sheet_node *node;
+	size_t index;
+	enum retcode ret;
+
+	while (p < end && IS_NAME_CHAR(*p))
+		p++;
+
+	*errp = scan_skip_space(p, end);
+
+	if (*errp == end || **errp != '=')
+		return PCALC_INVALID_EXPRESSION;
+
+	if (!pcalc_vars_slot(sh->vars, name, p - name, &index)) {
+		ret = sheet_add(sh, name, p - name, &index);
+
+		if (ret == PCALC_UKNOWN_TOKEN)
+			*errp = name;
+
+		if (ret != PCALC_OK)
+			return ret;
+	}
+
+	p = *errp + 1;
+	node = &sh->nodes[index];
+	free(node->expr);
+	pcalc_program_free(node->prog);
+	node->prog = NULL;
+	node->expr = malloc(end - p + 1);
+
+	// Without its formula the node fails like a name that was only used
+	if (node->expr == NULL) {
+		node->dirty = 1;
+		sh->stale = 1;
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	memcpy(node->expr, p, end - p);
+	node->expr[end - p] = '\0';
+
+	ret = sheet_compile(sh, index, &err, notation);
+
+	// sheet_compile may have moved the nodes
+	node = &sh->nodes[index];
+	node->error = ret;
+
+	// Inputs are usually set to new values, and then the graph stays the same
+	if (!sh->stale && node->level != SHEET_CIRCULAR &&
+		sheet_same_deps(sh, index)) {
+		sheet_mark(sh, index);
+	}
+	else {
+		node->dirty = 1;
+		sh->stale = 1;
+	}
+
+	if (ret != PCALC_OK && err)
+		*errp = p + (err - node->expr);
+	else if (ret != PCALC_OK)
+		*errp = NULL;
+
+	return ret;
+}
+
+// Build the graph of the sheet and queue the dirty nodes. Nodes that come to
+// depend on a cycle, and so can not be computed, are changed.
+enum retcode sheet_build(struct sheet *sh)
+{
+	size_t n = sh->len;
+	size_t edges = 0;
+	size_t *graph, *dep_start, *deps, *user_start, *users, *level_start;
+	size_t *indeg, *order;
+	size_t head = 0;
+	size_t tail = 0;
+	size_t nlevels = 0;
+
+	for (size_t i = 0; i < n; i++)
+		if (sh->nodes[i].prog)
+			edges += pcalc_program_vars(sh->nodes[i].prog, NULL);
+
+	graph = malloc((6 * n + 3 + 2 * edges) * sizeof(*graph));
+	indeg = malloc((2 * n + 1) * sizeof(*indeg));
+
+	if (graph == NULL || indeg == NULL) {
+		free(graph);
+		free(indeg);
+		return PCALC_MEMORY_ALLOC;
+	}
+
+	dep_start = graph;
+	user_start = dep_start + n + 1;
+	level_start = user_start + n + 1;
+	deps = level_start + n + 1;
+	users = deps + edges;
+	sh->level_dirty = users + edges;
+	sh->queue = sh->level_dirty + n;
+	sh->changed = sh->queue + n;
+	order = indeg + n;
+
+	// Every node reads the nodes of its slots
+	dep_start[0] = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t k = dep_start[i];
+
+		if (sh->nodes[i].prog)
+			k += pcalc_program_vars(sh->nodes[i].prog, deps + k);
+
+		dep_start[i + 1] = k;
+		indeg[i] = k - dep_start[i];
+	}
+
+	// Count the users of each node, sum the counts to the end of each row and
+	// fill the rows from the end
+	for (size_t i = 0; i <= n; i++)
+		user_start[i] = 0;
+
+	for (size_t k = 0; k < edges; k++)
+		user_start[deps[k]]++;
+
+	for (size_t i = 1; i <= n; i++)
+		user_start[i] += user_start[i - 1];
+
+	for (size_t i = 0; i < n; i++)
+		for (size_t k = dep_start[i]; k < dep_start[i + 1]; k++)
+			users[--user_start[deps[k]]] = i;
+
+	// Kahn's algorithm, with the level of each node found on the way
+	for (size_t i = 0; i < n; i++) {
+		sh->nodes[i].level = 0;
+
+		if (indeg[i] == 0)
+			order[tail++] = i;
+	}
+
+	while (head < tail) {
+		size_t i = order[head++];
+		size_t level = sh->nodes[i].level;
+
+		if (level + 1 > nlevels)
+			nlevels = level + 1;
+
+		for (size_t k = user_start[i]; k < user_start[i + 1]; k++) {
+			struct sheet_node *user = &sh->nodes[users[k]];
+
+			if (user->level < level + 1)
+				user->level = level + 1;
+
+			if (--indeg[users[k]] == 0)
+				order[tail++] = users[k];
+		}
+	}
+
+	for (size_t l = 0; l <= nlevels; l++)
+		level_start[l] = 0;
+
+	sh->nchanged = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		struct sheet_node *node = &sh->nodes[i];
+
+		if (indeg[i] > 0) {
+			node->level = SHEET_CIRCULAR;
+			node->dirty = 0;
+
+			if (node->ret != PCALC_CIRCULAR_DEPENDENCY) {
+				node->ret = PCALC_CIRCULAR_DEPENDENCY;
+				sh->changed[sh->nchanged++] = i;
+			}
+		}
+		else {
+			// A node that no longer depends on a cycle is computed again
+			if (node->ret == PCALC_CIRCULAR_DEPENDENCY)
+				node->dirty = 1;
+
+			level_start[node->level + 1]++;
+		}
+	}
+
+	for (size_t l = 0; l < nlevels; l++) {
+		level_start[l + 1] += level_start[l];
+		sh->level_dirty[l] = 0;
+	}
+
+	free(sh->graph);
+	sh->graph = graph;
+	sh->dep_start = dep_start;
+	sh->deps = deps;
+	sh->user_start = user_start;
+	sh->users = users;
+	sh->level_start = level_start;
+	sh->nlevels = nlevels;
+	sh->stale = 0;
+
+	// Queue the dirty nodes in topological order
+	for (size_t j = 0; j < tail; j++) {
+		struct sheet_node *node = &sh->nodes[order[j]];
+
+		if (node->dirty)
+			sh->queue[level_start[node->level] +
+					  sh->level_dirty[node->level]++] = order[j];
+	}
+
+	free(indeg);
+
+	return PCALC_OK;
+}
+
+// Compute node index from the nodes it reads, which must be up to date. An
+// error in one of those is the result of the node too. Only writes to the
+// node and its slot, so the nodes of a level may be computed concurrently.
+void sheet_compute(struct sheet *sh, size_t index)
+{
+	struct sheet_node *node = &sh->nodes[index];
+	int old = pcalc_vars_values(sh->vars)[index];
+	int value = old;
+	enum retcode ret = node->expr ? node->error : PCALC_UNBOUND_VARIABLE;
+
+	for (size_t k = sh->dep_start[index];
+		 k < sh->dep_start[index + 1] && ret == PCALC_OK; k++)
+		ret = sh->nodes[sh->deps[k]].ret;
+
+	if (ret == PCALC_OK)
+		ret = pcalc_exec(&value, node->prog, NULL);
+
+	node->changed = ret != node->ret || ret == PCALC_OK && value != old;
+	node->ret = ret;
+
+	if (ret == PCALC_OK)
+		pcalc_vars_set_slot(sh->vars, index, value);
+}
+
+// Compute a chunk of the level on the thread pool. Unlike those of batch and
+// server jobs the computation needs no state of its own, so worker is unused.
+void sheet_job_run(void *arg, size_t job, unsigned worker)
+{
+	struct sheet *sh = arg;
+	size_t end = (job + 1) * SHEET_CHUNK;
+
+	for (size_t j = job * SHEET_CHUNK; j < end && j < sh->level_len; j++)
+		sheet_compute(sh, sh->level_nodes[j]);
+}
+
+// Compute the n nodes at nodes, which are of the same level
+void sheet_compute_level(struct sheet *sh, size_t *nodes, size_t n)
+{
+	size_t jobs = (n + SHEET_CHUNK - 1) / SHEET_CHUNK;
+
+	sh->level_nodes = nodes;
+	sh->level_len = n;
+
+	if (sh->pool && jobs > 1 && pool_start(sh->pool, jobs, sheet_job_run, sh))
+		pool_wait(sh->pool);
+	else
+		for (size_t i = 0; i < n; i++)
+			sheet_compute(sh, nodes[i]);
+}
+
+// Compute the dirty nodes and the nodes that depend on them. *changedp is set
+// to the nodes whose result changed, in topological order, and is valid until
+// the sheet is updated again.
+enum retcode sheet_update(struct sheet *sh, size_t **changedp,
+						  size_t *nchanged)
+{
+	if (sh->stale) {
+		if (sheet_build(sh) != PCALC_OK)
+			return PCALC_MEMORY_ALLOC;
+	}
+	else {
+		sh->nchanged = 0;
+	}
+
+	for (size_t l = 0; l < sh->nlevels; l++) {
+		size_t *nodes = sh->queue + sh->level_start[l];
+		size_t n = sh->level_dirty[l];
+
+		sheet_compute_level(sh, nodes, n);
+
+		// Users are always of a higher level, so they are queued after
+		// this level has been computed
+		for (size_t j = 0; j < n; j++) {
+			size_t i = nodes[j];
+			struct sheet_node *node = &sh->nodes[i];
+
+			node->dirty = 0;
+
+			if (!node->changed)
+				continue;
+
+			sh->changed[sh->nchanged++] = i;
+
+			for (size_t k = sh->user_start[i]; k < sh->user_start[i + 1];
+				 k++)
+				sheet_mark(sh, sh->users[k]);
+		}
+
+		sh->level_dirty[l] = 0;
+	}
+
+	*changedp = sh->changed;
+	*nchanged = sh->nchanged;
+
+	return PCALC_OK;
+}
+
+// Number of nodes, which are numbered from zero in the order their names
+// first appeared
+size_t sheet_len(struct sheet *sh)
+{
+	return sh->len;
+}
+
+// Whether the name of node has been given a formula, rather than only used
+int sheet_has_formula(struct sheet *sh, size_t node)
+{
+	return sh->nodes[node].expr != NULL;
+}
+
+const char *sheet_name(struct sheet *sh, size_t node, size_t *len)
+{
+	*len = sh->nodes[node].name_len;
+
+	return sh->nodes[node].name;
+}
+
+// Result of node as of the last update
+enum retcode sheet_value(struct sheet *sh, size_t node, int *value)
+{
+	if (sh->nodes[node].ret == PCALC_OK)
+		*value = pcalc_vars_values(sh->vars)[node];
+
+	return sh->nodes[node].ret;
+}
+
+// Print a node as name = value, or with nothing after the = and an error
+// record on err. Returns 0 for an error.
+int sheet_print(struct settings *s, struct sheet *sh, size_t node, FILE *out,
+				FILE *err)
+{
+	char buf[32];
+	size_t len = 0;
+	size_t name_len;
+	const char *name = sheet_name(sh, node, &name_len);
+	int value;
+	enum retcode ret = sheet_value(sh, node, &value);
+
+	if (ret == PCALC_OK && s->output == BASE_HEX && value == INT_MIN)
+		ret = PCALC_OUT_OF_BOUNDS;
+
+	if (ret == PCALC_OK && s->output == BASE_HEX)
+		len = format_hex(buf, value);
+	else if (ret == PCALC_OK)
+		len = format_decimal(buf, value);
+	else
+		fprintf(err, "%.*s: %s\n", (int)name_len, name, retcode_str(ret));
+
+	fprintf(out, "%.*s = %.*s\n", (int)name_len, name, (int)len, buf);
+
+	return ret == PCALC_OK;
+}
+
+// Set the formulas of the lines of stream, reporting errors with their line
+// and column numbers, after the path of the file unless it is NULL. If out is
+// not NULL, the sheet is updated after each line and the changed formulas
+// are printed. Returns 0 if a line failed.
+int sheet_read(struct settings *s, struct sheet *sh, FILE *stream,
+			   const char *path, FILE *out, FILE *err)
+{
+	char *line = NULL;
+	size_t size = 0;
+	size_t lineno = 0;
+	ssize_t len;
+	int ok = 1;
+	enum retcode ret = PCALC_OK;
+	size_t *changed;
+	size_t nchanged;
+
+	while ((len = getline(&line, &size, stream)) > 0) {
+		char *errp = NULL;
+
+		lineno++;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (is_blank(line, len))
+			continue;
+
+		ret = sheet_set(sh, &errp, line, len, s->notation);
+
+		if (ret == PCALC_MEMORY_ALLOC)
+			break;
+
+		if (ret != PCALC_OK && path)
+			fprintf(err, "%s:", path);
+
+		if (ret != PCALC_OK && errp)
+			fprintf(err, "%zu:%zu: %s\n", lineno, (size_t)(errp - line + 1),
+					retcode_str(ret));
+		else if (ret != PCALC_OK)
+			fprintf(err, "%zu: %s\n", lineno, retcode_str(ret));
+
+		if (ret != PCALC_OK)
+			ok = 0;
+
+		if (out == NULL)
+			continue;
+
+		if ((ret = sheet_update(sh, &changed, &nchanged)) != PCALC_OK)
+			break;
+
+		for (size_t i = 0; i < nchanged; i++)
+			if (sheet_has_formula(sh, changed[i]))
+				sheet_print(s, sh, changed[i], out, err);
+
+		fflush(out);
+	}
+
+	free(line);
+
+	if (ret == PCALC_MEMORY_ALLOC) {
+		fprintf(err, "Error: %s\n", retcode_str(ret));
+		return 0;
+	}
+
+	return ok;
+}
+
+// Compute the sheet in the file at path and print every formula in the order
+// of the file. Then set the formulas of the lines of in, printing the
+// formulas that change after each.
+int sheet_run(struct settings *s, const char *path, FILE *in, FILE *out,
+			  FILE *err)
+{
+	struct sheet *sh = sheet_new(s->jobs);
+	FILE *file = fopen(path, "r");
+	int status = EXIT_SUCCESS;
+	size_t *changed;
+	size_t nchanged;
+
+	if (file == NULL || sh == NULL) {
+		if (file == NULL)
+			perror(path);
+		else
+			fprintf(err, "Error: %s\n", retcode_str(PCALC_MEMORY_ALLOC));
+
+		if (file)
+			fclose(file);
+		sheet_free(sh);
+
+		return EXIT_FAILURE;
+	}
+
+	if (!sheet_read(s, sh, file, path, NULL, err))
+		status = EXIT_FAILURE;
+
+	if (ferror(file)) {
+		perror(path);
+		status = EXIT_FAILURE;
+	}
+
+	fclose(file);
+
+	if (sheet_update(sh, &changed, &nchanged) != PCALC_OK) {
+		fprintf(err, "Error: %s\n", retcode_str(PCALC_MEMORY_ALLOC));
+		sheet_free(sh);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < sheet_len(sh); i++)
+		if (sheet_has_formula(sh, i) && !sheet_print(s, sh, i, out, err))
+			status = EXIT_FAILURE;
+
+	fflush(out);
+
+	if (!sheet_read(s, sh, in, NULL, out, err))
+		status = EXIT_FAILURE;
+
+	sheet_free(sh);
+
+	return status;
+}
@@ -0,0 +1,46 @@
+//
+// sheet.h
+//
+//
+// Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <stdio.h>
+
+#include "settings.h"
+
+// Sheet of named formulas that is computed incrementally
+//
+// A formula is a line of the form
+//
+//     <name> = <expression>
+//
+// where the expression, in the notation of the settings, may use the names of
+// other formulas as variables. Setting a formula computes only the formulas
+// that depend on it, and those that are independent of each other may be
+// computed in parallel.
+
+// The dirty formulas of a level are computed in jobs of this many, and by a
+// single thread if there are no more than this
+#define SHEET_CHUNK 64
+
+struct sheet;
+
+struct sheet *sheet_new(unsigned nthreads);
+void sheet_free(struct sheet *sh);
+enum retcode sheet_set(struct sheet *sh, char **errp, char *line, size_t len,
+					   enum notation notation);
+enum retcode sheet_update(struct sheet *sh, size_t **changedp,
+						  size_t *nchanged);
+size_t sheet_len(struct sheet *sh);
+int sheet_has_formula(struct sheet *sh, size_t node);
+const char *sheet_name(struct sheet *sh, size_t node, size_t *len);
+enum retcode sheet_value(struct sheet *sh, size_t node, int *value);
+int sheet_run(struct settings *s, const char *path, FILE *in, FILE *out,
+			  FILE *err);
+
+#endif
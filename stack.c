@@ -7,51 +7,70 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "stack.h"
 #include "pcalc.h"
+#include "profile.h"
 
-void stack_init(struct stack *stack, size_t size)
+// Move the values to an array of size slots. The stack is left unchanged if
+// the array can not be allocated.
+enum retcode stack_grow(struct stack *stack, size_t size)
 {
-	stack->array = calloc(size, sizeof(*stack->array));
+	int *old = stack->array == stack->inline_array ? NULL : stack->array;
+	int *array;
+
+	if (stack->arena)
+		array = arena_realloc(stack->arena, old,
+							  stack->top * sizeof(*stack->array),
+							  size * sizeof(*stack->array));
+	else
+		array = realloc(old, size * sizeof(*stack->array));
+
+	if (array == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	if (old == NULL)
+		memcpy(array, stack->inline_array, stack->top * sizeof(*array));
+
+	stack->array = array;
 	stack->size = size;
-	stack->top = 0;
+
+	return PCALC_OK;
 }
 
-struct stack *stack_new(size_t size)
+// Make an empty stack with room for at least size values. Pass the maximum
+// depth if it is known so that pushing never has to grow the stack.
+enum retcode stack_init(struct stack *stack, size_t size, struct arena *arena)
 {
-	struct stack *stack = malloc(sizeof(struct stack));
-	if (stack == NULL) {
-		return NULL;
-	}
-	else {
-		stack_init(stack, size);
-		if (stack->array == NULL) {
-			free(stack);
-			return NULL;
-		}
-		else {
-			return stack;
-		}
-	}
+	stack->array = stack->inline_array;
+	stack->size = STACK_INLINE_SIZE;
+	stack->top = 0;
+	stack->arena = arena;
+
+	if (size > STACK_INLINE_SIZE)
+		return stack_grow(stack, size);
+
+	return PCALC_OK;
 }
 
-void stack_free(struct stack *stack)
+void stack_destroy(struct stack *stack)
 {
-	free(stack->array);
-	free(stack);
+	if (stack->arena == NULL && stack->array != stack->inline_array)
+		free(stack->array);
 }
 
 enum retcode stack_push(struct stack *stack, int value)
 {
 	if (stack->top == stack->size) {
-		stack->size *= 2;
-		stack->array = realloc(stack->array,
-							   stack->size * sizeof(*stack->array));
+		PROFILE_START(start);
+		enum retcode ret = stack_grow(stack, stack->size * 2);
+
+		PROFILE_STOP(PROF_T_GROW, start);
+		PROFILE_COUNT(PROF_STACK_GROW);
 
-		if (stack->array == NULL) {
-			return PCALC_MEMORY_ALLOC;
-		}
+		if (ret != PCALC_OK)
+			return ret;
 	}
 	stack->array[stack->top++] = value;
 	return PCALC_OK;
@@ -62,10 +81,7 @@ int stack_pop(struct stack *stack)
 {
 	assert(stack->top != 0);
 
-	int value = stack->array[stack->top - 1];
-	stack->array[stack->top - 1] = 0;
-	stack->top--;
-	return value;
+	return stack->array[--stack->top];
 }
 
 int stack_peek(struct stack *stack)
@@ -10,21 +10,29 @@
 #define STACK_H
 
 #include "pcalc.h"
+#include "arena.h"
 
+// Slots held in the stack structure itself. Shallower stacks never allocate.
+#define STACK_INLINE_SIZE 64
+
+// Stacks live in automatic storage and spill to the heap, or to arena if it
+// is not NULL, when they grow past STACK_INLINE_SIZE. Arena memory is
+// released when the arena is reset. A stack must not be copied, since array
+// may point into it.
 struct stack {
 	int *array;
 	size_t size;
 	size_t top;
+	struct arena *arena;
+	int inline_array[STACK_INLINE_SIZE];
 };
 
-void stack_init(struct stack *stack, size_t size);
-struct stack *stack_new(size_t size);
-void stack_free(struct stack *stack);
+enum retcode stack_init(struct stack *stack, size_t size, struct arena *arena);
+void stack_destroy(struct stack *stack);
 enum retcode stack_push(struct stack *stack, int value);
 int stack_pop(struct stack *stack);
 int stack_peek(struct stack *stack);
 int stack_is_empty(struct stack *stack);
-int stack_is_full(struct stack *stack);
 int stack_size(struct stack *stack);
 
 #endif
@@ -0,0 +1,92 @@
+//
+//  token.h
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#ifndef TOKEN_H
+#define TOKEN_H
+
+#include <stdint.h>
+
+#include "pcalc.h"
+#include "d_array.h"
+#include "arena.h"
+
+#define MIN_STACK_SIZE 16
+
+// ASCII character classes, independent of the locale
+#define IS_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_NAME_START(c) \
+	((c) >= 'a' && (c) <= 'z' || (c) >= 'A' && (c) <= 'Z' || (c) == '_')
+#define IS_NAME_CHAR(c) (IS_NAME_START(c) || IS_DIGIT(c))
+
+// Checked arithmetic uses the compiler's overflow builtins where they exist.
+// Define PCALC_PORTABLE_ARITH to use the portable comparison and division
+// based checks instead.
+#if !defined(PCALC_PORTABLE_ARITH) && \
+	(defined(__clang__) || defined(__GNUC__) && __GNUC__ >= 5)
+#define HAVE_OVERFLOW_BUILTINS
+#endif
+
+enum token_type {
+	NONE,
+	VALUE,
+	ANS,
+	VAR,		// Named variable, not resolved or not bound
+	SLOT,		// Variable resolved to its slot in a pcalc_vars table
+	OP_ADD,
+	OP_SUB,
+	OP_MULT,
+	OP_DIV,
+	OP_POW,
+	OP_MOD,
+	OP_SHL,
+	OP_SHR,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_MIN,
+	OP_MAX,
+	OP_NEG,		// Unary minus, only produced by inf_reorder
+	OP_LPAREN,
+	OP_RPAREN
+};
+
+// value will only be defined if type is VALUE, is the length of the name if
+// type is VAR, or the slot of the variable if type is SLOT
+// pos points to the first character of the token in the expression
+struct token {
+	enum token_type type;
+	int value;
+	char *pos;
+};
+
+int is_undefined_add(int a, int b);
+int is_undefined_sub(int a, int b);
+int is_undefined_mult(int a, int b);
+int is_undefined_div(int a, int b);
+int is_undefined_mod(int a, int b);
+int is_undefined_shl(int a, int b);
+int is_undefined_shr(int a, int b);
+enum retcode pcalc_binop(int *result, enum token_type op, int lval, int rval);
+enum retcode pcalc_unop(int *result, enum token_type op, int val);
+
+unsigned digit_value(char c);
+char *lex_prefix(char *head, char *end, int *negative, unsigned *base);
+enum retcode lex_number(int *value, char *head, char *end, char **endp);
+enum token_type lex_name(const char *name, size_t len);
+int lex_is_var(const char *name, size_t len);
+enum retcode lex_int64(int64_t *value, char *head, char *end, char **endp);
+enum retcode read_token(struct token *token, char *expr, char *end,
+						char **endp, int wide);
+enum retcode pn_tokenize(d_array *tokens, char **errp, char *expr, char *end,
+						 int wide);
+enum retcode inf_reorder(struct arena *arena, d_array *outq, char **errp,
+						 char *expr, char *end, int has_ans, int wide,
+						 const struct pcalc_vars *vars);
+
+#endif
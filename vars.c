@@ -0,0 +1,249 @@
+//
+//  vars.c
+//
+//
+//  Copyright 2015 Jacob Wahlgren
+//
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pcalc.h"
+#include "token.h"
+#include "scan.h"
+
+// Named variables for compiled expressions. pcalc_compilen looks names up in
+// an open addressing hash table and resolves them to the slot of their value,
+// so that a program reads its variables from a flat array and never compares
+// strings. Slots are handed out in the order names are first bound and
+// bindings are never removed, so a program stays valid as long as the table
+// and sees the values set after it was compiled. The table must not be
+// changed while a program using it runs.
+
+// Buckets of a new table, always a power of two at most half full
+#define VARS_MIN_BUCKETS 16
+
+// Slots are ints in programs and byte offsets in native code
+#define VARS_MAX (INT_MAX / sizeof(int))
+
+struct var_entry {
+	uint64_t hash;
+	char *name;			// NULL for an empty bucket
+	size_t len;
+	size_t slot;
+};
+
+struct pcalc_vars {
+	struct var_entry *buckets;
+	size_t mask;		// Number of buckets - 1
+	int *values;		// Indexed by slot
+	size_t len;			// Bound names, the next slot
+	size_t cap;			// Of values
+};
+
+// FNV-1a
+uint64_t vars_hash(const char *name, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// The bucket holding name, or the empty bucket where it would be inserted
+struct var_entry *vars_find(struct var_entry *buckets, size_t mask,
+							uint64_t hash, const char *name, size_t len)
+{
+	size_t i = hash & mask;
+
+	while (buckets[i].name && (buckets[i].hash != hash ||
+							   buckets[i].len != len ||
+							   memcmp(buckets[i].name, name, len) != 0))
+		i = (i + 1) & mask;
+
+	return &buckets[i];
+}
+
+// Double the number of buckets
+enum retcode vars_grow(struct pcalc_vars *vars)
+{
+	size_t mask = vars->mask * 2 + 1;
+	struct var_entry *buckets = calloc(mask + 1, sizeof(*buckets));
+
+	if (buckets == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	for (size_t i = 0; i <= vars->mask; i++) {
+		struct var_entry *e = &vars->buckets[i];
+
+		if (e->name)
+			*vars_find(buckets, mask, e->hash, e->name, e->len) = *e;
+	}
+
+	free(vars->buckets);
+	vars->buckets = buckets;
+	vars->mask = mask;
+
+	return PCALC_OK;
+}
+
+struct pcalc_vars *pcalc_vars_new(void)
+{
+	struct pcalc_vars *vars = calloc(1, sizeof(*vars));
+
+	if (vars == NULL)
+		return NULL;
+
+	vars->mask = VARS_MIN_BUCKETS - 1;
+	vars->buckets = calloc(VARS_MIN_BUCKETS, sizeof(*vars->buckets));
+
+	if (vars->buckets == NULL) {
+		free(vars);
+		return NULL;
+	}
+
+	return vars;
+}
+
+void pcalc_vars_free(struct pcalc_vars *vars)
+{
+	if (vars) {
+		for (size_t i = 0; i <= vars->mask; i++)
+			free(vars->buckets[i].name);
+
+		free(vars->buckets);
+		free(vars->values);
+		free(vars);
+	}
+}
+
+// Bind the name of len characters at name to value, or change its value if
+// it is bound. A name is read like an identifier in C, and may not be a
+// keyword such as ans or xor.
+enum retcode pcalc_vars_set(struct pcalc_vars *vars, const char *name,
+							size_t len, int value)
+{
+	uint64_t hash = vars_hash(name, len);
+	struct var_entry *e;
+
+	if (!lex_is_var(name, len))
+		return PCALC_UKNOWN_TOKEN;
+
+	e = vars_find(vars->buckets, vars->mask, hash, name, len);
+
+	if (e->name) {
+		vars->values[e->slot] = value;
+		return PCALC_OK;
+	}
+
+	if (vars->len == VARS_MAX)
+		return PCALC_OUT_OF_BOUNDS;
+
+	if (vars->len == vars->cap) {
+		size_t cap = vars->cap ? vars->cap * 2 : VARS_MIN_BUCKETS;
+		int *values = realloc(vars->values, cap * sizeof(*values));
+
+		if (values == NULL)
+			return PCALC_MEMORY_ALLOC;
+
+		vars->values = values;
+		vars->cap = cap;
+	}
+
+	// Keep the table at most half full, so that probe sequences stay short
+	if ((vars->len + 1) * 2 > vars->mask + 1) {
+		if (vars_grow(vars) != PCALC_OK)
+			return PCALC_MEMORY_ALLOC;
+
+		e = vars_find(vars->buckets, vars->mask, hash, name, len);
+	}
+
+	e->name = malloc(len);
+
+	if (e->name == NULL)
+		return PCALC_MEMORY_ALLOC;
+
+	memcpy(e->name, name, len);
+	e->hash = hash;
+	e->len = len;
+	e->slot = vars->len++;
+	vars->values[e->slot] = value;
+
+	return PCALC_OK;
+}
+
+// Bind a variable from a binding of the form name = value of len characters,
+// where value is an integer literal. The spaces are optional. If an error
+// occurs, *errp will point to the offending part of binding.
+enum retcode pcalc_vars_bind(struct pcalc_vars *vars, char **errp,
+							 char *binding, size_t len)
+{
+	char *end = binding + len;
+	char *name = scan_skip_space(binding, end);
+	char *p = name;
+	size_t name_len;
+	int value;
+	enum retcode ret;
+
+	while (p < end && IS_NAME_CHAR(*p))
+		p++;
+
+	name_len = p - name;
+	*errp = p = scan_skip_space(p, end);
+
+	if (p == end || *p != '=')
+		return PCALC_INVALID_EXPRESSION;
+
+	*errp = p = scan_skip_space(p + 1, end);
+	ret = lex_number(&value, p, end, &p);
+
+	if (ret == PCALC_OK && scan_skip_space(p, end) != end) {
+		*errp = p;
+		ret = PCALC_UKNOWN_TOKEN;
+	}
+
+	if (ret != PCALC_OK)
+		return ret;
+
+	ret = pcalc_vars_set(vars, name, name_len, value);
+
+	if (ret == PCALC_UKNOWN_TOKEN)
+		*errp = name;
+
+	return ret;
+}
+
+// Whether the name of len characters at name is bound, and if so its slot
+int pcalc_vars_slot(const struct pcalc_vars *vars, const char *name,
+					size_t len, size_t *slot)
+{
+	struct var_entry *e = vars_find(vars->buckets, vars->mask,
+									vars_hash(name, len), name, len);
+
+	if (e->name)
+		*slot = e->slot;
+
+	return e->name != NULL;
+}
+
+// Set the value of the variable in slot, see pcalc_vars_slot. Unlike
+// pcalc_vars_set this never looks up the name, and variables in different
+// slots may be set from different threads.
+void pcalc_vars_set_slot(struct pcalc_vars *vars, size_t slot, int value)
+{
+	vars->values[slot] = value;
+}
+
+// Values of the variables indexed by slot. The array moves when a new name is
+// bound.
+const int *pcalc_vars_values(const struct pcalc_vars *vars)
+{
+	return vars->values;
+}